@@ -0,0 +1,487 @@
+// -*- mode: c++; tab-width: 2; indent-tabs-mode: nil; -*-
+//----------------------------------------------------------------------------
+// Asynchronous output sinks (io_uring, with an epoll fallback).
+//----------------------------------------------------------------------------
+// This is free and unencumbered software released into the public domain.
+//
+// Anyone is free to copy, modify, publish, use, compile, sell, or
+// distribute this software, either in source code form or as a compiled
+// binary, for any purpose, commercial or non-commercial, and by any
+// means.
+//
+// In jurisdictions that recognize copyright laws, the author or authors
+// of this software dedicate any and all copyright interest in the
+// software to the public domain. We make this dedication for the benefit
+// of the public at large and to the detriment of our heirs and
+// successors. We intend this dedication to be an overt act of
+// relinquishment in perpetuity of all present and future rights to this
+// software under copyright law.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+// OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+// ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+//
+// For more information, please refer to <http://unlicense.org/>
+//----------------------------------------------------------------------------
+
+#ifndef ASYNC_SINK_H_
+#define ASYNC_SINK_H_
+
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+// IO_URING_OP_SUPPORTED comes with IORING_OP_WRITE and IORING_REGISTER_PROBE
+// (Linux 5.6).
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) && \
+    defined(__NR_io_uring_register) && defined(IO_URING_OP_SUPPORTED)
+#define HTMLGEN_HAVE_IO_URING
+#endif
+#endif
+#endif
+
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "document.h"
+
+namespace htmlgen {
+
+class AsyncSink;
+
+/// @brief An engine that performs the writes of many AsyncSinks from a
+/// single thread.
+///
+/// Writes are submitted through io_uring where the kernel supports it (Linux
+/// 5.6 or later, where the ring supports IORING_OP_WRITE), and otherwise
+/// written with non-blocking write calls, waiting for descriptors
+/// to become writable with epoll. With the epoll backend, the descriptors
+/// must be in non-blocking mode.
+///
+/// Each AsyncSink has at most one write in flight, which keeps the output of
+/// a sink in order. The engine is not thread safe: it and its sinks must be
+/// used from one thread.
+///
+/// @note Writing to a closed pipe or socket raises SIGPIPE, as with write,
+/// so servers normally ignore that signal.
+class AsyncOutput {
+  public:
+    /// @brief The mechanism that is used for the writes.
+    enum Backend {
+      kAuto,     ///< io_uring if available, otherwise epoll.
+      kIoUring,  ///< io_uring (falls back to epoll if unavailable).
+      kEpoll     ///< Non-blocking writes and epoll.
+    };
+
+    /// @param backend The mechanism that is used for the writes.
+    /// @param queue_depth The maximum number of writes in flight.
+    explicit AsyncOutput(Backend backend = kAuto, unsigned queue_depth = 256) :
+        ring_fd_(-1), epoll_fd_(-1), max_in_flight_(queue_depth),
+        in_flight_(0), to_submit_(0) {
+      if (backend != kEpoll)
+        SetUpRing(queue_depth);
+      if (ring_fd_ < 0)
+        epoll_fd_ = ::epoll_create1(EPOLL_CLOEXEC);
+    }
+
+    ~AsyncOutput() {
+#if defined(HTMLGEN_HAVE_IO_URING)
+      if (ring_fd_ >= 0) {
+        ::munmap(sqes_, sqes_size_);
+        if (cq_ptr_ != sq_ptr_)
+          ::munmap(cq_ptr_, cq_size_);
+        ::munmap(sq_ptr_, sq_size_);
+        ::close(ring_fd_);
+      }
+#endif
+      if (epoll_fd_ >= 0)
+        ::close(epoll_fd_);
+    }
+
+    /// @brief Check if io_uring is used.
+    bool using_io_uring() const {
+      return ring_fd_ >= 0;
+    }
+
+    /// @brief Process completed writes, and start the next writes of the
+    /// sinks.
+    /// @param wait Wait until at least one write has completed.
+    /// @returns false if there were no writes in flight.
+    bool Poll(bool wait) {
+      if (in_flight_ == 0)
+        return false;
+#if defined(HTMLGEN_HAVE_IO_URING)
+      if (ring_fd_ >= 0) {
+        PollRing(wait);
+        return true;
+      }
+#endif
+      PollEpoll(wait);
+      return true;
+    }
+
+    /// @brief Wait until all writes have completed.
+    void Drain() {
+      while (Poll(true)) {
+      }
+    }
+
+  private:
+    friend class AsyncSink;
+
+    AsyncOutput(const AsyncOutput&) = delete;
+    AsyncOutput& operator=(const AsyncOutput&) = delete;
+
+    /// @brief Start writing the first queued buffer of a sink.
+    inline void StartWrite(AsyncSink* sink);
+
+    /// @brief Forget a sink that is being destroyed.
+    inline void Unregister(AsyncSink* sink);
+
+    inline void PollEpoll(bool wait);
+
+#if defined(HTMLGEN_HAVE_IO_URING)
+    void SetUpRing(unsigned entries) {
+      struct io_uring_params params;
+      std::memset(&params, 0, sizeof(params));
+      int fd = static_cast<int>(
+          ::syscall(__NR_io_uring_setup, entries, &params));
+      if (fd < 0)
+        return;
+      if (!SupportsWrite(fd)) {
+        ::close(fd);
+        return;
+      }
+
+      sq_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+      cq_size_ = params.cq_off.cqes +
+                 params.cq_entries * sizeof(struct io_uring_cqe);
+      bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+      if (single_mmap && cq_size_ > sq_size_)
+        sq_size_ = cq_size_;
+      sq_ptr_ = ::mmap(nullptr, sq_size_, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+      if (sq_ptr_ == MAP_FAILED) {
+        ::close(fd);
+        return;
+      }
+      cq_ptr_ = sq_ptr_;
+      if (!single_mmap) {
+        cq_ptr_ = ::mmap(nullptr, cq_size_, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cq_ptr_ == MAP_FAILED) {
+          ::munmap(sq_ptr_, sq_size_);
+          ::close(fd);
+          return;
+        }
+      }
+      sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+      void* sqes = ::mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+      if (sqes == MAP_FAILED) {
+        if (cq_ptr_ != sq_ptr_)
+          ::munmap(cq_ptr_, cq_size_);
+        ::munmap(sq_ptr_, sq_size_);
+        ::close(fd);
+        return;
+      }
+      sqes_ = static_cast<struct io_uring_sqe*>(sqes);
+
+      char* sq = static_cast<char*>(sq_ptr_);
+      sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+      sq_mask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+      sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+      char* cq = static_cast<char*>(cq_ptr_);
+      cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+      cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+      cq_mask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+      cqes_ = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+
+      // Each write in flight needs a submission queue entry until it has
+      // been submitted, and a completion queue entry.
+      if (max_in_flight_ > params.sq_entries)
+        max_in_flight_ = params.sq_entries;
+      ring_fd_ = fd;
+    }
+
+    /// @brief Check if a ring supports IORING_OP_WRITE. Linux 5.1 to 5.5 can
+    /// set up a ring, but fail each write with EINVAL, and they fail the probe
+    /// as well.
+    static bool SupportsWrite(int ring_fd) {
+      const unsigned kNumOps = 256;
+      std::vector<char> buffer(sizeof(struct io_uring_probe) +
+                               kNumOps * sizeof(struct io_uring_probe_op));
+      struct io_uring_probe* probe =
+          reinterpret_cast<struct io_uring_probe*>(buffer.data());
+      if (::syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PROBE,
+                    probe, kNumOps) < 0)
+        return false;
+      return probe->last_op >= IORING_OP_WRITE &&
+             (probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED) != 0;
+    }
+
+    /// @brief Queue a write request.
+    void SubmitWrite(int fd, const char* data, size_t len,
+                     AsyncSink* sink) {
+      unsigned tail = *sq_tail_;
+      unsigned index = tail & sq_mask_;
+      struct io_uring_sqe* sqe = &sqes_[index];
+      std::memset(sqe, 0, sizeof(*sqe));
+      sqe->opcode = IORING_OP_WRITE;
+      sqe->fd = fd;
+      sqe->addr = reinterpret_cast<uint64_t>(data);
+      sqe->len = static_cast<uint32_t>(len);
+      sqe->off = static_cast<uint64_t>(-1);  // Use the file position.
+      sqe->user_data = reinterpret_cast<uint64_t>(sink);
+      sq_array_[index] = index;
+      __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+      ++to_submit_;
+    }
+
+    inline void PollRing(bool wait);
+#else
+    void SetUpRing(unsigned) {}
+#endif
+
+#if defined(HTMLGEN_HAVE_IO_URING)
+    void* sq_ptr_;
+    void* cq_ptr_;
+    size_t sq_size_;
+    size_t cq_size_;
+    size_t sqes_size_;
+    struct io_uring_sqe* sqes_;
+    unsigned* sq_tail_;
+    unsigned sq_mask_;
+    unsigned* sq_array_;
+    unsigned* cq_head_;
+    unsigned* cq_tail_;
+    unsigned cq_mask_;
+    struct io_uring_cqe* cqes_;
+#endif
+    int ring_fd_;
+    int epoll_fd_;
+    unsigned max_in_flight_;
+    unsigned in_flight_;
+    unsigned to_submit_;
+};
+
+/// @brief A Sink that writes to a file descriptor through an AsyncOutput.
+///
+/// Each chunk that the Writer passes on is copied to a buffer and queued, so
+/// the serializer can continue while the data is written. When all buffers
+/// are in use, Write() pauses the serializer and processes the writes of all
+/// the sinks of the AsyncOutput until a buffer is free. This way one thread
+/// can stream many pages to slow clients, with a bounded amount of memory
+/// per client.
+///
+/// @code{.cpp}
+///   htmlgen::AsyncOutput output;
+///   std::vector<std::unique_ptr<htmlgen::AsyncSink> > sinks;
+///   for (auto& request : requests) {
+///     sinks.emplace_back(new htmlgen::AsyncSink(output, request.fd));
+///     std::string buffer;
+///     htmlgen::Document::Writer writer(buffer);
+///     writer.SetSink(sinks.back().get());
+///     request.doc.Write(writer);
+///   }
+///   output.Drain();
+/// @endcode
+class AsyncSink : public Document::Sink {
+  public:
+    /// @param output The AsyncOutput that performs the writes.
+    /// @param fd The file descriptor. It is not closed by the sink.
+    /// @param max_buffers The maximum number of queued buffers.
+    AsyncSink(AsyncOutput& output, int fd, size_t max_buffers = 4) :
+        output_(output), fd_(fd), max_buffers_(max_buffers ? max_buffers : 1),
+        head_offset_(0), error_(0), bytes_written_(0), registered_(false) {}
+
+    /// @brief Wait until all queued data has been written.
+    virtual ~AsyncSink() {
+      Finish();
+      output_.Unregister(this);
+    }
+
+    virtual void Write(const char* data, size_t len) {
+      if (len == 0)
+        return;
+      while (queue_.size() >= max_buffers_ && error_ == 0)
+        output_.Poll(true);
+      if (error_ != 0)
+        return;
+
+      if (free_.empty()) {
+        queue_.push_back(std::string(data, len));
+      } else {
+        queue_.push_back(std::string());
+        queue_.back().swap(free_.back());
+        free_.pop_back();
+        queue_.back().assign(data, len);
+      }
+      if (queue_.size() == 1)
+        output_.StartWrite(this);
+    }
+
+    /// @brief Wait until all queued data has been written.
+    /// @returns true if all data was written.
+    bool Finish() {
+      while (!queue_.empty() && error_ == 0)
+        output_.Poll(true);
+      return ok();
+    }
+
+    /// @brief Check if all queued data has been written.
+    bool done() const {
+      return queue_.empty();
+    }
+
+    /// @brief Check if no write has failed.
+    bool ok() const {
+      return error_ == 0;
+    }
+
+    /// @brief Get the error number of the failed write, or 0.
+    virtual int error() const {
+      return error_;
+    }
+
+    /// @brief Get the number of bytes written.
+    uint64_t bytes_written() const {
+      return bytes_written_;
+    }
+
+  private:
+    friend class AsyncOutput;
+
+    AsyncSink(const AsyncSink&) = delete;
+    AsyncSink& operator=(const AsyncSink&) = delete;
+
+    const char* pending_data() const {
+      return queue_.front().data() + head_offset_;
+    }
+
+    size_t pending_size() const {
+      return queue_.front().size() - head_offset_;
+    }
+
+    /// @brief Handle the result of a write of the first queued buffer.
+    /// @returns true if there is more to write.
+    bool OnWritten(long result) {
+      if (result <= 0) {
+        error_ = result < 0 ? static_cast<int>(-result) : EIO;
+        queue_.clear();
+        head_offset_ = 0;
+        return false;
+      }
+      bytes_written_ += static_cast<uint64_t>(result);
+      head_offset_ += static_cast<size_t>(result);
+      if (head_offset_ == queue_.front().size()) {
+        free_.push_back(std::string());
+        free_.back().swap(queue_.front());
+        queue_.pop_front();
+        head_offset_ = 0;
+      }
+      return !queue_.empty();
+    }
+
+    AsyncOutput& output_;
+    const int fd_;
+    const size_t max_buffers_;
+    std::deque<std::string> queue_;
+    std::vector<std::string> free_;
+    size_t head_offset_;
+    int error_;
+    uint64_t bytes_written_;
+    bool registered_;  // Registered with epoll.
+};
+
+void AsyncOutput::StartWrite(AsyncSink* sink) {
+#if defined(HTMLGEN_HAVE_IO_URING)
+  if (ring_fd_ >= 0) {
+    while (in_flight_ >= max_in_flight_)
+      PollRing(true);
+    SubmitWrite(sink->fd_, sink->pending_data(), sink->pending_size(), sink);
+    ++in_flight_;
+    return;
+  }
+#endif
+
+  while (true) {
+    ssize_t n = ::write(sink->fd_, sink->pending_data(),
+                        sink->pending_size());
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      // Wait for the descriptor to become writable.
+      struct epoll_event event;
+      event.events = EPOLLOUT | EPOLLONESHOT;
+      event.data.ptr = sink;
+      int op = sink->registered_ ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+      if (::epoll_ctl(epoll_fd_, op, sink->fd_, &event) != 0) {
+        sink->OnWritten(-errno);
+        return;
+      }
+      sink->registered_ = true;
+      ++in_flight_;
+      return;
+    }
+    if (!sink->OnWritten(n < 0 ? -errno : n))
+      return;
+  }
+}
+
+void AsyncOutput::Unregister(AsyncSink* sink) {
+  if (sink->registered_ && epoll_fd_ >= 0) {
+    struct epoll_event event;
+    ::epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, sink->fd_, &event);
+  }
+}
+
+void AsyncOutput::PollEpoll(bool wait) {
+  struct epoll_event events[64];
+  int n = ::epoll_wait(epoll_fd_, events, 64, wait ? -1 : 0);
+  for (int i = 0; i < n; ++i) {
+    --in_flight_;
+    StartWrite(static_cast<AsyncSink*>(events[i].data.ptr));
+  }
+}
+
+#if defined(HTMLGEN_HAVE_IO_URING)
+void AsyncOutput::PollRing(bool wait) {
+  // Submit the queued requests, and wait for a completion if requested.
+  unsigned flags = wait ? IORING_ENTER_GETEVENTS : 0;
+  if (to_submit_ > 0 || wait) {
+    long submitted = ::syscall(__NR_io_uring_enter, ring_fd_, to_submit_,
+                               wait ? 1 : 0, flags, nullptr, 0);
+    if (submitted > 0)
+      to_submit_ -= static_cast<unsigned>(submitted);
+  }
+
+  unsigned head = *cq_head_;
+  unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+  while (head != tail) {
+    struct io_uring_cqe* cqe = &cqes_[head & cq_mask_];
+    AsyncSink* sink = reinterpret_cast<AsyncSink*>(cqe->user_data);
+    long result = cqe->res;
+    __atomic_store_n(cq_head_, ++head, __ATOMIC_RELEASE);
+    --in_flight_;
+    if (sink->OnWritten(result))
+      StartWrite(sink);
+  }
+}
+#endif
+
+} // namespace htmlgen
+
+#endif // ASYNC_SINK_H_
@@ -0,0 +1,329 @@
+// -*- mode: c++; tab-width: 2; indent-tabs-mode: nil; -*-
+//----------------------------------------------------------------------------
+// An output buffer made of a list of pooled, fixed size chunks.
+//----------------------------------------------------------------------------
+// This is free and unencumbered software released into the public domain.
+//
+// Anyone is free to copy, modify, publish, use, compile, sell, or
+// distribute this software, either in source code form or as a compiled
+// binary, for any purpose, commercial or non-commercial, and by any
+// means.
+//
+// In jurisdictions that recognize copyright laws, the author or authors
+// of this software dedicate any and all copyright interest in the
+// software to the public domain. We make this dedication for the benefit
+// of the public at large and to the detriment of our heirs and
+// successors. We intend this dedication to be an overt act of
+// relinquishment in perpetuity of all present and future rights to this
+// software under copyright law.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+// OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+// ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+//
+// For more information, please refer to <http://unlicense.org/>
+//----------------------------------------------------------------------------
+
+#ifndef CHUNKED_OUTPUT_H_
+#define CHUNKED_OUTPUT_H_
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "document.h"
+
+namespace htmlgen {
+
+/// @brief A pool of fixed size memory chunks, which are reused by
+/// ChunkedOutputs.
+///
+/// The pool is thread safe. It must outlive the ChunkedOutputs that use it.
+class ChunkPool {
+  public:
+    static const size_t kDefaultChunkSize = 64 * 1024;
+
+    /// @param chunk_size The size of each chunk.
+    /// @param max_free The maximum number of unused chunks that are kept.
+    explicit ChunkPool(size_t chunk_size = kDefaultChunkSize,
+                       size_t max_free = 256) :
+        chunk_size_(chunk_size == 0 ? 1 : chunk_size), max_free_(max_free) {}
+
+    ~ChunkPool() {
+      for (size_t i = 0; i < free_.size(); ++i)
+        delete[] free_[i];
+    }
+
+    /// @brief Get the pool that ChunkedOutputs use by default.
+    static ChunkPool& Default() {
+      // Never destroyed, so that it can be used during static destruction.
+      static ChunkPool* pool = new ChunkPool();
+      return *pool;
+    }
+
+    /// @brief Get the size of each chunk.
+    size_t chunk_size() const {
+      return chunk_size_;
+    }
+
+    /// @brief Get a chunk (a reused one if possible).
+    char* Acquire() {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!free_.empty()) {
+          char* chunk = free_.back();
+          free_.pop_back();
+          return chunk;
+        }
+      }
+      return new char[chunk_size_];
+    }
+
+    /// @brief Return a chunk that was obtained with Acquire().
+    void Release(char* chunk) {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (free_.size() < max_free_) {
+          free_.push_back(chunk);
+          return;
+        }
+      }
+      delete[] chunk;
+    }
+
+    /// @brief Get the number of unused chunks in the pool.
+    size_t free_count() const {
+      std::lock_guard<std::mutex> lock(mutex_);
+      return free_.size();
+    }
+
+  private:
+    ChunkPool(const ChunkPool&) = delete;
+    ChunkPool& operator=(const ChunkPool&) = delete;
+
+    const size_t chunk_size_;
+    const size_t max_free_;
+    mutable std::mutex mutex_;
+    std::vector<char*> free_;
+};
+
+/// @brief An output buffer made of a list of fixed size chunks.
+///
+/// Unlike a std::string, the buffer never reallocates or copies the HTML
+/// that it already holds as it grows, and it needs no large contiguous
+/// block of memory. This lowers the peak memory use for large documents.
+/// The chunks come from a ChunkPool, and are returned to it by Clear() and
+/// the destructor.
+///
+/// A ChunkedOutput is a Sink, so it can receive the HTML from a Writer (see
+/// Render()). The HTML can then be iterated over chunk by chunk, written to
+/// a file descriptor with writev (see WriteTo()), or copied into a string
+/// (see Flatten()).
+///
+/// @code{.cpp}
+///   htmlgen::ChunkedOutput out;
+///   out.Render(doc);
+///   if (out.WriteTo(client_socket) != 0)
+///     perror("writev");
+/// @endcode
+class ChunkedOutput : public Document::Sink {
+  public:
+    /// @brief A part of the output.
+    struct Chunk {
+      char* data;
+      size_t size;
+    };
+
+    typedef std::vector<Chunk>::const_iterator const_iterator;
+
+    /// @param pool The pool that chunks are taken from.
+    explicit ChunkedOutput(ChunkPool& pool = ChunkPool::Default()) :
+        pool_(&pool), size_(0) {}
+
+    ChunkedOutput(ChunkedOutput&& other) :
+        pool_(other.pool_), chunks_(std::move(other.chunks_)),
+        size_(other.size_) {
+      other.chunks_.clear();
+      other.size_ = 0;
+    }
+
+    ChunkedOutput& operator=(ChunkedOutput&& other) {
+      if (this != &other) {
+        Clear();
+        pool_ = other.pool_;
+        chunks_.swap(other.chunks_);
+        size_ = other.size_;
+        other.size_ = 0;
+      }
+      return *this;
+    }
+
+    virtual ~ChunkedOutput() {
+      Clear();
+    }
+
+    virtual void Write(const char* data, size_t len) {
+      const size_t chunk_size = pool_->chunk_size();
+      while (len > 0) {
+        if (chunks_.empty() || chunks_.back().size == chunk_size) {
+          Chunk chunk = {pool_->Acquire(), 0};
+          chunks_.push_back(chunk);
+        }
+        Chunk& chunk = chunks_.back();
+        size_t n = chunk_size - chunk.size;
+        if (n > len)
+          n = len;
+        std::memcpy(chunk.data + chunk.size, data, n);
+        chunk.size += n;
+        size_ += n;
+        data += n;
+        len -= n;
+      }
+    }
+
+    /// @brief Write a document to this output (after the current content).
+    ///
+    /// The Writer builds the HTML in a buffer string, which is copied into
+    /// the chunks whenever it has reached the chunk size (checked between
+    /// nodes, see Document::Writer::SetSink()). The HTML is thus copied
+    /// twice. The buffer usually holds about one chunk, but a node that is
+    /// larger (e.g. a long text node) is held whole, and so is a fragment
+    /// that is captured for a fragment cache (see
+    /// Document::Writer::BeginCapture()).
+    /// @param doc The document.
+    void Render(const Document& doc) {
+      std::string buffer;
+      buffer.reserve(pool_->chunk_size());
+      Document::Writer writer(buffer);
+      writer.SetSink(this, pool_->chunk_size());
+      doc.Write(writer);
+    }
+
+    /// @brief Get the total size of the output.
+    size_t size() const {
+      return size_;
+    }
+
+    bool empty() const {
+      return size_ == 0;
+    }
+
+    /// @brief Get the chunks, in order. Only the last chunk may be partially
+    /// filled.
+    const std::vector<Chunk>& chunks() const {
+      return chunks_;
+    }
+
+    const_iterator begin() const {
+      return chunks_.begin();
+    }
+
+    const_iterator end() const {
+      return chunks_.end();
+    }
+
+    /// @brief Append the output to a string.
+    void AppendTo(std::string& out) const {
+      out.reserve(out.size() + size_);
+      for (size_t i = 0; i < chunks_.size(); ++i)
+        out.append(chunks_[i].data, chunks_[i].size);
+    }
+
+    /// @brief Get the output as a single string.
+    std::string Flatten() const {
+      std::string out;
+      AppendTo(out);
+      return out;
+    }
+
+    /// @brief Get an I/O vector (for writev) that describes the output.
+    /// @param[out] iov The vector that the entries are appended to.
+    void GetIovecs(std::vector<struct iovec>& iov) const {
+      iov.reserve(iov.size() + chunks_.size());
+      for (size_t i = 0; i < chunks_.size(); ++i) {
+        struct iovec entry;
+        entry.iov_base = chunks_[i].data;
+        entry.iov_len = chunks_[i].size;
+        iov.push_back(entry);
+      }
+    }
+
+    /// @brief Write the output to a file descriptor with writev.
+    ///
+    /// Partial writes are continued, and non-blocking descriptors are
+    /// waited on with poll. The output is left unchanged.
+    /// @param fd The file descriptor.
+    /// @returns 0 on success, or the error number of the failed write.
+    int WriteTo(int fd) const {
+      std::vector<struct iovec> iov;
+      GetIovecs(iov);
+      size_t first = 0;
+      while (first < iov.size()) {
+        size_t count = iov.size() - first;
+        if (count > kMaxIovecs)
+          count = kMaxIovecs;
+        ssize_t n = ::writev(fd, &iov[first], static_cast<int>(count));
+        if (n < 0 && errno == EINTR)
+          continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+          struct pollfd pfd;
+          pfd.fd = fd;
+          pfd.events = POLLOUT;
+          pfd.revents = 0;
+          if (::poll(&pfd, 1, -1) >= 0 || errno == EINTR)
+            continue;
+        }
+        if (n <= 0)
+          return n < 0 ? errno : EIO;
+
+        // Skip what was written.
+        size_t written = static_cast<size_t>(n);
+        while (written > 0 && written >= iov[first].iov_len)
+          written -= iov[first++].iov_len;
+        if (written > 0) {
+          iov[first].iov_base = static_cast<char*>(iov[first].iov_base) +
+                                written;
+          iov[first].iov_len -= written;
+        }
+      }
+      return 0;
+    }
+
+    /// @brief Remove the output, and return the chunks to the pool.
+    void Clear() {
+      for (size_t i = 0; i < chunks_.size(); ++i)
+        pool_->Release(chunks_[i].data);
+      chunks_.clear();
+      size_ = 0;
+    }
+
+  private:
+#if defined(IOV_MAX)
+    static const size_t kMaxIovecs = IOV_MAX;
+#else
+    static const size_t kMaxIovecs = 1024;
+#endif
+
+    ChunkedOutput(const ChunkedOutput&) = delete;
+    ChunkedOutput& operator=(const ChunkedOutput&) = delete;
+
+    ChunkPool* pool_;
+    std::vector<Chunk> chunks_;
+    size_t size_;
+};
+
+} // namespace htmlgen
+
+#endif // CHUNKED_OUTPUT_H_
@@ -0,0 +1,297 @@
+// -*- mode: c++; tab-width: 2; indent-tabs-mode: nil; -*-
+//----------------------------------------------------------------------------
+// A streaming CSV to HTML table converter.
+//----------------------------------------------------------------------------
+// This is free and unencumbered software released into the public domain.
+//
+// Anyone is free to copy, modify, publish, use, compile, sell, or
+// distribute this software, either in source code form or as a compiled
+// binary, for any purpose, commercial or non-commercial, and by any
+// means.
+//
+// In jurisdictions that recognize copyright laws, the author or authors
+// of this software dedicate any and all copyright interest in the
+// software to the public domain. We make this dedication for the benefit
+// of the public at large and to the detriment of our heirs and
+// successors. We intend this dedication to be an overt act of
+// relinquishment in perpetuity of all present and future rights to this
+// software under copyright law.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+// OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+// ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+//
+// For more information, please refer to <http://unlicense.org/>
+//----------------------------------------------------------------------------
+
+#ifndef CSV_TABLE_H_
+#define CSV_TABLE_H_
+
+#include <cstddef>
+#include <string>
+
+#include "document.h"
+
+namespace htmlgen {
+
+/// @brief Options for CsvTableConverter.
+struct CsvTableOptions {
+  CsvTableOptions() : delimiter(','), quote('"'), header(true),
+      ascii_only(false), chunk_size(64 * 1024) {}
+
+  char delimiter;     ///< The field delimiter (e.g. ',' or '\t').
+  char quote;         ///< The quote character ('\0' disables quoting).
+  bool header;        ///< Write the first row as a <thead> with <th> cells.
+  bool ascii_only;    ///< Write non-ASCII characters as character references.
+  size_t chunk_size;  ///< The output chunk size, in bytes.
+};
+
+/// @brief A converter that writes CSV or TSV data as an HTML table.
+///
+/// The input is scanned in a single pass (16 bytes at a time where SSE2 is
+/// available) for delimiters, line breaks and quotes, and the text between
+/// them is escaped with Document::TextNode::AppendEscaped() (or
+/// AppendEscapedAscii() in ASCII-only mode). The table markup is written to a
+/// buffer that is handed to a consumer whenever it reaches the chunk size,
+/// also in the middle of a long field, so the memory use is independent of
+/// the input size, which is typically a mapped file.
+///
+/// Quoted fields follow RFC 4180: they may contain delimiters and line breaks,
+/// and a doubled quote character is a literal quote. Blank lines are skipped.
+///
+/// @code{.cpp}
+///   htmlgen::CsvTableOptions options;
+///   options.delimiter = '\t';
+///   htmlgen::CsvTableConverter converter(options);
+///   bool ok = converter.Convert(data, size, [&](const char* s, size_t n) {
+///     fwrite(s, 1, n, stdout);
+///   });
+/// @endcode
+class CsvTableConverter {
+  public:
+    explicit CsvTableConverter(
+        const CsvTableOptions& options = CsvTableOptions()) :
+        options_(options) {
+      const char unquoted[] = {options.delimiter, '\r', '\n', options.quote};
+      unquoted_.Init(unquoted, options.quote ? 4 : 3);
+      quoted_.Init(&options.quote, 1);
+      if (options_.chunk_size == 0)
+        options_.chunk_size = 1;
+    }
+
+    /// @brief Convert CSV data to an HTML table.
+    /// @param data The CSV data.
+    /// @param len The length of the CSV data.
+    /// @param consume A function that is called as consume(html, len) with
+    /// each chunk of the HTML, in order.
+    /// @returns false if the data ends inside a quoted field, in which case
+    /// the output is incomplete.
+    template <class Consumer>
+    bool Convert(const char* data, size_t len, Consumer consume) const {
+      std::string buffer;
+      buffer.reserve(options_.chunk_size + 256);
+      buffer.append("<table>", 7);
+
+      const char* p = data;
+      const char* end = data + len;
+      bool is_header = options_.header;
+      bool in_body = false;
+      while (p != end) {
+        // Skip blank lines.
+        if (*p == '\n' || *p == '\r') {
+          ++p;
+          continue;
+        }
+
+        if (is_header) {
+          buffer.append("<thead><tr>", 11);
+        } else {
+          if (!in_body) {
+            buffer.append("<tbody>", 7);
+            in_body = true;
+          }
+          buffer.append("<tr>", 4);
+        }
+
+        // Write the cells of the row.
+        bool end_of_row = false;
+        while (!end_of_row) {
+          buffer.append(is_header ? "<th>" : "<td>", 4);
+          if (options_.quote && p != end && *p == options_.quote) {
+            if (!AppendQuoted(p, end, buffer, consume))
+              return false;
+          }
+          end_of_row = AppendUnquoted(p, end, buffer, consume);
+          buffer.append(is_header ? "</th>" : "</td>", 5);
+          Flush(buffer, consume);
+        }
+
+        if (is_header) {
+          buffer.append("</tr></thead>", 13);
+          is_header = false;
+        } else {
+          buffer.append("</tr>", 5);
+        }
+      }
+
+      if (in_body)
+        buffer.append("</tbody>", 8);
+      buffer.append("</table>", 8);
+      consume(buffer.data(), buffer.size());
+      return true;
+    }
+
+    /// @brief Convert CSV data to an HTML table.
+    /// @param data The CSV data.
+    /// @param len The length of the CSV data.
+    /// @param[out] out The string that the HTML is appended to.
+    /// @returns false if the data ends inside a quoted field, in which case
+    /// the output is incomplete.
+    bool Convert(const char* data, size_t len, std::string& out) const {
+      return Convert(data, len, [&out](const char* html, size_t html_len) {
+        out.append(html, html_len);
+      });
+    }
+
+  private:
+    /// @brief A set of characters that can be searched for.
+    class CharSet {
+      public:
+        void Init(const char* chars, int count) {
+          for (int i = 0; i < 256; ++i)
+            table_[i] = false;
+          for (int i = 0; i < count; ++i)
+            table_[static_cast<unsigned char>(chars[i])] = true;
+#if defined(HTMLGEN_USE_SSE2)
+          for (int i = 0; i < count; ++i)
+            chars_[i] = _mm_set1_epi8(chars[i]);
+          count_ = count;
+#endif
+        }
+
+        /// @brief Find the first character in the set.
+        /// @returns A pointer to the character, or @c end if there is none.
+        const char* Find(const char* p, const char* end) const {
+#if defined(HTMLGEN_USE_SSE2)
+          for (; end - p >= 16; p += 16) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+            __m128i m = _mm_cmpeq_epi8(v, chars_[0]);
+            for (int i = 1; i < count_; ++i)
+              m = _mm_or_si128(m, _mm_cmpeq_epi8(v, chars_[i]));
+            unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(m));
+            if (mask)
+              return p + internal::CountTrailingZeros(mask);
+          }
+#endif
+          for (; p != end; ++p) {
+            if (table_[static_cast<unsigned char>(*p)])
+              return p;
+          }
+          return end;
+        }
+
+      private:
+#if defined(HTMLGEN_USE_SSE2)
+        __m128i chars_[4];
+        int count_;
+#endif
+        bool table_[256];
+    };
+
+    /// @brief Hand the buffer to the consumer if it has reached the chunk
+    /// size.
+    template <class Consumer>
+    void Flush(std::string& buffer, Consumer& consume) const {
+      if (buffer.size() >= options_.chunk_size) {
+        consume(buffer.data(), buffer.size());
+        buffer.clear();
+      }
+    }
+
+    /// @brief Escape a run of field text, and flush the buffer after every
+    /// chunk size of input, so that a long field is not buffered whole.
+    template <class Consumer>
+    void AppendText(const char* p, const char* end, std::string& buffer,
+                    Consumer& consume) const {
+      while (static_cast<size_t>(end - p) > options_.chunk_size) {
+        // Split before a UTF-8 lead byte, so that a character is not split
+        // (which would be replaced by U+FFFD in ASCII-only mode).
+        const char* split = p + options_.chunk_size;
+        for (int i = 0; i < 3 && split > p + 1 &&
+             (static_cast<unsigned char>(*split) & 0xc0) == 0x80; ++i)
+          --split;
+        AppendEscaped(p, split - p, buffer);
+        Flush(buffer, consume);
+        p = split;
+      }
+      AppendEscaped(p, end - p, buffer);
+    }
+
+    void AppendEscaped(const char* p, size_t len, std::string& out) const {
+      if (options_.ascii_only)
+        Document::TextNode::AppendEscapedAscii(p, len, out);
+      else
+        Document::TextNode::AppendEscaped(p, len, out);
+    }
+
+    /// @brief Append the quoted part of a field, starting at the opening
+    /// quote, and advance @c p past the closing quote.
+    /// @returns false if there is no closing quote.
+    template <class Consumer>
+    bool AppendQuoted(const char*& p, const char* end, std::string& out,
+                      Consumer& consume) const {
+      ++p;
+      while (true) {
+        const char* q = quoted_.Find(p, end);
+        AppendText(p, q, out, consume);
+        if (q == end)
+          return false;
+        p = q + 1;
+        if (p != end && *p == options_.quote) {
+          AppendEscaped(&options_.quote, 1, out);
+          ++p;
+        } else {
+          return true;
+        }
+      }
+    }
+
+    /// @brief Append the rest of a field, and advance @c p past the
+    /// delimiter or line break that ends it.
+    /// @returns true if the field ends the row.
+    template <class Consumer>
+    bool AppendUnquoted(const char*& p, const char* end, std::string& out,
+                        Consumer& consume) const {
+      while (true) {
+        const char* q = unquoted_.Find(p, end);
+        AppendText(p, q, out, consume);
+        if (q == end) {
+          p = end;
+          return true;
+        }
+        p = q + 1;
+        char c = *q;
+        if (c == options_.delimiter)
+          return false;
+        if (c == '\r' || c == '\n') {
+          if (c == '\r' && p != end && *p == '\n')
+            ++p;
+          return true;
+        }
+        // A quote inside an unquoted field is literal.
+        AppendEscaped(q, 1, out);
+      }
+    }
+
+    CsvTableOptions options_;
+    CharSet unquoted_;
+    CharSet quoted_;
+};
+
+} // namespace htmlgen
+
+#endif // CSV_TABLE_H_
@@ -54,206 +54,2502 @@
 #ifndef DOCUMENT_H_
 #define DOCUMENT_H_
 
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <atomic>
 #include <cstring>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <utility>
 #include <vector>
 
+// The escapers use SSE2 to skip over characters that need no escaping, unless
+// HTMLGEN_NO_SIMD is defined.
+#if !defined(HTMLGEN_NO_SIMD) &&             \
+    (defined(__SSE2__) || defined(_M_X64) || \
+     (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define HTMLGEN_USE_SSE2
+#include <emmintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+// UTF-16 and UTF-32 text can also be passed as string views in C++17.
+#if __cplusplus >= 201703L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L)
+#define HTMLGEN_HAVE_STRING_VIEW
+#include <string_view>
+#endif
+
+// Functions with loops can be constexpr in C++14.
+#if __cplusplus >= 201402L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201402L)
+#define HTMLGEN_CONSTEXPR14 constexpr
+#else
+#define HTMLGEN_CONSTEXPR14
+#endif
+
 namespace htmlgen {
 
+namespace internal {
+
+/// @brief Get the index of the least significant set bit (x must not be 0).
+inline int CountTrailingZeros(unsigned x) {
+#if defined(_MSC_VER)
+  unsigned long index;
+  _BitScanForward(&index, x);
+  return static_cast<int>(index);
+#else
+  return __builtin_ctz(x);
+#endif
+}
+
+/// @brief Decode a UTF-8 sequence (p must be before end).
+/// @param[out] code_point The decoded code point.
+/// @returns The length of the sequence, or 0 if it is not valid UTF-8
+/// (overlong forms, surrogates and code points above U+10FFFF are invalid).
+inline int DecodeUtf8(const char* p, const char* end, uint32_t& code_point) {
+  unsigned char c = static_cast<unsigned char>(*p);
+  int len;
+  uint32_t min;
+  if (c < 0x80) {
+    code_point = c;
+    return 1;
+  } else if ((c & 0xe0) == 0xc0) {
+    len = 2;
+    min = 0x80;
+    code_point = c & 0x1f;
+  } else if ((c & 0xf0) == 0xe0) {
+    len = 3;
+    min = 0x800;
+    code_point = c & 0x0f;
+  } else if ((c & 0xf8) == 0xf0) {
+    len = 4;
+    min = 0x10000;
+    code_point = c & 0x07;
+  } else {
+    return 0;
+  }
+  if (end - p < len)
+    return 0;
+  for (int i = 1; i < len; ++i) {
+    unsigned char b = static_cast<unsigned char>(p[i]);
+    if ((b & 0xc0) != 0x80)
+      return 0;
+    code_point = (code_point << 6) | (b & 0x3f);
+  }
+  if (code_point < min || code_point > 0x10ffff ||
+      (code_point >= 0xd800 && code_point <= 0xdfff))
+    return 0;
+  return len;
+}
+
+/// @brief Append a number as (upper case) hexadecimal digits.
+/// @param value The number.
+/// @param min_digits The minimum number of digits (padded with zeros).
+/// @param[out] out The string that the digits are appended to.
+inline void AppendHex(uint32_t value, int min_digits, std::string& out) {
+  char digits[8];
+  int n = 0;
+  while (value || n < min_digits) {
+    digits[n++] = "0123456789ABCDEF"[value & 15];
+    value >>= 4;
+  }
+  while (n)
+    out += digits[--n];
+}
+
+#if defined(HTMLGEN_USE_SSE2)
+/// @brief Convert a block of eight UTF-16 units to bytes, as far as they are
+/// ASCII characters other than c1, c2 and c3.
+/// @returns The number of converted units (all eight bytes are written).
+inline size_t ConvertAsciiBlock(const char16_t* p, char* dst, char c1, char c2,
+                                char c3) {
+  __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+  __m128i ascii = _mm_cmpeq_epi16(
+      _mm_and_si128(v, _mm_set1_epi16(static_cast<short>(0xff80))),
+      _mm_setzero_si128());
+  __m128i special = _mm_or_si128(
+      _mm_or_si128(_mm_cmpeq_epi16(v, _mm_set1_epi16(c1)),
+                   _mm_cmpeq_epi16(v, _mm_set1_epi16(c2))),
+      _mm_cmpeq_epi16(v, _mm_set1_epi16(c3)));
+  unsigned bad =
+      ~static_cast<unsigned>(_mm_movemask_epi8(_mm_andnot_si128(special,
+                                                                ascii))) &
+      0xffff;
+  _mm_storel_epi64(reinterpret_cast<__m128i*>(dst), _mm_packus_epi16(v, v));
+  return bad ? CountTrailingZeros(bad) / 2 : 8;
+}
+
+/// @brief Convert a block of four UTF-32 units to bytes, as far as they are
+/// ASCII characters other than c1, c2 and c3.
+/// @returns The number of converted units (all four bytes are written).
+inline size_t ConvertAsciiBlock(const char32_t* p, char* dst, char c1, char c2,
+                                char c3) {
+  __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+  __m128i ascii = _mm_cmpeq_epi32(
+      _mm_and_si128(v, _mm_set1_epi32(static_cast<int>(0xffffff80))),
+      _mm_setzero_si128());
+  __m128i special = _mm_or_si128(
+      _mm_or_si128(_mm_cmpeq_epi32(v, _mm_set1_epi32(c1)),
+                   _mm_cmpeq_epi32(v, _mm_set1_epi32(c2))),
+      _mm_cmpeq_epi32(v, _mm_set1_epi32(c3)));
+  unsigned bad =
+      ~static_cast<unsigned>(_mm_movemask_epi8(_mm_andnot_si128(special,
+                                                                ascii))) &
+      0xffff;
+  __m128i bytes = _mm_packus_epi16(_mm_packs_epi32(v, v), v);
+  int32_t word = _mm_cvtsi128_si32(bytes);
+  std::memcpy(dst, &word, 4);
+  return bad ? CountTrailingZeros(bad) / 4 : 4;
+}
+#endif
+
+/// @brief Decode the code point at value[i] and advance i past it.
+///
+/// Unpaired surrogates and invalid code points are replaced by U+FFFD.
+template <class Char>
+uint32_t NextCodePoint(const Char* value, size_t len, size_t& i) {
+  uint32_t c = static_cast<uint32_t>(value[i++]);
+  if (sizeof(Char) == 2 && (c & 0xfc00) == 0xd800 && i < len &&
+      (static_cast<uint32_t>(value[i]) & 0xfc00) == 0xdc00) {
+    c = 0x10000 + ((c - 0xd800) << 10) +
+        (static_cast<uint32_t>(value[i]) - 0xdc00);
+    ++i;
+  } else if ((c >= 0xd800 && c <= 0xdfff) || c > 0x10ffff) {
+    c = 0xfffd;
+  }
+  return c;
+}
+
+/// @brief Write a code point as UTF-8 (at most four bytes), or as a numeric
+/// character reference (at most ten bytes) if ascii_only is set.
+/// @returns The end of the written bytes.
+inline char* EncodeCodePoint(uint32_t c, bool ascii_only, char* p) {
+  if (ascii_only && c >= 0x80) {
+    *p++ = '&';
+    *p++ = '#';
+    *p++ = 'x';
+    int shift = 20;
+    while (shift > 0 && !(c >> shift))
+      shift -= 4;
+    for (; shift >= 0; shift -= 4)
+      *p++ = "0123456789ABCDEF"[(c >> shift) & 15];
+    *p++ = ';';
+  } else if (c < 0x80) {
+    *p++ = static_cast<char>(c);
+  } else if (c < 0x800) {
+    *p++ = static_cast<char>(0xc0 | (c >> 6));
+    *p++ = static_cast<char>(0x80 | (c & 0x3f));
+  } else if (c < 0x10000) {
+    *p++ = static_cast<char>(0xe0 | (c >> 12));
+    *p++ = static_cast<char>(0x80 | ((c >> 6) & 0x3f));
+    *p++ = static_cast<char>(0x80 | (c & 0x3f));
+  } else {
+    *p++ = static_cast<char>(0xf0 | (c >> 18));
+    *p++ = static_cast<char>(0x80 | ((c >> 12) & 0x3f));
+    *p++ = static_cast<char>(0x80 | ((c >> 6) & 0x3f));
+    *p++ = static_cast<char>(0x80 | (c & 0x3f));
+  }
+  return p;
+}
+
+/// @brief Transcode UTF-16 or UTF-32 to UTF-8 and escape it, in one pass.
+///
+/// The result is written directly into the output string. Unpaired
+/// surrogates and invalid code points are replaced by U+FFFD.
+/// @param value The string (char16_t or char32_t units).
+/// @param len The length of the string, in units.
+/// @param attribute Escape for attribute values (" & <) instead of text
+/// content (& < >).
+/// @param ascii_only Write non-ASCII characters as numeric character
+/// references instead of UTF-8.
+/// @param[out] out The string that the result is appended to.
+template <class Char>
+void AppendTranscodedEscaped(const Char* value, size_t len, bool attribute,
+                             bool ascii_only, std::string& out) {
+  const char c3 = attribute ? '"' : '>';
+  // Room for the all-ASCII case. While converting, the room that is left is
+  // kept at least as large as the number of remaining units.
+  size_t w = out.size();
+  out.resize(w + len);
+  size_t i = 0;
+  while (i < len) {
+#if defined(HTMLGEN_USE_SSE2)
+    const size_t kBlock = 16 / sizeof(Char);
+    if (len - i >= kBlock) {
+      size_t n = ConvertAsciiBlock(value + i, &out[w], '&', '<', c3);
+      i += n;
+      w += n;
+      if (n == kBlock)
+        continue;
+    }
+#endif
+
+    // Make room for the longest expansion of one character.
+    const size_t kMaxExpansion = 16;
+    if (out.size() - w < len - i + kMaxExpansion)
+      out.resize(std::max(out.size() * 2, w + len - i + kMaxExpansion));
+    char* dst = &out[w];
+    uint32_t c = NextCodePoint(value, len, i);
+    const char* ref = nullptr;
+    if (c == '&')
+      ref = "&amp;";
+    else if (c == '<')
+      ref = "&lt;";
+    else if (c == static_cast<uint32_t>(c3))
+      ref = attribute ? "&#34;" : "&gt;";
+    if (ref) {
+      size_t ref_len = std::strlen(ref);
+      std::memcpy(dst, ref, ref_len);
+      w += ref_len;
+    } else {
+      w += EncodeCodePoint(c, ascii_only, dst) - dst;
+    }
+  }
+  out.resize(w);
+}
+
+/// @brief Transcode UTF-16 or UTF-32 to UTF-8, without escaping.
+template <class Char>
+std::string ToUtf8(const Char* value, size_t len) {
+  std::string out;
+  out.reserve(len);
+  char buffer[4];
+  for (size_t i = 0; i < len;) {
+    uint32_t c = NextCodePoint(value, len, i);
+    out.append(buffer, EncodeCodePoint(c, false, buffer));
+  }
+  return out;
+}
+
+/// @brief Append a numeric character reference (e.g. "&#xE9;") for the
+/// UTF-8 sequence at p. An invalid byte is replaced by U+FFFD.
+/// @returns A pointer to the end of the sequence.
+inline const char* AppendCharRef(const char* p, const char* end,
+                                 std::string& out) {
+  uint32_t code_point;
+  int len = DecodeUtf8(p, end, code_point);
+  if (!len) {
+    code_point = 0xfffd;
+    len = 1;
+  }
+  out.append("&#x", 3);
+  AppendHex(code_point, 1, out);
+  out += ';';
+  return p + len;
+}
+
+/// @brief Unescape text in the form that TextNode escapes it to: "&amp;",
+/// "&lt;", "&gt;" and hexadecimal numeric character references are replaced
+/// by their characters.
+inline void AppendUnescapedText(const std::string& text, std::string& out) {
+  size_t i = 0;
+  while (true) {
+    size_t amp = text.find('&', i);
+    if (amp == std::string::npos)
+      break;
+    out.append(text, i, amp - i);
+    const char* p = text.c_str() + amp + 1;
+    size_t len = 0;
+    if (std::strncmp(p, "amp;", 4) == 0) {
+      out += '&';
+      len = 4;
+    } else if (std::strncmp(p, "lt;", 3) == 0) {
+      out += '<';
+      len = 3;
+    } else if (std::strncmp(p, "gt;", 3) == 0) {
+      out += '>';
+      len = 3;
+    } else if (p[0] == '#' && p[1] == 'x') {
+      uint32_t c = 0;
+      const char* q = p + 2;
+      for (; q - p < 9; ++q) {
+        char d = static_cast<char>(*q | 0x20);
+        if (*q >= '0' && *q <= '9')
+          c = (c << 4) | static_cast<uint32_t>(*q - '0');
+        else if (d >= 'a' && d <= 'f')
+          c = (c << 4) | static_cast<uint32_t>(d - 'a' + 10);
+        else
+          break;
+      }
+      if (*q == ';' && q - p > 2 && c <= 0x10ffff) {
+        char buffer[4];
+        out.append(buffer, EncodeCodePoint(c, false, buffer) - buffer);
+        len = q + 1 - p;
+      }
+    }
+    if (!len)
+      out += '&';
+    i = amp + 1 + len;
+  }
+  out.append(text, i, std::string::npos);
+}
+
+/// @brief The standard HTML5 tag and attribute names.
+///
+/// Names are mapped to IDs with a minimal perfect hash: the hash of a name
+/// selects a bucket, and the displacement of the bucket turns the hash into
+/// the only ID that the name can have. A lookup costs one hash, two table
+/// reads and one string compare. Each ID also has flags that tell how the
+/// name is used. The tables are generated by gen_standard_names.py.
+///
+/// In C++14, names can be looked up at compile time (html_dsl.h uses this
+/// for the flags of its elements).
+class StandardNames {
+  public:
+    enum Flag {
+      kTag = 1,               ///< The name of an element.
+      kAttribute = 2,         ///< The name of an attribute.
+      kVoid = 4,              ///< A void element (no end tag).
+      kRawText = 8,           ///< An element with raw text content.
+      kEscapableRawText = 16  ///< An element with escapable raw text content.
+    };
+
+    /// @brief Find a standard name.
+    /// @param name The name.
+    /// @param len The length of the name.
+    /// @returns The ID of the name, or -1 if it is not a standard name.
+    static HTMLGEN_CONSTEXPR14 int Find(const char* name, size_t len) {
+      int id = Slot(Hash(name, len));
+      const char* candidate = Name(id);
+      for (size_t i = 0; i < len; ++i) {
+        if (candidate[i] != name[i] || !candidate[i])
+          return -1;
+      }
+      return candidate[len] ? -1 : id;
+    }
+
+    // BEGIN GENERATED by gen_standard_names.py
+    enum {
+      kCount = 321,
+      kNumBuckets = 81
+    };
+
+    /// @brief Get a name by its ID.
+    static constexpr const char* Name(int id) {
+      return Tables<>::kNames[id];
+    }
+
+    /// @brief Get the flags of a name (a combination of Flag values).
+    static constexpr unsigned Flags(int id) {
+      return Tables<>::kFlags[id];
+    }
+
+  private:
+    /// @brief The tables, in a class template so that they can be defined in
+    /// a header.
+    template <int = 0>
+    struct Tables {
+      static constexpr const char* kNames[kCount] = {
+        "ondrop", "low", "h6", "textarea", "abbr", "itemid", "translate", "i",
+        "onafterprint", "ol", "em", "menu", "html", "button", "p", "hreflang",
+        "h1", "async", "step", "max", "slot", "ontimeupdate", "rel",
+        "popovertargetaction", "onpageshow", "width", "thead", "aria-current",
+        "pattern", "code", "mark", "onstorage", "rows", "onmouseleave", "data",
+        "body", "onseeking", "link", "onpaste", "dd", "inert", "progress",
+        "dl", "blocking", "id", "wbr", "onclose", "controls", "readonly",
+        "autofocus", "crossorigin", "onloadstart", "onpagehide",
+        "aria-labelledby", "spellcheck", "usemap", "noscript",
+        "ondurationchange", "onchange", "referrerpolicy", "aria-selected",
+        "src", "role", "start", "small", "object", "div", "high", "ondragend",
+        "section", "onunload", "dirname", "iframe", "hr", "address", "dir",
+        "details", "meter", "ins", "audio", "onfocus", "onkeyup", "content",
+        "del", "maxlength", "article", "onvolumechange", "preload", "header",
+        "aria-label", "value", "picture", "onhashchange", "aria-expanded",
+        "optgroup", "minlength", "style", "itemtype", "onmouseenter", "figure",
+        "tabindex", "canvas", "onkeypress", "onemptied", "formaction",
+        "search", "cols", "nonce", "srclang", "figcaption", "tfoot",
+        "novalidate", "onmessage", "ondragover", "img", "onended",
+        "onpopstate", "enterkeyhint", "a", "caption", "br", "muted", "track",
+        "title", "multiple", "math", "draggable", "h5", "h4", "onbeforeprint",
+        "base", "datalist", "tr", "aside", "map", "dfn", "onkeydown",
+        "oncanplaythrough", "srcdoc", "cite", "rowspan", "onscroll",
+        "popovertarget", "bdi", "embed", "h3", "onresize", "ondragstart",
+        "onmouseover", "ondragenter", "required", "aria-live", "playsinline",
+        "shape", "onblur", "onmouseup", "is", "accept", "legend",
+        "shadowrootmode", "reversed", "select", "lang", "oninvalid", "onplay",
+        "hgroup", "decoding", "keygen", "s", "table", "sup", "onplaying",
+        "span", "onmousedown", "ruby", "accesskey", "form", "onmousemove",
+        "output", "onselect", "aria-disabled", "u", "onabort", "imagesizes",
+        "loop", "oncontextmenu", "as", "checked", "optimum", "selected",
+        "ondragleave", "input", "popover", "download", "onseeked", "kind",
+        "area", "for", "oninput", "coords", "onpause", "ul", "onsuspend",
+        "dialog", "open", "alt", "meta", "td", "strong", "head", "ismap",
+        "label", "formnovalidate", "hidden", "onprogress", "aria-hidden",
+        "pre", "name", "sizes", "blockquote", "onloadeddata", "col", "samp",
+        "onoffline", "onmouseout", "svg", "headers", "autocomplete",
+        "ontoggle", "itemref", "onerror", "aria-controls", "bdo", "formtarget",
+        "wrap", "enctype", "onreset", "href", "th", "b", "itemprop",
+        "oncuechange", "defer", "param", "onwheel", "script", "kbd",
+        "onloadedmetadata", "list", "autocapitalize", "accept-charset",
+        "template", "target", "allowfullscreen", "allow", "itemscope",
+        "oncanplay", "oncopy", "time", "oncancel", "source", "type", "loading",
+        "h2", "nomodule", "placeholder", "video", "onsubmit", "ping",
+        "onbeforeunload", "onauxclick", "autoplay", "formenctype", "min",
+        "srcset", "oncut", "action", "contenteditable", "method", "scope",
+        "aria-describedby", "onclick", "footer", "poster", "onload", "li",
+        "ondblclick", "http-equiv", "inputmode", "formmethod", "size",
+        "datetime", "imagesrcset", "q", "tbody", "disabled", "media", "rt",
+        "onratechange", "summary", "nav", "dt", "main", "integrity", "sandbox",
+        "charset", "ondrag", "ononline", "onwaiting", "default", "height",
+        "class", "fieldset", "onstalled", "colspan", "option", "sub", "var",
+        "rp", "colgroup", "fetchpriority"};
+      static constexpr uint8_t kFlags[kCount] = {
+        2, 2, 1, 17, 3, 2, 2, 1, 2, 1, 1, 1, 1, 1, 1, 2, 1, 2, 2, 2, 3, 2, 2,
+        2, 2, 2, 1, 2, 2, 1, 1, 2, 2, 2, 3, 1, 2, 5, 2, 1, 2, 1, 1, 2, 2, 5, 2,
+        2, 2, 2, 2, 2, 2, 2, 2, 2, 1, 2, 2, 2, 2, 2, 2, 2, 1, 1, 1, 2, 2, 1, 2,
+        2, 1, 5, 1, 2, 1, 1, 1, 1, 2, 2, 2, 1, 2, 1, 2, 2, 1, 2, 2, 1, 2, 2, 1,
+        2, 11, 2, 2, 1, 2, 1, 2, 2, 2, 1, 2, 2, 2, 1, 1, 2, 2, 2, 5, 2, 2, 2,
+        1, 1, 5, 2, 5, 19, 2, 1, 2, 1, 1, 2, 5, 1, 1, 1, 1, 1, 2, 2, 2, 3, 2,
+        2, 2, 1, 5, 1, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 1, 2, 2, 1, 2, 2, 2,
+        1, 2, 5, 1, 1, 1, 2, 3, 2, 1, 2, 3, 2, 1, 2, 2, 1, 2, 2, 2, 2, 2, 2, 2,
+        2, 2, 5, 2, 2, 2, 2, 5, 2, 2, 2, 2, 1, 2, 1, 2, 2, 5, 1, 1, 1, 2, 3, 2,
+        2, 2, 2, 1, 2, 2, 1, 2, 5, 1, 2, 2, 1, 2, 2, 2, 2, 2, 2, 1, 2, 2, 2, 2,
+        2, 1, 1, 2, 2, 2, 5, 2, 9, 1, 2, 2, 2, 2, 1, 2, 2, 2, 2, 2, 2, 1, 2, 5,
+        2, 2, 1, 2, 2, 1, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 1, 2, 2,
+        1, 2, 2, 2, 2, 2, 2, 2, 1, 1, 2, 2, 1, 2, 1, 1, 1, 1, 2, 2, 2, 2, 2, 2,
+        2, 2, 2, 1, 2, 2, 1, 1, 1, 1, 1, 2};
+      static constexpr uint16_t kDisplacements[kNumBuckets] = {
+        21, 2, 90, 56, 4, 2, 4, 284, 39, 208, 1, 0, 4, 24, 4, 11, 128, 17, 0,
+        3, 326, 9, 48, 16, 9, 1, 74, 69, 197, 9, 101, 4, 0, 1, 139, 7, 24, 217,
+        75, 172, 0, 710, 73, 12, 163, 0, 326, 70, 0, 925, 2, 4, 160, 78, 3, 26,
+        4946, 320, 227, 0, 35, 440, 57, 36, 34, 1, 1, 16, 927, 2, 0, 81, 86,
+        74, 10, 92, 6, 240, 93, 11, 71};
+    };
+
+    /// @brief Map a name hash to the only ID that it can have.
+    static constexpr int Slot(uint64_t h) {
+      return static_cast<int>(Reduce(
+          (h ^ Tables<>::kDisplacements[Reduce(h, kNumBuckets)]) *
+              0xff51afd7ed558ccdULL,
+          kCount));
+    }
+    // END GENERATED
+
+    /// @brief Hash the first and last eight bytes, and the length, of a name.
+    static HTMLGEN_CONSTEXPR14 uint64_t Hash(const char* name, size_t len) {
+      size_t n = len < 8 ? len : 8;
+      uint64_t a = 0, b = 0;
+      for (size_t i = 0; i < n; ++i) {
+        a |= static_cast<uint64_t>(static_cast<unsigned char>(name[i]))
+             << (8 * i);
+        b |= static_cast<uint64_t>(
+                 static_cast<unsigned char>(name[len - n + i]))
+             << (8 * i);
+      }
+      uint64_t h = (a * 0x9e3779b97f4a7c15ULL) ^
+                   ((b + len) * 0xc2b2ae3d27d4eb4fULL);
+      return h ^ (h >> 29);
+    }
+
+    /// @brief Map the high 32 bits of x to [0, n).
+    static constexpr uint64_t Reduce(uint64_t x, uint64_t n) {
+      return ((x >> 32) * n) >> 32;
+    }
+};
+
+template <int I>
+constexpr const char* StandardNames::Tables<I>::kNames[StandardNames::kCount];
+template <int I>
+constexpr uint8_t StandardNames::Tables<I>::kFlags[StandardNames::kCount];
+template <int I>
+constexpr uint16_t
+    StandardNames::Tables<I>::kDisplacements[StandardNames::kNumBuckets];
+
+/// @brief The global table of interned element and attribute names.
+///
+/// Each distinct name is stored once and never freed, so interned names can
+/// be compared by address. Standard names are found through StandardNames
+/// without touching shared state. Other names are looked up in an open
+/// addressing hash table that is read without locks: a slot is only ever
+/// filled in once, and when the table grows the old table is kept, so readers
+/// never see freed memory. Only adding a new name takes a lock.
+///
+/// The table never shrinks. Elements and attributes add their names with
+/// TryIntern(), which stops adding names once the table holds kMaxOtherNames
+/// names other than the standard ones, so names from an unbounded set (e.g.
+/// "data-row-123", or names from untrusted input) cannot make it grow without
+/// bound: they are then owned by the element or attribute instead (see
+/// Name). Lookup() finds a
+/// name without adding it, for names that are only compared with (e.g. those
+/// in a Selector).
+class NameTable {
+  public:
+    /// @brief The number of names that are not standard names after which
+    /// TryIntern() stops adding names.
+    static const size_t kMaxOtherNames = 4096;
+
+    /// @brief Get the interned copy of a name.
+    /// @param name The name.
+    /// @param len The length of the name.
+    static const std::string* Intern(const char* name, size_t len) {
+      NameTable& table = Instance();
+      int id = StandardNames::Find(name, len);
+      if (id >= 0)
+        return &table.standard_[id];
+      return table.InternOther(name, len, false);
+    }
+
+    /// @brief Get the interned copy of a name.
+    static const std::string* Intern(const std::string& name) {
+      return Intern(name.data(), name.size());
+    }
+
+    /// @brief Get the interned copy of a name, adding it only if the table
+    /// holds fewer than kMaxOtherNames names that are not standard names.
+    /// @param name The name.
+    /// @param len The length of the name.
+    /// @returns The interned name, or nullptr if the table is full.
+    static const std::string* TryIntern(const char* name, size_t len) {
+      NameTable& table = Instance();
+      int id = StandardNames::Find(name, len);
+      if (id >= 0)
+        return &table.standard_[id];
+      return table.InternOther(name, len, true);
+    }
+
+    /// @brief Find the interned copy of a name, without adding it.
+    /// @param name The name.
+    /// @param len The length of the name.
+    /// @returns The interned name, or nullptr if the name has not been
+    /// interned (so no element or attribute has it).
+    static const std::string* Lookup(const char* name, size_t len) {
+      NameTable& table = Instance();
+      int id = StandardNames::Find(name, len);
+      if (id >= 0)
+        return &table.standard_[id];
+      const Entry* entry =
+          Find(*table.table_.load(std::memory_order_acquire),
+               HashName(name, len), name, len);
+      return entry ? &entry->name : nullptr;
+    }
+
+    /// @brief Find the interned copy of a name, without adding it.
+    static const std::string* Lookup(const std::string& name) {
+      return Lookup(name.data(), name.size());
+    }
+
+    /// @brief Get the StandardNames ID of an interned name, without hashing.
+    /// @param name The interned name.
+    /// @returns The ID, or -1 if it is not a standard name.
+    static int StandardId(const std::string* name) {
+      const std::vector<std::string>& standard = Instance().standard_;
+      std::less<const std::string*> less;
+      if (less(name, standard.data()) ||
+          !less(name, standard.data() + standard.size()))
+        return -1;
+      return static_cast<int>(name - standard.data());
+    }
+
+  private:
+    struct Entry {
+      Entry(uint64_t h, const char* name_data, size_t name_len) : hash(h),
+          name(name_data, name_len) {}
+
+      const uint64_t hash;
+      const std::string name;
+    };
+
+    struct Table {
+      explicit Table(size_t size) : mask(size - 1),
+          slots(new std::atomic<const Entry*>[size]) {
+        for (size_t i = 0; i < size; ++i)
+          slots[i].store(nullptr, std::memory_order_relaxed);
+      }
+
+      const size_t mask;
+      std::unique_ptr<std::atomic<const Entry*>[]> slots;
+    };
+
+    NameTable() : table_(nullptr), full_(false) {
+      standard_.reserve(StandardNames::kCount);
+      for (int i = 0; i < StandardNames::kCount; ++i)
+        standard_.push_back(StandardNames::Name(i));
+      tables_.push_back(std::unique_ptr<Table>(new Table(64)));
+      table_.store(tables_.back().get());
+    }
+
+    /// @brief Get the table. It is never destroyed, so that interned names
+    /// stay valid while static objects are destroyed.
+    static NameTable& Instance() {
+      static NameTable* table = new NameTable();
+      return *table;
+    }
+
+    /// @param bounded Return nullptr instead of adding the name if the table
+    /// is full.
+    const std::string* InternOther(const char* name, size_t len,
+                                   bool bounded) {
+      uint64_t h = HashName(name, len);
+      const Entry* entry =
+          Find(*table_.load(std::memory_order_acquire), h, name, len);
+      if (entry)
+        return &entry->name;
+      // Once the table is full, new names do not take the lock.
+      if (bounded && full_.load(std::memory_order_relaxed))
+        return nullptr;
+
+      std::lock_guard<std::mutex> lock(mutex_);
+      Table* table = table_.load(std::memory_order_relaxed);
+      entry = Find(*table, h, name, len);
+      if (entry)
+        return &entry->name;
+      if (bounded && entries_.size() >= kMaxOtherNames) {
+        full_.store(true, std::memory_order_relaxed);
+        return nullptr;
+      }
+
+      // Keep the load factor at or below 1/2.
+      if ((entries_.size() + 1) * 2 > table->mask + 1) {
+        table = new Table((table->mask + 1) * 2);
+        tables_.push_back(std::unique_ptr<Table>(table));
+        for (auto i = entries_.begin(); i != entries_.end(); ++i)
+          Insert(*table, i->get());
+        table_.store(table, std::memory_order_release);
+      }
+      entries_.push_back(std::unique_ptr<Entry>(new Entry(h, name, len)));
+      Insert(*table, entries_.back().get());
+      return &entries_.back()->name;
+    }
+
+    static const Entry* Find(const Table& table, uint64_t h, const char* name,
+                             size_t len) {
+      for (size_t i = h & table.mask;; i = (i + 1) & table.mask) {
+        const Entry* entry = table.slots[i].load(std::memory_order_acquire);
+        if (!entry)
+          return nullptr;
+        if (entry->hash == h && entry->name.size() == len &&
+            std::memcmp(entry->name.data(), name, len) == 0)
+          return entry;
+      }
+    }
+
+    static void Insert(Table& table, const Entry* entry) {
+      size_t i = entry->hash & table.mask;
+      while (table.slots[i].load(std::memory_order_relaxed))
+        i = (i + 1) & table.mask;
+      table.slots[i].store(entry, std::memory_order_release);
+    }
+
+    /// @brief A 64-bit FNV-1a hash.
+    static uint64_t HashName(const char* name, size_t len) {
+      uint64_t h = 14695981039346656037ULL;
+      for (size_t i = 0; i < len; ++i)
+        h = (h ^ static_cast<unsigned char>(name[i])) * 1099511628211ULL;
+      return h;
+    }
+
+    std::vector<std::string> standard_;  // Indexed by StandardNames ID.
+    std::atomic<Table*> table_;          // The current table.
+    std::atomic<bool> full_;  // Whether TryIntern() no longer adds names.
+
+    std::mutex mutex_;  // Protects the members below (when writing).
+    std::vector<std::unique_ptr<Table> > tables_;  // Current and old tables.
+    std::vector<std::unique_ptr<Entry> > entries_;
+
+    NameTable(const NameTable&) = delete;
+    NameTable& operator=(const NameTable&) = delete;
+};
+
+/// @brief The name of an element or attribute: interned if the NameTable has
+/// room for it (see NameTable::TryIntern()), and owned otherwise.
+class Name {
+  public:
+    Name(const char* name, size_t len) :
+        interned_(NameTable::TryIntern(name, len)) {
+      if (!interned_)
+        owned_.assign(name, len);
+    }
+
+    explicit Name(const std::string& name) : Name(name.data(), name.size()) {}
+
+    /// @brief Get the name.
+    const std::string& get() const {
+      return interned_ ? *interned_ : owned_;
+    }
+
+    /// @brief Get the interned name, or nullptr if the name is owned.
+    const std::string* interned() const {
+      return interned_;
+    }
+
+  private:
+    const std::string* interned_;
+    std::string owned_;  // The name, if it is not interned.
+};
+
+/// @brief An incremental SipHash-2-4 with a 128-bit result.
+///
+/// Unlike FNV and other fast non-cryptographic hashes, SipHash makes it
+/// impractical to construct inputs with the same hash, so it is used where
+/// the inputs may come from users (e.g. fragment cache keys).
+class SipHash {
+  public:
+    SipHash(uint64_t k0, uint64_t k1) : tail_(0), len_(0) {
+      v0_ = 0x736f6d6570736575ULL ^ k0;
+      v1_ = 0x646f72616e646f6dULL ^ k1 ^ 0xee;
+      v2_ = 0x6c7967656e657261ULL ^ k0;
+      v3_ = 0x7465646279746573ULL ^ k1;
+    }
+
+    void Update(const void* data, size_t len) {
+      const unsigned char* p = static_cast<const unsigned char*>(data);
+      const unsigned char* end = p + len;
+
+      // Complete a partial word.
+      while ((len_ & 7) != 0 && p != end) {
+        tail_ |= static_cast<uint64_t>(*p++) << (8 * (len_ & 7));
+        if ((++len_ & 7) == 0) {
+          Compress(tail_);
+          tail_ = 0;
+        }
+      }
+
+      for (; end - p >= 8; p += 8, len_ += 8) {
+        uint64_t m = 0;
+        for (int i = 7; i >= 0; --i)
+          m = (m << 8) | p[i];
+        Compress(m);
+      }
+      for (; p != end; ++p)
+        tail_ |= static_cast<uint64_t>(*p) << (8 * (len_++ & 7));
+    }
+
+    /// @brief Add a 64-bit number (in a fixed byte order).
+    void Update(uint64_t x) {
+      unsigned char bytes[8];
+      for (int i = 0; i < 8; ++i)
+        bytes[i] = static_cast<unsigned char>(x >> (8 * i));
+      Update(bytes, 8);
+    }
+
+    /// @brief Get the hash of the data that has been added.
+    void Final(uint64_t& out0, uint64_t& out1) const {
+      uint64_t v0 = v0_, v1 = v1_, v2 = v2_, v3 = v3_;
+      uint64_t b = tail_ | (static_cast<uint64_t>(len_) << 56);
+      v3 ^= b;
+      Round(v0, v1, v2, v3);
+      Round(v0, v1, v2, v3);
+      v0 ^= b;
+      v2 ^= 0xee;
+      for (int i = 0; i < 4; ++i)
+        Round(v0, v1, v2, v3);
+      out0 = v0 ^ v1 ^ v2 ^ v3;
+      v1 ^= 0xdd;
+      for (int i = 0; i < 4; ++i)
+        Round(v0, v1, v2, v3);
+      out1 = v0 ^ v1 ^ v2 ^ v3;
+    }
+
+  private:
+    static uint64_t Rotate(uint64_t x, int n) {
+      return (x << n) | (x >> (64 - n));
+    }
+
+    static void Round(uint64_t& v0, uint64_t& v1, uint64_t& v2,
+                      uint64_t& v3) {
+      v0 += v1;
+      v1 = Rotate(v1, 13);
+      v1 ^= v0;
+      v0 = Rotate(v0, 32);
+      v2 += v3;
+      v3 = Rotate(v3, 16);
+      v3 ^= v2;
+      v0 += v3;
+      v3 = Rotate(v3, 21);
+      v3 ^= v0;
+      v2 += v1;
+      v1 = Rotate(v1, 17);
+      v1 ^= v2;
+      v2 = Rotate(v2, 32);
+    }
+
+    void Compress(uint64_t m) {
+      v3_ ^= m;
+      Round(v0_, v1_, v2_, v3_);
+      Round(v0_, v1_, v2_, v3_);
+      v0_ ^= m;
+    }
+
+    uint64_t v0_, v1_, v2_, v3_;
+    uint64_t tail_;  // The bytes of the current partial word.
+    uint64_t len_;
+};
+
+} // namespace internal
+
 /// @brief A container for a single HTML document.
 ///
 /// The Document contains a root node, which is an Element with the name
 /// "html". Children can be added to the root node to form a node tree.
 class Document {
   public:
+    class Element;
+    class TextNode;
+    class Attribute;
+
+    /// @brief A rewrite of attribute values that is applied during
+    /// serialization.
+    ///
+    /// Rewrites work on the already escaped attribute values, and the strings
+    /// that are added are escaped once when the rewrite is created, so
+    /// applying a rewrite neither re-escapes nor modifies the node tree.
+    ///
+    /// @code{.cpp}
+    ///   htmlgen::Document::Writer writer(html_string);
+    ///   writer.AddAttributeRewrite(htmlgen::Document::AttributeRewrite(
+    ///       "src", "/static/", "https://cdn.example.com", "?v=1234"));
+    ///   doc.Write(writer);
+    /// @endcode
+    class AttributeRewrite {
+      public:
+        /// @param name The name of the attributes to rewrite (e.g. "href").
+        /// @param match_prefix Only values that start with this string are
+        /// rewritten (unescaped). An empty string matches all values.
+        /// @param prefix The string to insert before the value (unescaped).
+        /// @param suffix The string to append after the value (unescaped).
+        AttributeRewrite(const std::string& name,
+                         const std::string& match_prefix,
+                         const std::string& prefix,
+                         const std::string& suffix = std::string()) :
+            name_(name) {
+          Attribute::AppendEscaped(match_prefix.data(), match_prefix.size(),
+                                   match_prefix_);
+          Attribute::AppendEscaped(prefix.data(), prefix.size(), prefix_);
+          Attribute::AppendEscaped(suffix.data(), suffix.size(), suffix_);
+        }
+
+        /// @brief Check if this rewrite applies to an attribute.
+        /// @param name The attribute name.
+        /// @param name_len The length of the attribute name.
+        /// @param escaped_value The attribute value, in its escaped form.
+        /// @param value_len The length of the escaped attribute value.
+        bool Matches(const char* name, size_t name_len,
+                     const char* escaped_value, size_t value_len) const {
+          return name_.compare(0, std::string::npos, name, name_len) == 0 &&
+                 value_len >= match_prefix_.size() &&
+                 std::memcmp(escaped_value, match_prefix_.data(),
+                             match_prefix_.size()) == 0;
+        }
+
+        /// @brief Get the escaped string to insert before the value.
+        const std::string& escaped_prefix() const {
+          return prefix_;
+        }
+
+        /// @brief Get the escaped string to append after the value.
+        const std::string& escaped_suffix() const {
+          return suffix_;
+        }
+
+        /// @brief Get a hash of the rewrite rule.
+        uint64_t Hash() const {
+          uint64_t h = HashBytes(kHashSeed, name_.data(), name_.size() + 1);
+          h = HashBytes(h, match_prefix_.data(), match_prefix_.size() + 1);
+          h = HashBytes(h, prefix_.data(), prefix_.size() + 1);
+          return HashBytes(h, suffix_.data(), suffix_.size() + 1);
+        }
+
+      private:
+        std::string name_;
+        std::string match_prefix_;
+        std::string prefix_;
+        std::string suffix_;
+    };
+
+    /// @brief The 128-bit key of a cached fragment.
+    ///
+    /// Caches find fragments by @c hash, and must store @c check with each
+    /// fragment and compare it on lookup, so that a fragment is only returned
+    /// for the full key that it was stored under.
+    struct FragmentKey {
+      uint64_t hash;
+      uint64_t check;
+    };
+
+    /// @brief An interface for caches of serialized subtrees.
+    ///
+    /// A cache is attached to a Writer, and is used for all Elements that have
+    /// caching enabled (see Element::EnableCaching()).
+    class FragmentCache {
+      public:
+        virtual ~FragmentCache() {}
+
+        /// @brief Look up a cached fragment.
+        /// @param key The cache key.
+        /// @param[out] out The string that the cached HTML is appended to.
+        /// @returns true if the fragment was found in the cache.
+        virtual bool Fetch(const FragmentKey& key, std::string& out) = 0;
+
+        /// @brief Store a fragment in the cache.
+        /// @param key The cache key.
+        /// @param html The HTML of the fragment.
+        /// @param len The length of the HTML.
+        virtual void Store(const FragmentKey& key, const char* html,
+                           size_t len) = 0;
+    };
+
+    /// @brief An interface for destinations that serialized HTML is streamed
+    /// to (e.g. a socket).
+    class Sink {
+      public:
+        virtual ~Sink() {}
+
+        /// @brief Consume a chunk of HTML.
+        /// @param data The HTML.
+        /// @param len The length of the HTML.
+        virtual void Write(const char* data, size_t len) = 0;
+
+        /// @brief Consume a region of a file, without reading it into memory.
+        ///
+        /// Sinks that can transfer files directly (e.g. with sendfile)
+        /// implement this. The default implementation does nothing.
+        /// @param fd The file descriptor.
+        /// @param offset The start of the region.
+        /// @param len The length of the region.
+        /// @returns false if the file was not consumed, in which case the
+        /// content is passed to Write() instead.
+        virtual bool WriteFile(int fd, uint64_t offset, size_t len) {
+          (void)fd;
+          (void)offset;
+          (void)len;
+          return false;
+        }
+
+        /// @brief Get the error number of a failed write, or 0.
+        ///
+        /// Sinks that can fail (e.g. FdSink) implement this, so that sinks
+        /// that pass the output on (e.g. PipelineSink) can report the errors
+        /// of their target. The default implementation returns 0.
+        virtual int error() const {
+          return 0;
+        }
+    };
+
+    /// @brief The state of an ongoing serialization of a node tree.
+    class Writer {
+      public:
+        /// @param[out] out The output string that will receive the HTML.
+        explicit Writer(std::string& out) : out_(out), cache_(nullptr),
+            cache_salt_(kHashSeed), sink_(nullptr), chunk_size_(0),
+            captures_(0) {}
+
+        /// @brief Get the output string.
+        ///
+        /// When a Sink is attached, this is a buffer that is passed to the
+        /// Sink in chunks.
+        std::string& out() {
+          return out_;
+        }
+
+        /// @brief Stream the HTML to a Sink.
+        ///
+        /// The output string is then used as a buffer, which is passed to the
+        /// Sink whenever it has grown to @c chunk_size bytes (checked between
+        /// nodes), and by Flush().
+        /// @param sink The Sink (nullptr to disable streaming).
+        /// @param chunk_size The size at which the buffer is passed on.
+        void SetSink(Sink* sink, size_t chunk_size = 64 * 1024) {
+          sink_ = sink;
+          chunk_size_ = chunk_size;
+        }
+
+        /// @brief Get the Sink, or nullptr if there is none.
+        Sink* sink() const {
+          return sink_;
+        }
+
+        /// @brief Pass the buffered HTML to the Sink, if there is one.
+        ///
+        /// Nothing is passed on while the output is being captured for a
+        /// fragment cache.
+        void Flush() {
+          if (sink_ && captures_ == 0 && !out_.empty()) {
+            sink_->Write(out_.data(), out_.size());
+            out_.clear();
+          }
+        }
+
+        /// @brief Flush the buffered HTML if it has reached the chunk size.
+        void MaybeFlush() {
+          if (sink_ && out_.size() >= chunk_size_)
+            Flush();
+        }
+
+        /// @brief Pass a region of a file to the Sink, after the buffered
+        /// HTML.
+        /// @returns false if the Sink can not consume the file directly (or
+        /// the output is being captured), in which case the caller must
+        /// write the content to out() instead.
+        bool WriteFile(int fd, uint64_t offset, size_t len) {
+          if (!sink_ || captures_ != 0)
+            return false;
+          Flush();
+          return sink_->WriteFile(fd, offset, len);
+        }
+
+        /// @brief Mark the start of a part of the output that must stay in
+        /// the output string (e.g. to store it in a fragment cache).
+        ///
+        /// Captures may be nested, and must be ended with EndCapture().
+        void BeginCapture() {
+          ++captures_;
+        }
+
+        /// @brief Mark the end of a part of the output that was started by
+        /// BeginCapture().
+        void EndCapture() {
+          --captures_;
+        }
+
+        /// @brief Add an attribute rewrite that is applied to all attributes
+        /// that are written by this Writer.
+        ///
+        /// The rewrites are tried in the order that they were added, and at
+        /// most one rewrite is applied to each attribute.
+        void AddAttributeRewrite(const AttributeRewrite& rewrite) {
+          rewrites_.push_back(rewrite);
+          cache_salt_ = HashCombine(cache_salt_, rewrite.Hash());
+        }
+
+        /// @brief Set the cache that is used for Elements that have caching
+        /// enabled (nullptr disables caching).
+        void SetFragmentCache(FragmentCache* cache) {
+          cache_ = cache;
+        }
+
+        /// @brief Get the fragment cache, or nullptr if there is none.
+        FragmentCache* fragment_cache() const {
+          return cache_;
+        }
+
+        /// @brief Get the key that a fragment is cached under by this Writer.
+        ///
+        /// The key depends on the attribute rewrites, since they change the
+        /// serialized HTML.
+        /// @param element_key The cache key of the Element.
+        FragmentKey CacheKey(const FragmentKey& element_key) const {
+          FragmentKey key;
+          key.hash = HashCombine(cache_salt_, element_key.hash);
+          key.check = HashCombine(cache_salt_, element_key.check);
+          return key;
+        }
+
+        /// @brief Find the attribute rewrite that applies to an attribute.
+        /// @returns The first matching rewrite, or nullptr if none matches.
+        const AttributeRewrite* FindAttributeRewrite(
+            const char* name, size_t name_len, const char* escaped_value,
+            size_t value_len) const {
+          for (auto i = rewrites_.begin(); i != rewrites_.end(); ++i) {
+            if (i->Matches(name, name_len, escaped_value, value_len))
+              return &(*i);
+          }
+          return nullptr;
+        }
+
+        /// @brief Find the attribute rewrite that applies to an attribute.
+        /// @returns The first matching rewrite, or nullptr if none matches.
+        const AttributeRewrite* FindAttributeRewrite(
+            const std::string& name, const std::string& escaped_value) const {
+          return FindAttributeRewrite(name.data(), name.size(),
+                                      escaped_value.data(),
+                                      escaped_value.size());
+        }
+
+      private:
+        std::string& out_;
+        std::vector<AttributeRewrite> rewrites_;
+        FragmentCache* cache_;
+        uint64_t cache_salt_;
+        Sink* sink_;
+        size_t chunk_size_;
+        int captures_;
+    };
+
     /// @brief An interface used for all HTML nodes.
+    ///
+    /// Nodes are linked to their siblings in an intrusive doubly linked list,
+    /// which makes insertion, removal and reordering of children O(1).
     class Node {
       public:
+        /// @brief The kind of a node.
+        enum Type {
+          kElement,  ///< The node is an Element.
+          kText,     ///< The node is a TextNode.
+          kRaw,      ///< The node is a RawNode.
+          kOther     ///< The node is of some other (user defined) kind.
+        };
+
+        Node() : type_(kOther), parent_(nullptr), prev_sibling_(nullptr),
+            next_sibling_(nullptr) {}
+
+        explicit Node(Type type) : type_(type), parent_(nullptr),
+            prev_sibling_(nullptr), next_sibling_(nullptr) {}
+
         virtual ~Node() {}
 
-        /// @brief Get an HTML formatted string representing this node.
-        /// @param[out] out The output string that will receive the HTML.
-        virtual void GetHTML(std::string& out) const = 0;
-    };
+        /// @brief Get an HTML formatted string representing this node.
+        /// @param[out] out The output string that will receive the HTML.
+        void GetHTML(std::string& out) const {
+          Writer writer(out);
+          Write(writer);
+        }
+
+        /// @brief Write the HTML representation of this node.
+        /// @param writer The Writer that receives the HTML.
+        virtual void Write(Writer& writer) const = 0;
+
+        /// @brief Get a key that determines the HTML of this node, for the
+        /// structural hash of its parent (see Element::Hash()).
+        ///
+        /// Nodes of other (user defined) kinds are hashed by their HTML, which
+        /// is written on every hash. Nodes whose HTML is large, but determined
+        /// by a small key (e.g. FileNode), implement this instead. The default
+        /// implementation returns false.
+        /// @param[out] key The string that the key is appended to.
+        /// @returns false if the node has no such key.
+        virtual bool GetHashKey(std::string& key) const {
+          (void)key;
+          return false;
+        }
+
+        /// @brief Get the kind of this node.
+        Type type() const {
+          return type_;
+        }
+
+        /// @brief Get the parent Element, or nullptr if this node is detached.
+        Element* parent() const {
+          return parent_;
+        }
+
+        /// @brief Get the previous sibling, or nullptr if this is the first.
+        Node* previous_sibling() const {
+          return prev_sibling_;
+        }
+
+        /// @brief Get the next sibling, or nullptr if this is the last one.
+        Node* next_sibling() const {
+          return next_sibling_;
+        }
+
+      private:
+        friend class Element;
+
+        Type type_;
+        Element* parent_;
+        Node* prev_sibling_;
+        Node* next_sibling_;
+    };
+
+    /// @brief A forward iterator that visits all nodes of a subtree in
+    /// pre-order (parents before their children).
+    ///
+    /// The iterator only follows the parent and sibling links of the nodes, so
+    /// it does not allocate any memory. The node that the iterator points to
+    /// may be modified, but must not be moved or removed from the tree.
+    class PreOrderIterator {
+      public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef Node* value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef Node* const* pointer;
+        typedef Node* const& reference;
+
+        PreOrderIterator() : node_(nullptr), root_(nullptr) {}
+
+        /// @brief Create an iterator that starts at (and includes) @c root.
+        explicit PreOrderIterator(Node* root) : node_(root), root_(root) {}
+
+        reference operator*() const {
+          return node_;
+        }
+
+        PreOrderIterator& operator++() {
+          if (node_->type() == Node::kElement) {
+            Node* child = static_cast<Element*>(node_)->first_child();
+            if (child) {
+              node_ = child;
+              return *this;
+            }
+          }
+          while (node_ != root_) {
+            if (node_->next_sibling()) {
+              node_ = node_->next_sibling();
+              return *this;
+            }
+            node_ = node_->parent();
+          }
+          node_ = nullptr;
+          return *this;
+        }
+
+        PreOrderIterator operator++(int) {
+          PreOrderIterator old = *this;
+          ++(*this);
+          return old;
+        }
+
+        bool operator==(const PreOrderIterator& other) const {
+          return node_ == other.node_;
+        }
+
+        bool operator!=(const PreOrderIterator& other) const {
+          return node_ != other.node_;
+        }
+
+      private:
+        Node* node_;
+        Node* root_;
+    };
+
+    /// @brief A forward iterator that visits all nodes of a subtree in
+    /// post-order (children before their parents).
+    ///
+    /// Like PreOrderIterator, this iterator does not allocate any memory. The
+    /// children of the node that the iterator points to have already been
+    /// visited, so they may be removed from the tree.
+    class PostOrderIterator {
+      public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef Node* value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef Node* const* pointer;
+        typedef Node* const& reference;
+
+        PostOrderIterator() : node_(nullptr), root_(nullptr) {}
+
+        /// @brief Create an iterator over the subtree rooted at @c root. The
+        /// root is the last node to be visited.
+        explicit PostOrderIterator(Node* root) :
+            node_(FirstLeaf(root)), root_(root) {}
+
+        reference operator*() const {
+          return node_;
+        }
+
+        PostOrderIterator& operator++() {
+          if (node_ == root_)
+            node_ = nullptr;
+          else if (node_->next_sibling())
+            node_ = FirstLeaf(node_->next_sibling());
+          else
+            node_ = node_->parent();
+          return *this;
+        }
+
+        PostOrderIterator operator++(int) {
+          PostOrderIterator old = *this;
+          ++(*this);
+          return old;
+        }
+
+        bool operator==(const PostOrderIterator& other) const {
+          return node_ == other.node_;
+        }
+
+        bool operator!=(const PostOrderIterator& other) const {
+          return node_ != other.node_;
+        }
+
+      private:
+        static Node* FirstLeaf(Node* node) {
+          while (node->type() == Node::kElement) {
+            Node* child = static_cast<Element*>(node)->first_child();
+            if (!child)
+              break;
+            node = child;
+          }
+          return node;
+        }
+
+        Node* node_;
+        Node* root_;
+    };
+
+    /// @brief A range of nodes, for use with range based for loops.
+    template <class Iterator>
+    class NodeRange {
+      public:
+        explicit NodeRange(Node* root) : root_(root) {}
+
+        Iterator begin() const {
+          return Iterator(root_);
+        }
+
+        Iterator end() const {
+          return Iterator();
+        }
+
+      private:
+        Node* root_;
+    };
+
+    /// @brief A base class for visitors that are passed to Element::Walk().
+    ///
+    /// The visitor methods are resolved at compile time (there is no virtual
+    /// dispatch per node), so a visitor only needs to declare the methods that
+    /// it is interested in, hiding the empty defaults of this class.
+    struct Visitor {
+      /// @brief Called when an Element is entered, before its attributes.
+      /// @returns false to skip the children of the Element.
+      bool EnterElement(Element&) {
+        return true;
+      }
+
+      /// @brief Called for each attribute, after EnterElement().
+      void VisitAttribute(Element&, Attribute&) {}
+
+      /// @brief Called when an Element is left, after its children.
+      void LeaveElement(Element&) {}
+
+      /// @brief Called for each text node.
+      void VisitText(TextNode&) {}
+
+      /// @brief Called for each node that is not an Element or a TextNode
+      /// (e.g. a RawNode).
+      void VisitOther(Node&) {}
+    };
+
+    /// @brief An attribute that can be part of an Element.
+    class Attribute {
+      public:
+        /// @param name The attribute name.
+        /// @param value The attribute value (unescaped).
+        /// @param ascii_only Replace non-ASCII characters in the value with
+        /// numeric character references (see AppendEscapedAscii()).
+        Attribute(const char* name, const char* value,
+                  bool ascii_only = false) :
+            name_(name, std::strlen(name)), ascii_only_(ascii_only) {
+          Escape(value, std::strlen(value));
+        }
+
+        Attribute(const std::string& name, const std::string& value,
+                  bool ascii_only = false) :
+            name_(name), ascii_only_(ascii_only) {
+          Escape(value.data(), value.size());
+        }
+
+        /// @brief Create an attribute with a UTF-16 value, which is
+        /// transcoded to UTF-8 and escaped in one pass.
+        /// @param name The attribute name.
+        /// @param value The attribute value (unescaped).
+        /// @param len The length of the value, in code units.
+        /// @param ascii_only Replace non-ASCII characters in the value with
+        /// numeric character references.
+        Attribute(const std::string& name, const char16_t* value, size_t len,
+                  bool ascii_only = false) :
+            name_(name), ascii_only_(ascii_only) {
+          internal::AppendTranscodedEscaped(value, len, true, ascii_only,
+                                            value_);
+        }
+
+        /// @brief Create an attribute with a UTF-32 value, which is
+        /// transcoded to UTF-8 and escaped in one pass.
+        /// @param name The attribute name.
+        /// @param value The attribute value (unescaped).
+        /// @param len The length of the value, in code units.
+        /// @param ascii_only Replace non-ASCII characters in the value with
+        /// numeric character references.
+        Attribute(const std::string& name, const char32_t* value, size_t len,
+                  bool ascii_only = false) :
+            name_(name), ascii_only_(ascii_only) {
+          internal::AppendTranscodedEscaped(value, len, true, ascii_only,
+                                            value_);
+        }
+
+        void GetHTML(std::string& out) const {
+          Writer writer(out);
+          Write(writer);
+        }
+
+        /// @brief Write the HTML representation of this attribute.
+        /// @param writer The Writer that receives the HTML.
+        void Write(Writer& writer) const {
+          std::string& out = writer.out();
+          out.append(name_.get());
+          out.append("=\"", 2);
+          const AttributeRewrite* rewrite =
+              writer.FindAttributeRewrite(name_.get(), value_);
+          if (rewrite) {
+            out.append(rewrite->escaped_prefix());
+            out.append(value_);
+            out.append(rewrite->escaped_suffix());
+          }
+          else
+            out.append(value_);
+          out += '"';
+        }
+
+        /// @brief Get the attribute name.
+        ///
+        /// Names are interned while the name table has room for them (see
+        /// internal::NameTable), so two attributes (or an attribute and an
+        /// element) with interned names have the same name if and only if the
+        /// returned references have the same address.
+        const std::string& name() const {
+          return name_.get();
+        }
+
+        /// @brief Whether the name is interned (see name()).
+        bool name_interned() const {
+          return name_.interned() != nullptr;
+        }
 
-    /// @brief An attribute that can be part of an Element.
-    class Attribute {
-      public:
-        Attribute(const char* name, const char* value) : name_(name) {
-          SetEscapedValue(value, std::strlen(value));
+        /// @brief Get the attribute value, in its escaped form.
+        const std::string& escaped_value() const {
+          return value_;
         }
 
-        Attribute(const std::string& name, const std::string& value) :
-            name_(name) {
-          SetEscapedValue(value.data(), value.size());
+        /// @brief Determine if non-ASCII characters in the value are replaced
+        /// with numeric character references.
+        bool ascii_only() const {
+          return ascii_only_;
         }
 
-        void GetHTML(std::string& out) const {
-          out.append(name_);
-          out.append("=\"", 2);
-          out.append(value_);
-          out += '"';
+        /// @brief Set the attribute value.
+        /// @param value The new value (unescaped).
+        void SetValue(const std::string& value) {
+          value_.clear();
+          Escape(value.data(), value.size());
         }
 
-      private:
-        void SetEscapedValue(const char* value, size_t len) {
-          // We escape: " (0x22), & (0x26) and < (0x3c). The escape LUT is
-          // indexed by the character code (0-255) modulo 8.
-          static const char kEscapeLut[8] = {1, 0, '"', 0, '<', 0, '&', 0};
+        /// @brief Escape a string for use as an attribute value, and replace
+        /// non-ASCII characters with numeric character references.
+        ///
+        /// The string should be UTF-8. Invalid bytes are replaced by U+FFFD.
+        /// @param value The string to escape.
+        /// @param len The length of the string.
+        /// @param[out] out The string that the escaped value is appended to.
+        static void AppendEscapedAscii(const char* value, size_t len,
+                                       std::string& out) {
+          out.reserve(out.size() + len);
+          const char* end = value + len;
+          while (true) {
+            const char* p = FindEscapeAscii(value, end);
+            out.append(value, p - value);
+            if (p == end)
+              break;
+            switch (*p) {
+            case '"':
+              out.append("&#34;", 5);
+              break;
+            case '&':
+              out.append("&amp;", 5);
+              break;
+            case '<':
+              out.append("&lt;", 4);
+              break;
+            default:  // Non-ASCII.
+              value = internal::AppendCharRef(p, end, out);
+              continue;
+            }
+            value = p + 1;
+          }
+        }
 
+        /// @brief Escape a string for use as an attribute value.
+        /// @param value The string to escape.
+        /// @param len The length of the string.
+        /// @param[out] out The string that the escaped value is appended to.
+        static void AppendEscaped(const char* value, size_t len,
+                                  std::string& out) {
           // Reserve space for the escaped string.
           // Note: This is optimized for strings that need no escaping. To
           // optimize for strings that may need escaping, but at some memory
           // cost, reserve len + (len >> 1) instead.
-          value_.reserve(len);
+          out.reserve(out.size() + len);
 
-          // Copy the value string, and escape characters as needed.
-          for (size_t i = 0; i < len; ++i) {
-            char c = value[i];
-            if (kEscapeLut[c & 7] == c) {
-              switch (c) {
-              case '"':
-                value_.append("&#34;", 5);
-                break;
-              case '&':
-                value_.append("&amp;", 5);
-                break;
-              default:  // '<'
-                value_.append("&lt;", 4);
-              }
+          // Copy the value string in runs of characters that need no escaping,
+          // and escape characters as needed.
+          const char* end = value + len;
+          while (true) {
+            const char* p = FindEscape(value, end);
+            out.append(value, p - value);
+            if (p == end)
+              break;
+            switch (*p) {
+            case '"':
+              out.append("&#34;", 5);
+              break;
+            case '&':
+              out.append("&amp;", 5);
+              break;
+            default:  // '<'
+              out.append("&lt;", 4);
             }
-            else
-              value_ += c;
+            value = p + 1;
+          }
+        }
+
+      private:
+        /// @brief Find the first character that needs escaping.
+        /// @returns A pointer to the character, or @c end if there is none.
+        static const char* FindEscape(const char* p, const char* end) {
+#if defined(HTMLGEN_USE_SSE2)
+          const __m128i quot = _mm_set1_epi8('"');
+          const __m128i amp = _mm_set1_epi8('&');
+          const __m128i lt = _mm_set1_epi8('<');
+          for (; end - p >= 16; p += 16) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+            __m128i m = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(v, quot), _mm_cmpeq_epi8(v, amp)),
+                _mm_cmpeq_epi8(v, lt));
+            unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(m));
+            if (mask)
+              return p + internal::CountTrailingZeros(mask);
+          }
+#endif
+
+          // We escape: " (0x22), & (0x26) and < (0x3c). The escape LUT is
+          // indexed by the character code (0-255) modulo 8.
+          static const char kEscapeLut[8] = {1, 0, '"', 0, '<', 0, '&', 0};
+          for (; p != end; ++p) {
+            char c = *p;
+            if (kEscapeLut[c & 7] == c)
+              return p;
+          }
+          return end;
+        }
+
+        /// @brief Find the first character that needs escaping, or that is
+        /// not ASCII.
+        static const char* FindEscapeAscii(const char* p, const char* end) {
+#if defined(HTMLGEN_USE_SSE2)
+          const __m128i quot = _mm_set1_epi8('"');
+          const __m128i amp = _mm_set1_epi8('&');
+          const __m128i lt = _mm_set1_epi8('<');
+          for (; end - p >= 16; p += 16) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+            __m128i m = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(v, quot), _mm_cmpeq_epi8(v, amp)),
+                _mm_cmpeq_epi8(v, lt));
+            // Non-ASCII bytes have the sign bit set.
+            unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(m)) |
+                            static_cast<unsigned>(_mm_movemask_epi8(v));
+            if (mask)
+              return p + internal::CountTrailingZeros(mask);
+          }
+#endif
+
+          static const char kEscapeLut[8] = {1, 0, '"', 0, '<', 0, '&', 0};
+          for (; p != end; ++p) {
+            char c = *p;
+            if ((c & 0x80) || kEscapeLut[c & 7] == c)
+              return p;
           }
+          return end;
         }
 
-        const std::string name_;
+        void Escape(const char* value, size_t len) {
+          if (ascii_only_)
+            AppendEscapedAscii(value, len, value_);
+          else
+            AppendEscaped(value, len, value_);
+        }
+
+        internal::Name name_;
         std::string value_;
+        bool ascii_only_;
     };
 
     /// @brief A text node (typically named "#text" in a DOM).
     class TextNode : public Node {
       public:
-        explicit TextNode(const char* value) {
-          SetEscapedValue(value, std::strlen(value));
+        /// @param value The text (unescaped).
+        /// @param ascii_only Replace non-ASCII characters with numeric
+        /// character references (see AppendEscapedAscii()).
+        explicit TextNode(const char* value, bool ascii_only = false) :
+            Node(kText), raw_text_element_(nullptr), ascii_only_(ascii_only) {
+          Escape(value, std::strlen(value));
         }
 
-        explicit TextNode(const std::string& value) {
-          SetEscapedValue(value.data(), value.size());
+        explicit TextNode(const std::string& value, bool ascii_only = false) :
+            Node(kText), raw_text_element_(nullptr), ascii_only_(ascii_only) {
+          Escape(value.data(), value.size());
         }
 
-        virtual void GetHTML(std::string& out) const {
-          out.append(value_);
+        /// @brief Create a text node from UTF-16 text, which is transcoded to
+        /// UTF-8 and escaped in one pass.
+        /// @param value The text (unescaped).
+        /// @param len The length of the text, in code units.
+        /// @param ascii_only Replace non-ASCII characters with numeric
+        /// character references.
+        TextNode(const char16_t* value, size_t len, bool ascii_only = false) :
+            Node(kText), raw_text_element_(nullptr), ascii_only_(ascii_only) {
+          internal::AppendTranscodedEscaped(value, len, false, ascii_only,
+                                            value_);
         }
 
-      private:
-        void SetEscapedValue(const char* value, size_t len) {
-          // We escape: & (0x26), < (0x3c) and > (0x3e). The escape LUT is
-          // indexed by the character code (0-255) modulo 16.
-          static const char kEscapeLut[16] = {1, 0, 0, 0, 0, 0, '&', 0,
-                                              0, 0, 0, 0, '<', 0, '>', 0};
+        /// @brief Create a text node from UTF-32 text, which is transcoded to
+        /// UTF-8 and escaped in one pass.
+        /// @param value The text (unescaped).
+        /// @param len The length of the text, in code units.
+        /// @param ascii_only Replace non-ASCII characters with numeric
+        /// character references.
+        TextNode(const char32_t* value, size_t len, bool ascii_only = false) :
+            Node(kText), raw_text_element_(nullptr), ascii_only_(ascii_only) {
+          internal::AppendTranscodedEscaped(value, len, false, ascii_only,
+                                            value_);
+        }
 
+        /// @brief Selects the raw text constructor, e.g.
+        /// <tt>TextNode(TextNode::RawText(), value, "script")</tt>.
+        struct RawText {};
+
+        /// @brief Create a text node for the content of a raw text element
+        /// (see Element::IsRawTextElement()).
+        ///
+        /// The text is not escaped (see AppendRawText()). Element::AddTextChild
+        /// uses this for raw text elements. If the node is moved to another
+        /// element, the text is rewritten for it (see Reparent()).
+        /// @param value The text.
+        /// @param element_name The name of the raw text element (e.g.
+        /// "script"). It is interned (see internal::NameTable::Intern()).
+        /// @param ascii_only Replace non-ASCII characters with escapes (see
+        /// AppendRawText()).
+        TextNode(RawText, const std::string& value,
+                 const std::string& element_name, bool ascii_only = false) :
+            Node(kText),
+            raw_text_element_(internal::NameTable::Intern(element_name)),
+            ascii_only_(ascii_only) {
+          Escape(value.data(), value.size());
+        }
+
+        // An element name would convert to the ascii_only flag (see RawText).
+        TextNode(const char*, const char*, bool = false) = delete;
+        TextNode(const std::string&, const char*, bool = false) = delete;
+
+        virtual void Write(Writer& writer) const {
+          writer.out().append(value_);
+        }
+
+        /// @brief Get the text, in its escaped form (or in its raw text form,
+        /// in a raw text element).
+        const std::string& escaped_value() const {
+          return value_;
+        }
+
+        /// @brief Set the text.
+        /// @param value The new text (unescaped).
+        void SetValue(const std::string& value) {
+          value_.clear();
+          Escape(value.data(), value.size());
+          if (parent())
+            parent()->InvalidateHash();
+        }
+
+        /// @brief Escape a string for use as text content.
+        /// @param value The string to escape.
+        /// @param len The length of the string.
+        /// @param[out] out The string that the escaped text is appended to.
+        static void AppendEscaped(const char* value, size_t len,
+                                  std::string& out) {
           // Reserve space for the escaped string.
           // Note: This is optimized for strings that need no escaping. To
           // optimize for strings that may need escaping, but at some memory
           // cost, reserve len + (len >> 1) instead.
-          value_.reserve(len);
+          out.reserve(out.size() + len);
 
-          // Copy the value string, and escape characters as needed.
-          for (size_t i = 0; i < len; ++i) {
-            char c = value[i];
-            if (kEscapeLut[c & 15] == c) {
-              switch (c) {
-              case '&':
-                value_.append("&amp;", 5);
-                break;
-              case '<':
-                value_.append("&lt;", 4);
+          // Copy the value string in runs of characters that need no escaping,
+          // and escape characters as needed.
+          const char* end = value + len;
+          while (true) {
+            const char* p = FindEscape(value, end);
+            out.append(value, p - value);
+            if (p == end)
+              break;
+            switch (*p) {
+            case '&':
+              out.append("&amp;", 5);
+              break;
+            case '<':
+              out.append("&lt;", 4);
+              break;
+            default:  // '>'
+              out.append("&gt;", 4);
+            }
+            value = p + 1;
+          }
+        }
+
+        /// @brief Escape a string for use as text content, and replace
+        /// non-ASCII characters with numeric character references.
+        ///
+        /// The string should be UTF-8. Invalid bytes are replaced by U+FFFD.
+        /// @param value The string to escape.
+        /// @param len The length of the string.
+        /// @param[out] out The string that the escaped text is appended to.
+        static void AppendEscapedAscii(const char* value, size_t len,
+                                       std::string& out) {
+          out.reserve(out.size() + len);
+          const char* end = value + len;
+          while (true) {
+            const char* p = FindEscapeAscii(value, end);
+            out.append(value, p - value);
+            if (p == end)
+              break;
+            switch (*p) {
+            case '&':
+              out.append("&amp;", 5);
+              break;
+            case '<':
+              out.append("&lt;", 4);
+              break;
+            case '>':
+              out.append("&gt;", 4);
+              break;
+            default:  // Non-ASCII.
+              value = internal::AppendCharRef(p, end, out);
+              continue;
+            }
+            value = p + 1;
+          }
+        }
+
+        /// @brief Find the first character that needs escaping.
+        /// @returns A pointer to the character, or @c end if there is none.
+        static const char* FindEscape(const char* p, const char* end) {
+#if defined(HTMLGEN_USE_SSE2)
+          const __m128i amp = _mm_set1_epi8('&');
+          const __m128i lt = _mm_set1_epi8('<');
+          const __m128i gt = _mm_set1_epi8('>');
+          for (; end - p >= 16; p += 16) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+            __m128i m = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(v, amp), _mm_cmpeq_epi8(v, lt)),
+                _mm_cmpeq_epi8(v, gt));
+            unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(m));
+            if (mask)
+              return p + internal::CountTrailingZeros(mask);
+          }
+#endif
+
+          // We escape: & (0x26), < (0x3c) and > (0x3e). The escape LUT is
+          // indexed by the character code (0-255) modulo 16.
+          static const char kEscapeLut[16] = {1, 0, 0, 0, 0, 0, '&', 0,
+                                              0, 0, 0, 0, '<', 0, '>', 0};
+          for (; p != end; ++p) {
+            char c = *p;
+            if (kEscapeLut[c & 15] == c)
+              return p;
+          }
+          return end;
+        }
+
+        /// @brief Prepare a string for use as the content of a raw text
+        /// element, such as "script" or "style".
+        ///
+        /// Raw text can not contain character references, so nothing is
+        /// escaped, except that an end tag for the element (e.g. "</script",
+        /// in any case) is written as "<\/script". That keeps the element
+        /// from ending early, and reads as the same text in JavaScript strings
+        /// and regular expressions, and in CSS. In "script" elements, "<!--"
+        /// and "<script" (in any case) are written as "\x3C!--" and
+        /// "\x3Cscript", since together they would hide the end tag of the
+        /// element (the "script data double escaped" state of HTML parsers).
+        /// These also read the same in strings and regular expressions. Only
+        /// '<' characters are inspected, so the string is otherwise copied in
+        /// large runs.
+        ///
+        /// In ASCII-only mode, non-ASCII characters are replaced with
+        /// JavaScript escapes (e.g. "\u00E9"), or CSS escapes (e.g.
+        /// "\0000E9") in "style" elements. These read as the same characters
+        /// in strings, identifiers and comments.
+        /// @param value The string.
+        /// @param len The length of the string.
+        /// @param element_name The (lower case) name of the element.
+        /// @param name_len The length of the element name.
+        /// @param[out] out The string that the text is appended to.
+        /// @param ascii_only Replace non-ASCII characters with escapes.
+        static void AppendRawText(const char* value, size_t len,
+                                  const char* element_name, size_t name_len,
+                                  std::string& out, bool ascii_only = false) {
+          out.reserve(out.size() + len);
+          const char* end = value + len;
+          const char* p = value;
+          bool css =
+              name_len == 5 && std::memcmp(element_name, "style", 5) == 0;
+          bool script =
+              name_len == 6 && std::memcmp(element_name, "script", 6) == 0;
+          while (true) {
+            if (ascii_only) {
+              p = FindRawTextAscii(p, end);
+              if (p == end)
                 break;
-              default:  // '>'
-                value_.append("&gt;", 4);
+              if (*p & 0x80) {
+                out.append(value, p - value);
+                p = AppendRawTextEscape(p, end, css, out);
+                value = p;
+                continue;
               }
+            } else {
+              p = static_cast<const char*>(std::memchr(p, '<', end - p));
+              if (!p)
+                break;
             }
-            else
-              value_ += c;
+            ++p;
+            size_t left = static_cast<size_t>(end - p);
+            if (left > name_len && *p == '/' &&
+                EqualsIgnoreCase(p + 1, element_name, name_len)) {
+              out.append(value, p - value);
+              out += '\\';
+              value = p;
+            } else if (script &&
+                       ((left >= 3 && std::memcmp(p, "!--", 3) == 0) ||
+                        (left >= 6 && EqualsIgnoreCase(p, "script", 6)))) {
+              out.append(value, p - 1 - value);
+              out.append("\\x3C", 4);
+              value = p;
+            }
+          }
+          out.append(value, end - value);
+        }
+
+        /// @brief Find the first character that needs escaping, or that is
+        /// not ASCII.
+        /// @returns A pointer to the character, or @c end if there is none.
+        static const char* FindEscapeAscii(const char* p, const char* end) {
+#if defined(HTMLGEN_USE_SSE2)
+          const __m128i amp = _mm_set1_epi8('&');
+          const __m128i lt = _mm_set1_epi8('<');
+          const __m128i gt = _mm_set1_epi8('>');
+          for (; end - p >= 16; p += 16) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+            __m128i m = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(v, amp), _mm_cmpeq_epi8(v, lt)),
+                _mm_cmpeq_epi8(v, gt));
+            // Non-ASCII bytes have the sign bit set.
+            unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(m)) |
+                            static_cast<unsigned>(_mm_movemask_epi8(v));
+            if (mask)
+              return p + internal::CountTrailingZeros(mask);
+          }
+#endif
+
+          static const char kEscapeLut[16] = {1, 0, 0, 0, 0, 0, '&', 0,
+                                              0, 0, 0, 0, '<', 0, '>', 0};
+          for (; p != end; ++p) {
+            char c = *p;
+            if ((c & 0x80) || kEscapeLut[c & 15] == c)
+              return p;
+          }
+          return end;
+        }
+
+      private:
+        /// @brief Find the first '<' or non-ASCII character of raw text.
+        static const char* FindRawTextAscii(const char* p, const char* end) {
+#if defined(HTMLGEN_USE_SSE2)
+          const __m128i lt = _mm_set1_epi8('<');
+          for (; end - p >= 16; p += 16) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+            unsigned mask =
+                static_cast<unsigned>(
+                    _mm_movemask_epi8(_mm_cmpeq_epi8(v, lt))) |
+                static_cast<unsigned>(_mm_movemask_epi8(v));
+            if (mask)
+              return p + internal::CountTrailingZeros(mask);
+          }
+#endif
+          for (; p != end; ++p) {
+            if (*p == '<' || (*p & 0x80))
+              return p;
+          }
+          return end;
+        }
+
+        /// @brief Append a JavaScript or CSS escape for the UTF-8 sequence
+        /// at p. An invalid byte is replaced by U+FFFD.
+        /// @returns A pointer to the end of the sequence.
+        static const char* AppendRawTextEscape(const char* p, const char* end,
+                                               bool css, std::string& out) {
+          uint32_t code_point;
+          int len = internal::DecodeUtf8(p, end, code_point);
+          if (!len) {
+            code_point = 0xfffd;
+            len = 1;
+          }
+          if (css) {
+            // Six digits need no terminating space.
+            out += '\\';
+            internal::AppendHex(code_point, 6, out);
+          } else if (code_point < 0x10000) {
+            out.append("\\u", 2);
+            internal::AppendHex(code_point, 4, out);
+          } else {
+            // A UTF-16 surrogate pair.
+            code_point -= 0x10000;
+            out.append("\\u", 2);
+            internal::AppendHex(0xd800 + (code_point >> 10), 4, out);
+            out.append("\\u", 2);
+            internal::AppendHex(0xdc00 + (code_point & 0x3ff), 4, out);
+          }
+          return p + len;
+        }
+
+        friend class Element;
+
+        /// @brief Rewrite the text for a new parent Element, if it is a raw
+        /// text element and the text is escaped, or the other way around.
+        ///
+        /// Escaped text is unescaped, and raw text is taken from raw_text_
+        /// (the text before it was prepared), so the text is the same in the
+        /// new element, e.g. when it moves from a "script" to a "style"
+        /// element in ASCII-only mode (which use different escapes).
+        /// @param raw_text_element The interned name of the new parent, if it
+        /// is a raw text element, or nullptr.
+        void Reparent(const std::string* raw_text_element) {
+          if (raw_text_element == raw_text_element_)
+            return;
+          std::string text;
+          if (!raw_text_element_)
+            internal::AppendUnescapedText(value_, text);
+          else if (!raw_text_.empty())
+            text.swap(raw_text_);
+          else
+            text.swap(value_);
+          value_.clear();
+          raw_text_element_ = raw_text_element;
+          Escape(text.data(), text.size());
+        }
+
+        void Escape(const char* value, size_t len) {
+          raw_text_.clear();
+          if (raw_text_element_) {
+            AppendRawText(value, len, raw_text_element_->data(),
+                          raw_text_element_->size(), value_, ascii_only_);
+            // Preparing raw text only makes it longer, so the text is kept
+            // (for Reparent()) only when it was changed.
+            if (value_.size() != len)
+              raw_text_.assign(value, len);
+          } else if (ascii_only_)
+            AppendEscapedAscii(value, len, value_);
+          else
+            AppendEscaped(value, len, value_);
+        }
+
+        /// @brief Compare a string with a lower case ASCII name, ignoring
+        /// case.
+        static bool EqualsIgnoreCase(const char* str, const char* name,
+                                     size_t len) {
+          for (size_t i = 0; i < len; ++i) {
+            char c = str[i];
+            if (c >= 'A' && c <= 'Z')
+              c = static_cast<char>(c - 'A' + 'a');
+            if (c != name[i])
+              return false;
           }
+          return true;
         }
 
         std::string value_;
+        std::string raw_text_;  // The text that value_ was prepared from.
+        const std::string* raw_text_element_;  // Interned, or nullptr.
+        bool ascii_only_;
+    };
+
+    /// @brief A node that holds pre-rendered HTML.
+    ///
+    /// The HTML is written as is, without any escaping, so it must come from a
+    /// trusted source (e.g. another renderer that escapes its output).
+    class RawNode : public Node {
+      public:
+        explicit RawNode(const char* html) : Node(kRaw), html_(html) {}
+
+        explicit RawNode(std::string html) : Node(kRaw),
+            html_(std::move(html)) {}
+
+        RawNode(const char* html, size_t len) : Node(kRaw), html_(html, len) {}
+
+        virtual void Write(Writer& writer) const {
+          writer.out().append(html_);
+        }
+
+        /// @brief Get the HTML.
+        const std::string& html() const {
+          return html_;
+        }
+
+      private:
+        std::string html_;
     };
 
     /// @brief An Element can have attributes and children.
     class Element : public Node {
       public:
-        explicit Element(const char* name) : name_(name) {}
+        explicit Element(const char* name) : Node(kElement),
+            name_(name, std::strlen(name)),
+            name_flags_(NameFlags(name_.interned())), first_child_(nullptr),
+            last_child_(nullptr), cache_mode_(kNoCache), cache_key_(0),
+            hash_valid_(false), hash_(0), hash_check_(0), ascii_only_(false) {}
 
-        explicit Element(const std::string& name) : name_(name) {}
+        explicit Element(const std::string& name) : Node(kElement),
+            name_(name),
+            name_flags_(NameFlags(name_.interned())), first_child_(nullptr),
+            last_child_(nullptr), cache_mode_(kNoCache), cache_key_(0),
+            hash_valid_(false), hash_(0), hash_check_(0), ascii_only_(false) {}
 
         virtual ~Element() {
-          for (auto i = children_.begin(); i != children_.end(); ++i)
-            delete (*i);
+          Node* child = first_child_;
+          while (child) {
+            Node* next = child->next_sibling_;
+            delete child;
+            child = next;
+          }
+        }
+
+        virtual void Write(Writer& writer) const {
+          FragmentCache* cache = writer.fragment_cache();
+          if (cache_mode_ == kNoCache || !cache) {
+            WriteUncached(writer);
+            return;
+          }
+
+          FragmentKey element_key = {cache_key_, 0};
+          if (cache_mode_ == kCacheByHash)
+            element_key = Hash();
+          FragmentKey key = writer.CacheKey(element_key);
+          std::string& out = writer.out();
+          if (cache->Fetch(key, out))
+            return;
+          size_t start = out.size();
+          writer.BeginCapture();
+          WriteUncached(writer);
+          writer.EndCapture();
+          cache->Store(key, out.data() + start, out.size() - start);
+        }
+
+        /// @brief Enable caching of the serialized subtree, keyed by the
+        /// structural hash of the subtree (see Hash()).
+        ///
+        /// The cache is only used if one is attached to the Writer (see
+        /// Writer::SetFragmentCache()).
+        void EnableCaching() {
+          cache_mode_ = kCacheByHash;
         }
 
-        virtual void GetHTML(std::string& out) const {
+        /// @brief Enable caching of the serialized subtree, keyed by a caller
+        /// provided key.
+        ///
+        /// This avoids hashing the subtree on every serialization. The caller
+        /// is responsible for using different keys for different content.
+        /// @param key The cache key.
+        void EnableCaching(uint64_t key) {
+          cache_mode_ = kCacheByKey;
+          cache_key_ = key;
+        }
+
+        /// @brief Disable caching of the serialized subtree.
+        void DisableCaching() {
+          cache_mode_ = kNoCache;
+        }
+
+        /// @brief Enable or disable ASCII-only output for the text and
+        /// attribute values that are added to this Element from now on.
+        ///
+        /// Non-ASCII characters (UTF-8) are then replaced with numeric
+        /// character references (e.g. "&#xE9;") in the same pass as the
+        /// escaping, and with JavaScript or CSS escapes in raw text elements.
+        /// Elements that are created with AddChild() inherit the setting, so
+        /// enabling it on the root of a new Document makes the whole document
+        /// ASCII-only. Element and attribute names are not converted.
+        ///
+        /// @code{.cpp}
+        ///   htmlgen::Document doc;
+        ///   doc.root()->SetAsciiOnly(true);
+        /// @endcode
+        void SetAsciiOnly(bool ascii_only) {
+          ascii_only_ = ascii_only;
+        }
+
+        /// @brief Determine if ASCII-only output is enabled (see
+        /// SetAsciiOnly()).
+        bool ascii_only() const {
+          return ascii_only_;
+        }
+
+        /// @brief Calculate a structural hash of the subtree rooted at this
+        /// Element.
+        ///
+        /// Subtrees with the same names, attributes, text and structure have
+        /// the same hash. The hash is a 128-bit SipHash, so subtrees with the
+        /// same hash can not practically be constructed.
+        ///
+        /// The hash of each Element is kept until the Element or one of its
+        /// descendants is changed, so rehashing a tree after a change only
+        /// rehashes the path to the change. Subtrees that contain nodes of
+        /// other (user defined) kinds are rehashed on every call, since their
+        /// HTML may change without the tree being changed. Such nodes are
+        /// hashed by their key if they have one (see Node::GetHashKey()), and
+        /// by their HTML otherwise.
+        FragmentKey Hash() const {
+          FragmentKey key;
+          if (hash_valid_.load(std::memory_order_acquire)) {
+            key.hash = hash_.load(std::memory_order_relaxed);
+            key.check = hash_check_.load(std::memory_order_relaxed);
+            return key;
+          }
+
+          internal::SipHash h(kHashSeed, 0x68746d6c67656e31ULL);
+          HashString(h, name_.get());
+          h.Update(attributes_.size());
+          for (auto a = attributes_.begin(); a != attributes_.end(); ++a) {
+            HashString(h, a->name());
+            HashString(h, a->escaped_value());
+          }
+          bool keep = true;
+          for (const Node* child = first_child_; child;
+               child = child->next_sibling_) {
+            h.Update(static_cast<uint64_t>(child->type_));
+            if (child->type_ == kElement) {
+              const Element* element = static_cast<const Element*>(child);
+              FragmentKey child_key = element->Hash();
+              h.Update(child_key.hash);
+              h.Update(child_key.check);
+              keep = keep && element->hash_valid_.load(
+                                 std::memory_order_relaxed);
+            } else if (child->type_ == kText) {
+              HashString(h, static_cast<const TextNode*>(child)
+                                ->escaped_value());
+            } else if (child->type_ == kRaw) {
+              HashString(h, static_cast<const RawNode*>(child)->html());
+            } else {
+              std::string html;
+              bool has_key = child->GetHashKey(html);
+              if (!has_key)
+                child->GetHTML(html);
+              h.Update(static_cast<uint64_t>(has_key));
+              HashString(h, html);
+              keep = false;
+            }
+          }
+          h.Update(static_cast<uint64_t>(-1));
+          h.Final(key.hash, key.check);
+
+          if (keep) {
+            hash_.store(key.hash, std::memory_order_relaxed);
+            hash_check_.store(key.check, std::memory_order_relaxed);
+            hash_valid_.store(true, std::memory_order_release);
+          }
+          return key;
+        }
+
+        /// @brief Write the HTML representation of this element, bypassing
+        /// any fragment cache.
+        /// @param writer The Writer that receives the HTML.
+        void WriteUncached(Writer& writer) const {
+          std::string& out = writer.out();
           out += '<';
-          out.append(name_);
+          out.append(name_.get());
           for (auto i = attributes_.begin(); i != attributes_.end(); ++i) {
             out += ' ';
-            i->GetHTML(out);
+            i->Write(writer);
           }
-          if (children_.size() > 0 || !IsVoidElement()) {
+          if (first_child_ || !IsVoidElement()) {
             out += '>';
-            for (auto i = children_.begin(); i != children_.end(); ++i)
-              (*i)->GetHTML(out);
+            for (Node* child = first_child_; child;
+                 child = child->next_sibling_) {
+              child->Write(writer);
+              writer.MaybeFlush();
+            }
             out.append("</", 2);
-            out.append(name_);
+            out.append(name_.get());
           }
           out += '>';
         }
 
+        /// @brief Get the element name.
+        ///
+        /// Names are interned while the name table has room for them (see
+        /// internal::NameTable), so two elements with interned names have the
+        /// same name if and only if the returned references have the same
+        /// address.
+        const std::string& name() const {
+          return name_.get();
+        }
+
+        /// @brief Whether the name is interned (see name()).
+        bool name_interned() const {
+          return name_.interned() != nullptr;
+        }
+
+        /// @brief Get the first child, or nullptr if there are no children.
+        Node* first_child() const {
+          return first_child_;
+        }
+
+        /// @brief Get the last child, or nullptr if there are no children.
+        Node* last_child() const {
+          return last_child_;
+        }
+
+        /// @brief Get the attributes of this Element.
+        const std::vector<Attribute>& attributes() const {
+          return attributes_;
+        }
+
+        /// @brief Get all nodes of the subtree rooted at this Element, in
+        /// pre-order (including this Element).
+        NodeRange<PreOrderIterator> PreOrder() {
+          return NodeRange<PreOrderIterator>(this);
+        }
+
+        /// @brief Get all nodes of the subtree rooted at this Element, in
+        /// post-order (including this Element).
+        NodeRange<PostOrderIterator> PostOrder() {
+          return NodeRange<PostOrderIterator>(this);
+        }
+
+        /// @brief Walk the subtree rooted at this Element with a visitor.
+        ///
+        /// The subtree is traversed in a single linear sweep, without recursion
+        /// or memory allocations. The visitor may modify attributes and text,
+        /// but must not change the structure of the tree.
+        /// @param visitor The visitor (see Visitor for the interface).
+        template <class V>
+        void Walk(V& visitor) {
+          Node* node = this;
+          while (node) {
+            if (node->type_ == kElement) {
+              Element* element = static_cast<Element*>(node);
+              element->InvalidateHash();  // The visitor may change it.
+              bool descend = visitor.EnterElement(*element);
+              for (auto i = element->attributes_.begin();
+                   i != element->attributes_.end(); ++i)
+                visitor.VisitAttribute(*element, *i);
+              if (descend && element->first_child_) {
+                node = element->first_child_;
+                continue;
+              }
+              visitor.LeaveElement(*element);
+            } else if (node->type_ == kText) {
+              visitor.VisitText(*static_cast<TextNode*>(node));
+            } else {
+              visitor.VisitOther(*node);
+            }
+
+            // Advance to the next sibling, leaving the Elements that have been
+            // completed on the way up.
+            while (node != this && !node->next_sibling_) {
+              node = node->parent_;
+              visitor.LeaveElement(*static_cast<Element*>(node));
+            }
+            node = (node == this) ? nullptr : node->next_sibling_;
+          }
+        }
+
+        /// @brief Find an attribute of this Element.
+        /// @param name The attribute name.
+        /// @returns The first attribute with the given name, or nullptr if
+        /// there is no such attribute.
+        const Attribute* FindAttribute(const char* name) const {
+          for (auto i = attributes_.begin(); i != attributes_.end(); ++i) {
+            if (i->name().compare(name) == 0)
+              return &(*i);
+          }
+          return nullptr;
+        }
+
+        /// @brief Find an attribute of this Element.
+        /// @param name The attribute name.
+        /// @returns The first attribute with the given name, or nullptr if
+        /// there is no such attribute.
+        const Attribute* FindAttribute(const std::string& name) const {
+          return FindAttribute(name.c_str());
+        }
+
         /// @brief Add an attribute to this Element.
+        ///
+        /// Names that are not standard names are interned until the name
+        /// table is full, and are never freed (see internal::NameTable).
+        /// After that, new names are copied into each attribute instead.
+        /// Names such as "data-row-123" should therefore be avoided where
+        /// possible: they use up the table, and are slower to match.
         /// @param name The attribute name.
         /// @param value The attribute value (unescaped).
         void AddAttribute(const char* name, const char* value) {
-          attributes_.push_back(Attribute(name, value));
+          InvalidateHash();
+          attributes_.push_back(Attribute(name, value, ascii_only_));
         }
 
         /// @brief Add an attribute to this Element.
         /// @param name The attribute name.
         /// @param value The attribute value (unescaped).
         void AddAttribute(const std::string& name, const std::string& value) {
-          attributes_.push_back(Attribute(name, value));
+          InvalidateHash();
+          attributes_.push_back(Attribute(name, value, ascii_only_));
+        }
+
+        /// @brief Add an attribute with a UTF-16 value to this Element.
+        /// @param name The attribute name.
+        /// @param value The attribute value (unescaped).
+        /// @param len The length of the value, in code units.
+        void AddAttribute(const std::string& name, const char16_t* value,
+                          size_t len) {
+          InvalidateHash();
+          attributes_.push_back(Attribute(name, value, len, ascii_only_));
+        }
+
+        /// @brief Add an attribute with a UTF-32 value to this Element.
+        /// @param name The attribute name.
+        /// @param value The attribute value (unescaped).
+        /// @param len The length of the value, in code units.
+        void AddAttribute(const std::string& name, const char32_t* value,
+                          size_t len) {
+          InvalidateHash();
+          attributes_.push_back(Attribute(name, value, len, ascii_only_));
+        }
+
+#if defined(HTMLGEN_HAVE_STRING_VIEW)
+        void AddAttribute(const std::string& name, std::u16string_view value) {
+          AddAttribute(name, value.data(), value.size());
+        }
+
+        void AddAttribute(const std::string& name, std::u32string_view value) {
+          AddAttribute(name, value.data(), value.size());
         }
+#endif
 
         /// @brief Add a child to this Element.
+        ///
+        /// As with AddAttribute(), names that are not standard names are
+        /// interned until the name table is full, and copied into each
+        /// Element after that.
         /// @param name The name of the new child element.
         /// @returns The newly created Element.
         Element* AddChild(const char* name) {
-          children_.push_back(new Element(name));
-          return reinterpret_cast<Element*>(children_.back());
+          Element* child = InsertChildBefore(new Element(name), nullptr);
+          child->ascii_only_ = ascii_only_;
+          return child;
         }
 
         /// @brief Add a child to this Element.
         /// @param name The name of the new child element.
         /// @returns The newly created Element.
         Element* AddChild(const std::string& name) {
-          children_.push_back(new Element(name));
-          return reinterpret_cast<Element*>(children_.back());
+          Element* child = InsertChildBefore(new Element(name), nullptr);
+          child->ascii_only_ = ascii_only_;
+          return child;
         }
 
         /// @brief Add a text node child to this element.
+        ///
+        /// The text of raw text elements, such as "script" and "style", is not
+        /// escaped (see TextNode::AppendRawText()).
         /// @param value The text for the new text node (unescaped).
-        void AddTextChild(const char* value) {
-          children_.push_back(new TextNode(value));
+        /// @returns The newly created TextNode.
+        TextNode* AddTextChild(const char* value) {
+          if (IsRawTextElement())
+            return AddTextChild(std::string(value));
+          return InsertChildBefore(new TextNode(value, ascii_only_), nullptr);
         }
 
         /// @brief Add a text node child to this element.
+        ///
+        /// The text of raw text elements, such as "script" and "style", is not
+        /// escaped (see TextNode::AppendRawText()).
         /// @param value The text for the new text node (unescaped).
-        void AddTextChild(const std::string& value) {
-          children_.push_back(new TextNode(value));
+        /// @returns The newly created TextNode.
+        TextNode* AddTextChild(const std::string& value) {
+          if (IsRawTextElement())
+            return InsertChildBefore(
+                new TextNode(TextNode::RawText(), value, name_.get(),
+                             ascii_only_),
+                nullptr);
+          return InsertChildBefore(new TextNode(value, ascii_only_), nullptr);
+        }
+
+        /// @brief Add a text node child with UTF-16 text to this element.
+        ///
+        /// The text is transcoded to UTF-8 and escaped in one pass (the text
+        /// of raw text elements is transcoded first, and then written as in
+        /// TextNode::AppendRawText()).
+        /// @param value The text for the new text node (unescaped).
+        /// @param len The length of the text, in code units.
+        /// @returns The newly created TextNode.
+        TextNode* AddTextChild(const char16_t* value, size_t len) {
+          return AddTranscodedTextChild(value, len);
+        }
+
+        /// @brief Add a text node child with UTF-32 text to this element.
+        /// @see AddTextChild(const char16_t*, size_t)
+        TextNode* AddTextChild(const char32_t* value, size_t len) {
+          return AddTranscodedTextChild(value, len);
+        }
+
+#if defined(HTMLGEN_HAVE_STRING_VIEW)
+        TextNode* AddTextChild(std::u16string_view value) {
+          return AddTranscodedTextChild(value.data(), value.size());
+        }
+
+        TextNode* AddTextChild(std::u32string_view value) {
+          return AddTranscodedTextChild(value.data(), value.size());
+        }
+#endif
+
+        /// @brief Add a pre-rendered HTML child to this element.
+        /// @param html The HTML, which is written as is (see RawNode).
+        /// @returns The newly created RawNode.
+        RawNode* AddRawChild(std::string html) {
+          return InsertChildBefore(new RawNode(std::move(html)), nullptr);
+        }
+
+        /// @brief Insert a node as a child of this Element.
+        ///
+        /// A TextNode is rewritten for this Element if it was created for a
+        /// raw text element and this is not one, or the other way around.
+        /// @param child The node to insert. It must not already be part of a
+        /// node tree. The Element takes ownership of the node.
+        /// @param before The child of this Element that the new node will be
+        /// inserted in front of, or nullptr to insert the node last.
+        /// @returns The inserted node.
+        template <class T>
+        T* InsertChildBefore(T* child, Node* before) {
+          Link(child, before);
+          return child;
+        }
+
+        /// @brief Remove and delete a child of this Element.
+        /// @param child The child node to remove.
+        void RemoveChild(Node* child) {
+          Unlink(child);
+          delete child;
+        }
+
+        /// @brief Move a node so that it becomes a child of this Element.
+        ///
+        /// The node may be a child of this Element (i.e. the children are
+        /// reordered) or of any other Element, as long as it is not an ancestor
+        /// of this Element. A TextNode is rewritten for this Element, as in
+        /// InsertChildBefore() (e.g. the text of a "script" element is escaped
+        /// when it is moved to a "div").
+        /// @param child The node to move.
+        /// @param before The child of this Element that the node will be moved
+        /// in front of, or nullptr to move the node last.
+        void MoveChild(Node* child, Node* before) {
+          if (child == before)
+            return;
+          Unlink(child);
+          Link(child, before);
+        }
+
+        /// @brief Replace a child of this Element with another node.
+        /// @param new_child The node to insert. It must not already be part of
+        /// a node tree. The Element takes ownership of the node.
+        /// @param old_child The child node to replace. It will be deleted.
+        /// @returns The inserted node.
+        template <class T>
+        T* ReplaceChild(T* new_child, Node* old_child) {
+          Link(new_child, old_child);
+          RemoveChild(old_child);
+          return new_child;
         }
 
-      private:
         /// @brief Determine if this is a void element.
         ///
         /// The <a href="http://www.w3.org/TR/html5/syntax.html#void-elements">
@@ -264,49 +2560,182 @@ class Document {
         /// "img" is treated as a void element, while an element with the name
         /// "IMG" is not.
         bool IsVoidElement() const {
-          static const char* const kVoidNames[] = {
-              "area", "base", "br", "col", "embed", "hr", "img", "input",
-              "keygen", "link", "meta", "param", "source", "track", "wbr"};
-          static const int kNumVoidNames =
-              sizeof(kVoidNames) / sizeof(kVoidNames[0]);
-
-          // Do a binary search.
-          int imin = 0, imax = kNumVoidNames - 1;
-          while (imax >= imin) {
-            int imid = (imin + imax) / 2;
-            int diff = std::strcmp(kVoidNames[imid], name_.data());
-            if (diff == 0)
-              return true;
-            else if (diff < 0)
-              imin = imid + 1;
-            else
-              imax = imid - 1;
-          }
+          return (name_flags_ & internal::StandardNames::kVoid) != 0;
+        }
 
-          return false;
+        /// @brief Determine if this is a raw text element ("script" or
+        /// "style").
+        ///
+        /// The content of raw text elements is not parsed as HTML, so it can
+        /// not contain character references or end tags.
+        bool IsRawTextElement() const {
+          return (name_flags_ & internal::StandardNames::kRawText) != 0;
+        }
+
+        /// @brief Determine if this is an escapable raw text element
+        /// ("textarea" or "title").
+        ///
+        /// The content of escapable raw text elements can contain character
+        /// references, but not elements.
+        bool IsEscapableRawTextElement() const {
+          return (name_flags_ & internal::StandardNames::kEscapableRawText) !=
+                 0;
+        }
+
+        /// @brief Determine if an element name is the name of a void element.
+        /// @param name The element name.
+        /// @returns true if this is the name of a void element.
+        static bool IsVoidElement(const char* name) {
+          int id = internal::StandardNames::Find(name, std::strlen(name));
+          return id >= 0 && (internal::StandardNames::Flags(id) &
+                             internal::StandardNames::kVoid) != 0;
+        }
+
+      private:
+        friend class TextNode;
+
+        /// @brief Get the StandardNames flags of an interned element name.
+        /// @param name The interned name, or nullptr.
+        static unsigned NameFlags(const std::string* name) {
+          int id = internal::NameTable::StandardId(name);
+          return id >= 0 ? internal::StandardNames::Flags(id) : 0;
+        }
+
+        /// @brief Add a text node child with UTF-16 or UTF-32 text.
+        template <class Char>
+        TextNode* AddTranscodedTextChild(const Char* value, size_t len) {
+          if (IsRawTextElement())
+            return InsertChildBefore(
+                new TextNode(TextNode::RawText(), internal::ToUtf8(value, len),
+                             name_.get(), ascii_only_),
+                nullptr);
+          return InsertChildBefore(new TextNode(value, len, ascii_only_),
+                                   nullptr);
+        }
+
+        /// @brief Forget the kept hashes (see Hash()) of this Element and its
+        /// ancestors.
+        void InvalidateHash() {
+          // An Element only keeps its hash while all of its children keep
+          // theirs, so the walk can stop at the first Element without one.
+          for (Element* e = this;
+               e && e->hash_valid_.load(std::memory_order_relaxed);
+               e = e->parent_)
+            e->hash_valid_.store(false, std::memory_order_relaxed);
+        }
+
+        static void HashString(internal::SipHash& h, const std::string& s) {
+          h.Update(s.size());
+          h.Update(s.data(), s.size());
         }
 
-        const std::string name_;
+        /// @brief Link a detached node into the child list of this Element.
+        void Link(Node* child, Node* before) {
+          InvalidateHash();
+          if (child->type_ == kText)
+            static_cast<TextNode*>(child)->Reparent(
+                IsRawTextElement() ? name_.interned() : nullptr);
+          Node* prev = before ? before->prev_sibling_ : last_child_;
+          child->parent_ = this;
+          child->prev_sibling_ = prev;
+          child->next_sibling_ = before;
+          if (prev)
+            prev->next_sibling_ = child;
+          else
+            first_child_ = child;
+          if (before)
+            before->prev_sibling_ = child;
+          else
+            last_child_ = child;
+        }
+
+        /// @brief Unlink a node from the child list of its parent Element.
+        static void Unlink(Node* child) {
+          Element* parent = child->parent_;
+          if (!parent)
+            return;
+          parent->InvalidateHash();
+          if (child->prev_sibling_)
+            child->prev_sibling_->next_sibling_ = child->next_sibling_;
+          else
+            parent->first_child_ = child->next_sibling_;
+          if (child->next_sibling_)
+            child->next_sibling_->prev_sibling_ = child->prev_sibling_;
+          else
+            parent->last_child_ = child->prev_sibling_;
+          child->parent_ = nullptr;
+          child->prev_sibling_ = nullptr;
+          child->next_sibling_ = nullptr;
+        }
+
+        enum CacheMode {
+          kNoCache,
+          kCacheByHash,
+          kCacheByKey
+        };
+
+        const internal::Name name_;
+        const unsigned name_flags_;  // StandardNames flags of the name.
         std::vector<Attribute> attributes_;
-        std::vector<Node*> children_;
+        Node* first_child_;
+        Node* last_child_;
+        CacheMode cache_mode_;
+        uint64_t cache_key_;
+        mutable std::atomic<bool> hash_valid_;  // See Hash().
+        mutable std::atomic<uint64_t> hash_;
+        mutable std::atomic<uint64_t> hash_check_;
+        bool ascii_only_;
     };
 
-    Document() : root_(Element("html")) {}
+    Document() : root_("html") {}
 
     /// @brief Get the root element of this document.
     Element* root() {
       return &root_;
     }
 
+    /// @brief Get the root element of this document.
+    const Element* root() const {
+      return &root_;
+    }
+
     /// @brief Get an HTML formatted string representing this document.
     /// @param[out] out The output string that will receive the HTML.
     void GetHTML(std::string& out) const {
+      Writer writer(out);
+      Write(writer);
+    }
+
+    /// @brief Write the HTML representation of this document.
+    ///
+    /// Unlike GetHTML(), this makes it possible to control the serialization
+    /// through the Writer (e.g. to apply attribute rewrites, or to stream the
+    /// HTML to a Sink). The Writer is flushed at the end.
+    /// @param writer The Writer that receives the HTML.
+    void Write(Writer& writer) const {
+      std::string& out = writer.out();
       out.append("<!DOCTYPE html>\n");
-      root_.GetHTML(out);
+      root_.Write(writer);
       out += '\n';
+      writer.Flush();
     }
 
   private:
+    static const uint64_t kHashSeed = 14695981039346656037ULL;
+
+    /// @brief Update a 64-bit FNV-1a hash with a number of bytes.
+    static uint64_t HashBytes(uint64_t h, const void* data, size_t len) {
+      const unsigned char* p = static_cast<const unsigned char*>(data);
+      for (size_t i = 0; i < len; ++i)
+        h = (h ^ p[i]) * 1099511628211ULL;
+      return h;
+    }
+
+    /// @brief Combine two hashes.
+    static uint64_t HashCombine(uint64_t a, uint64_t b) {
+      return HashBytes(a, &b, sizeof(b));
+    }
+
     Element root_;
 };
 
@@ -0,0 +1,212 @@
+// -*- mode: c++; tab-width: 2; indent-tabs-mode: nil; -*-
+//----------------------------------------------------------------------------
+// A Sink that streams HTML to a file descriptor.
+//----------------------------------------------------------------------------
+// This is free and unencumbered software released into the public domain.
+//
+// Anyone is free to copy, modify, publish, use, compile, sell, or
+// distribute this software, either in source code form or as a compiled
+// binary, for any purpose, commercial or non-commercial, and by any
+// means.
+//
+// In jurisdictions that recognize copyright laws, the author or authors
+// of this software dedicate any and all copyright interest in the
+// software to the public domain. We make this dedication for the benefit
+// of the public at large and to the detriment of our heirs and
+// successors. We intend this dedication to be an overt act of
+// relinquishment in perpetuity of all present and future rights to this
+// software under copyright law.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+// OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+// ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+//
+// For more information, please refer to <http://unlicense.org/>
+//----------------------------------------------------------------------------
+
+#ifndef FD_SINK_H_
+#define FD_SINK_H_
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#endif
+
+#include <cstdint>
+
+#include "document.h"
+
+namespace htmlgen {
+
+/// @brief A Sink that writes to a file descriptor (e.g. a socket or a pipe).
+///
+/// File regions (e.g. from FileNodes) are transferred in the kernel with
+/// sendfile, or with splice when the descriptor is a pipe that sendfile can
+/// not write to, and otherwise by reading and writing through a buffer.
+/// Non-blocking descriptors are waited on with poll, for at most the timeout
+/// that is given to the constructor, after which the write fails with
+/// ETIMEDOUT (e.g. for a client that stops reading).
+///
+/// Errors are sticky: after a failed write, further output is dropped and
+/// ok() returns false.
+///
+/// @code{.cpp}
+///   htmlgen::FdSink sink(client_socket);
+///   std::string buffer;
+///   htmlgen::Document::Writer writer(buffer);
+///   writer.SetSink(&sink);
+///   doc.Write(writer);
+///   if (!sink.ok())
+///     perror("write");
+/// @endcode
+class FdSink : public Document::Sink {
+  public:
+    /// @param fd The file descriptor. It is not closed by the FdSink.
+    /// @param timeout_ms The longest time to wait for a non-blocking
+    /// descriptor to become writable, in milliseconds (-1 for no limit).
+    explicit FdSink(int fd, int timeout_ms = -1) :
+        fd_(fd), timeout_ms_(timeout_ms), error_(0), bytes_written_(0) {}
+
+    virtual void Write(const char* data, size_t len) {
+      while (len > 0 && error_ == 0) {
+        ssize_t n = ::write(fd_, data, len);
+        if (n > 0) {
+          data += n;
+          len -= static_cast<size_t>(n);
+          bytes_written_ += static_cast<uint64_t>(n);
+        } else if (!Retry(n)) {
+          return;
+        }
+      }
+    }
+
+    virtual bool WriteFile(int fd, uint64_t offset, size_t len) {
+      if (error_ != 0)
+        return true;  // The output is dropped.
+#if defined(__linux__)
+      if (SendFile(fd, offset, len))
+        return true;
+#endif
+      CopyFile(fd, offset, len);
+      return true;
+    }
+
+    /// @brief Check if all output has been written.
+    bool ok() const {
+      return error_ == 0;
+    }
+
+    /// @brief Get the error number of the failed write (ETIMEDOUT if the
+    /// descriptor did not become writable in time), or 0.
+    virtual int error() const {
+      return error_;
+    }
+
+    /// @brief Get the number of bytes written.
+    uint64_t bytes_written() const {
+      return bytes_written_;
+    }
+
+  private:
+    static const size_t kBufferSize = 64 * 1024;
+
+    /// @brief Handle a failed or empty write.
+    /// @returns true if the write should be retried.
+    bool Retry(ssize_t result) {
+      if (result < 0 && errno == EINTR)
+        return true;
+      if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        struct pollfd pfd;
+        pfd.fd = fd_;
+        pfd.events = POLLOUT;
+        pfd.revents = 0;
+        int ready = ::poll(&pfd, 1, timeout_ms_);
+        if (ready > 0 || (ready < 0 && errno == EINTR))
+          return true;
+        if (ready == 0) {
+          error_ = ETIMEDOUT;
+          return false;
+        }
+      }
+      error_ = result < 0 ? errno : EIO;
+      return false;
+    }
+
+#if defined(__linux__)
+    /// @brief Transfer a file region in the kernel.
+    /// @returns false if nothing was transferred because neither sendfile nor
+    /// splice supports the descriptors.
+    bool SendFile(int fd, uint64_t offset, size_t len) {
+      off_t off = static_cast<off_t>(offset);
+      bool use_splice = false;
+      bool started = false;
+      while (len > 0 && error_ == 0) {
+        ssize_t n;
+        if (use_splice) {
+          n = ::splice(fd, &off, fd_, nullptr, len, SPLICE_F_MORE);
+        } else {
+          n = ::sendfile(fd_, fd, &off, len);
+        }
+        if (n > 0) {
+          started = true;
+          len -= static_cast<size_t>(n);
+          bytes_written_ += static_cast<uint64_t>(n);
+          continue;
+        }
+        if (n < 0 && !started && (errno == EINVAL || errno == ENOSYS)) {
+          if (use_splice || !IsPipe())
+            return false;
+          use_splice = true;
+          continue;
+        }
+        if (n == 0) {
+          // The file is shorter than expected.
+          error_ = EIO;
+          break;
+        }
+        Retry(n);
+      }
+      return true;
+    }
+
+    bool IsPipe() const {
+      struct stat st;
+      return ::fstat(fd_, &st) == 0 && S_ISFIFO(st.st_mode);
+    }
+#endif
+
+    /// @brief Copy a file region through a buffer.
+    void CopyFile(int fd, uint64_t offset, size_t len) {
+      char buffer[kBufferSize];
+      while (len > 0 && error_ == 0) {
+        size_t chunk = len < kBufferSize ? len : kBufferSize;
+        ssize_t n = ::pread(fd, buffer, chunk, static_cast<off_t>(offset));
+        if (n < 0 && errno == EINTR)
+          continue;
+        if (n <= 0) {
+          error_ = n < 0 ? errno : EIO;
+          return;
+        }
+        Write(buffer, static_cast<size_t>(n));
+        offset += static_cast<uint64_t>(n);
+        len -= static_cast<size_t>(n);
+      }
+    }
+
+    const int fd_;
+    const int timeout_ms_;
+    int error_;
+    uint64_t bytes_written_;
+};
+
+} // namespace htmlgen
+
+#endif // FD_SINK_H_
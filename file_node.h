@@ -0,0 +1,352 @@
+// -*- mode: c++; tab-width: 2; indent-tabs-mode: nil; -*-
+//----------------------------------------------------------------------------
+// Nodes with content from memory mapped files.
+//----------------------------------------------------------------------------
+// This is free and unencumbered software released into the public domain.
+//
+// Anyone is free to copy, modify, publish, use, compile, sell, or
+// distribute this software, either in source code form or as a compiled
+// binary, for any purpose, commercial or non-commercial, and by any
+// means.
+//
+// In jurisdictions that recognize copyright laws, the author or authors
+// of this software dedicate any and all copyright interest in the
+// software to the public domain. We make this dedication for the benefit
+// of the public at large and to the detriment of our heirs and
+// successors. We intend this dedication to be an overt act of
+// relinquishment in perpetuity of all present and future rights to this
+// software under copyright law.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+// OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+// ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+//
+// For more information, please refer to <http://unlicense.org/>
+//----------------------------------------------------------------------------
+
+#ifndef FILE_NODE_H_
+#define FILE_NODE_H_
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "document.h"
+
+namespace htmlgen {
+
+/// @brief A read-only memory mapping of a file.
+///
+/// When a file is opened, it is scanned once for characters that need
+/// escaping in text, and for non-ASCII characters. The result is cached for
+/// the process, keyed by the device, inode, modification time and size of
+/// the file, so opening the same unchanged file again does not scan it
+/// again.
+///
+/// The file descriptor is kept open, so that the file can also be sent
+/// directly to a socket or a pipe (e.g. with sendfile).
+///
+/// @note The file must not be modified in place while it is mapped (replace
+/// it with a rename instead), since the content would then no longer match
+/// the scan.
+class MappedFile {
+  public:
+    /// @brief Map a file.
+    /// @param path The file name.
+    /// @returns The mapped file, or nullptr if the file could not be mapped.
+    static std::shared_ptr<const MappedFile> Open(const char* path) {
+      int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+      if (fd < 0)
+        return nullptr;
+      struct stat st;
+      if (::fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        ::close(fd);
+        return nullptr;
+      }
+      std::shared_ptr<MappedFile> file(new MappedFile(fd));
+      file->size_ = static_cast<size_t>(st.st_size);
+      if (file->size_ > 0) {
+        void* data = ::mmap(nullptr, file->size_, PROT_READ, MAP_PRIVATE, fd,
+                            0);
+        if (data == MAP_FAILED)
+          return nullptr;
+        file->data_ = static_cast<const char*>(data);
+      }
+      ScanCache::Offsets offsets = ScanCache::Get().Lookup(st, *file);
+      file->text_escape_ = offsets.text;
+      file->ascii_escape_ = offsets.ascii;
+      AppendId(st, file->id_);
+      return file;
+    }
+
+    ~MappedFile() {
+      if (data_)
+        ::munmap(const_cast<char*>(data_), size_);
+      ::close(fd_);
+    }
+
+    /// @brief Get the file content.
+    const char* data() const {
+      return data_;
+    }
+
+    /// @brief Get the file size.
+    size_t size() const {
+      return size_;
+    }
+
+    /// @brief Get the file descriptor.
+    int fd() const {
+      return fd_;
+    }
+
+    /// @brief Get a key that identifies the file and its version: the
+    /// device, inode, modification time and size of the file when it was
+    /// opened.
+    const std::string& id() const {
+      return id_;
+    }
+
+    /// @brief Get the offset of the first character that needs escaping in
+    /// text, or size() if there is none.
+    size_t text_escape_offset() const {
+      return text_escape_;
+    }
+
+    /// @brief Get the offset of the first character that needs escaping in
+    /// text, or that is not ASCII, or size() if there is none.
+    size_t ascii_escape_offset() const {
+      return ascii_escape_;
+    }
+
+  private:
+    /// @brief The cached scan results of the files that have been opened.
+    class ScanCache {
+      public:
+        static ScanCache& Get() {
+          static ScanCache cache;
+          return cache;
+        }
+
+        struct Offsets {
+          size_t text;   // See text_escape_offset().
+          size_t ascii;  // See ascii_escape_offset().
+        };
+
+        Offsets Lookup(const struct stat& st, const MappedFile& file) {
+          Key key;
+          key.dev = st.st_dev;
+          key.ino = st.st_ino;
+          key.mtime_sec = st.st_mtim.tv_sec;
+          key.mtime_nsec = st.st_mtim.tv_nsec;
+          key.size = st.st_size;
+          {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto i = offsets_.find(key);
+            if (i != offsets_.end())
+              return i->second;
+          }
+
+          // The first character that needs escaping is not before the first
+          // one that needs escaping or is not ASCII.
+          Offsets offsets = {0, 0};
+          if (file.size_ > 0) {
+            const char* end = file.data_ + file.size_;
+            const char* p =
+                Document::TextNode::FindEscapeAscii(file.data_, end);
+            offsets.ascii = p - file.data_;
+            offsets.text = Document::TextNode::FindEscape(p, end) - file.data_;
+          }
+
+          std::lock_guard<std::mutex> lock(mutex_);
+          if (offsets_.size() >= kMaxEntries)
+            offsets_.clear();
+          offsets_[key] = offsets;
+          return offsets;
+        }
+
+      private:
+        static const size_t kMaxEntries = 4096;
+
+        struct Key {
+          dev_t dev;
+          ino_t ino;
+          time_t mtime_sec;
+          long mtime_nsec;
+          off_t size;
+
+          bool operator<(const Key& other) const {
+            if (ino != other.ino)
+              return ino < other.ino;
+            if (dev != other.dev)
+              return dev < other.dev;
+            if (mtime_sec != other.mtime_sec)
+              return mtime_sec < other.mtime_sec;
+            if (mtime_nsec != other.mtime_nsec)
+              return mtime_nsec < other.mtime_nsec;
+            return size < other.size;
+          }
+        };
+
+        std::mutex mutex_;
+        std::map<Key, Offsets> offsets_;
+    };
+
+    static void AppendId(const struct stat& st, std::string& id) {
+      const uint64_t fields[] = {
+          static_cast<uint64_t>(st.st_dev), static_cast<uint64_t>(st.st_ino),
+          static_cast<uint64_t>(st.st_mtim.tv_sec),
+          static_cast<uint64_t>(st.st_mtim.tv_nsec),
+          static_cast<uint64_t>(st.st_size)};
+      id.append(reinterpret_cast<const char*>(fields), sizeof(fields));
+    }
+
+    explicit MappedFile(int fd) : fd_(fd), data_(nullptr), size_(0),
+        text_escape_(0), ascii_escape_(0) {}
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    int fd_;
+    const char* data_;
+    size_t size_;
+    size_t text_escape_;
+    size_t ascii_escape_;
+    std::string id_;
+};
+
+/// @brief A node with content from a mapped file.
+///
+/// The content is written either as text (escaped) or as raw HTML. Text that
+/// needs no escaping, according to the scan made when the file was opened,
+/// is written with a single copy, and otherwise only the part after the
+/// first character that needs escaping goes through the escaper. The file is
+/// never copied into the node, and if the Writer streams to a Sink that can
+/// transfer files directly (see FdSink), verbatim content is not copied at
+/// all. For fragment caching, the node is hashed by the identity of the file
+/// (see MappedFile::id()), so hashing does not read the content either.
+///
+/// In a raw text element ("script" or "style"), the content is written as
+/// raw text in either mode, with end tags for the element broken up (see
+/// Document::TextNode::AppendRawText()). Content without '<' is still
+/// written verbatim.
+///
+/// If the parent is ASCII-only (see Document::Element::SetAsciiOnly()), text
+/// is escaped as by Document::TextNode::AppendEscapedAscii(), and is only
+/// written verbatim if it is all ASCII. Raw HTML is still written as is.
+///
+/// @code{.cpp}
+///   auto css = htmlgen::MappedFile::Open("static/site.css");
+///   if (css) {
+///     head->AddChild("style")->InsertChildBefore(
+///         new htmlgen::FileNode(css, htmlgen::FileNode::kRaw), nullptr);
+///   }
+/// @endcode
+class FileNode : public Document::Node {
+  public:
+    /// @brief How the file content is written.
+    enum Mode {
+      kText,  ///< The content is text, and is escaped.
+      kRaw    ///< The content is HTML, and is written as is.
+    };
+
+    FileNode(std::shared_ptr<const MappedFile> file, Mode mode) :
+        file_(std::move(file)), mode_(mode) {}
+
+    virtual void Write(Document::Writer& writer) const {
+      std::string& out = writer.out();
+      if (IsVerbatim()) {
+        if (!writer.WriteFile(file_->fd(), 0, file_->size()))
+          out.append(file_->data(), file_->size());
+        return;
+      }
+      const Document::Element* parent = this->parent();
+      bool ascii_only = parent && parent->ascii_only();
+      if (parent && parent->IsRawTextElement()) {
+        const std::string& name = parent->name();
+        Document::TextNode::AppendRawText(file_->data(), file_->size(),
+                                          name.data(), name.size(), out,
+                                          ascii_only);
+        return;
+      }
+      size_t offset = EscapeOffset(ascii_only);
+      out.append(file_->data(), offset);
+      if (ascii_only)
+        Document::TextNode::AppendEscapedAscii(file_->data() + offset,
+                                               file_->size() - offset, out);
+      else
+        Document::TextNode::AppendEscaped(file_->data() + offset,
+                                          file_->size() - offset, out);
+    }
+
+    /// @brief Hash the node by the identity of the file and the state that
+    /// its HTML depends on, rather than by the file content.
+    virtual bool GetHashKey(std::string& key) const {
+      const Document::Element* parent = this->parent();
+      key.append(file_->id());
+      key += static_cast<char>(mode_);
+      key += parent && parent->IsRawTextElement() ? 'r' : '-';
+      key += parent && parent->ascii_only() ? 'a' : '-';
+      return true;
+    }
+
+    /// @brief Get the mapped file.
+    const MappedFile& file() const {
+      return *file_;
+    }
+
+    /// @brief Get the mode.
+    Mode mode() const {
+      return mode_;
+    }
+
+    /// @brief Check if the file content is written as is in the current
+    /// parent: raw HTML, or content that needs no escaping (no non-ASCII
+    /// characters either, if the parent is ASCII-only). In a raw text
+    /// element, raw HTML is not written as is unless it needs no escaping.
+    bool IsVerbatim() const {
+      const Document::Element* parent = this->parent();
+      bool ascii_only = parent && parent->ascii_only();
+      if (EscapeOffset(ascii_only) == file_->size())
+        return true;
+      return mode_ == kRaw && !(parent && parent->IsRawTextElement());
+    }
+
+  private:
+    size_t EscapeOffset(bool ascii_only) const {
+      return ascii_only ? file_->ascii_escape_offset()
+                        : file_->text_escape_offset();
+    }
+
+    std::shared_ptr<const MappedFile> file_;
+    const Mode mode_;
+};
+
+/// @brief Map a file and add it as a FileNode child of an Element.
+/// @param parent The Element that the node is added to.
+/// @param path The file name.
+/// @param mode How the file content is written.
+/// @returns The newly created FileNode, or nullptr if the file could not be
+/// mapped.
+inline FileNode* AddFileChild(Document::Element* parent, const char* path,
+                              FileNode::Mode mode) {
+  std::shared_ptr<const MappedFile> file = MappedFile::Open(path);
+  if (!file)
+    return nullptr;
+  return parent->InsertChildBefore(new FileNode(std::move(file), mode),
+                                   nullptr);
+}
+
+} // namespace htmlgen
+
+#endif // FILE_NODE_H_
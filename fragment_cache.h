@@ -0,0 +1,442 @@
+// -*- mode: c++; tab-width: 2; indent-tabs-mode: nil; -*-
+//----------------------------------------------------------------------------
+// An in-memory cache of rendered htmlgen fragments.
+//----------------------------------------------------------------------------
+// This is free and unencumbered software released into the public domain.
+//
+// Anyone is free to copy, modify, publish, use, compile, sell, or
+// distribute this software, either in source code form or as a compiled
+// binary, for any purpose, commercial or non-commercial, and by any
+// means.
+//
+// In jurisdictions that recognize copyright laws, the author or authors
+// of this software dedicate any and all copyright interest in the
+// software to the public domain. We make this dedication for the benefit
+// of the public at large and to the detriment of our heirs and
+// successors. We intend this dedication to be an overt act of
+// relinquishment in perpetuity of all present and future rights to this
+// software under copyright law.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+// OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+// ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+//
+// For more information, please refer to <http://unlicense.org/>
+//----------------------------------------------------------------------------
+
+#ifndef FRAGMENT_CACHE_H_
+#define FRAGMENT_CACHE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "document.h"
+
+namespace htmlgen {
+
+/// @brief A thread safe, in-memory fragment cache with a memory budget.
+///
+/// The cache is split into shards (selected by the key), each with its own
+/// hash table, writer lock and share of the memory budget. Lookups never take
+/// a lock: the hash chains are read with atomic loads, and entries that are
+/// evicted while readers may still see them are retired, and freed once all
+/// readers that started before the eviction have finished (epoch based
+/// reclamation). Each reader announces itself in its own slot, so lookups do
+/// not write to shared cache lines, and memory is reclaimed under a steady
+/// stream of lookups. A hit copies the cached HTML to the output with a
+/// single append.
+///
+/// Eviction uses the CLOCK algorithm, an approximation of LRU that only needs
+/// a relaxed store of a "referenced" flag on the read path.
+///
+/// @code{.cpp}
+///   static htmlgen::MemoryFragmentCache cache(32 << 20);
+///   product_card->EnableCaching(product_id);
+///
+///   htmlgen::Document::Writer writer(html_string);
+///   writer.SetFragmentCache(&cache);
+///   doc.Write(writer);
+/// @endcode
+class MemoryFragmentCache : public Document::FragmentCache {
+  public:
+    /// @brief Cache statistics.
+    struct Stats {
+      uint64_t hits;
+      uint64_t misses;
+      uint64_t insertions;
+      uint64_t evictions;
+      uint64_t oversized;  ///< Stores rejected for exceeding the entry limit.
+      size_t entries;
+      size_t bytes;  ///< Memory used by entries, including retired entries.
+    };
+
+    /// Each shard gets an equal share of the budget, and a single entry may
+    /// use at most half of its shard's share, i.e. budget / (2 * num_shards)
+    /// bytes (including about 100 bytes of overhead). Larger fragments are
+    /// never cached; they are counted in Stats::oversized. Use fewer shards
+    /// or a larger budget to cache large fragments.
+    /// @param budget The maximum number of bytes used by cached entries.
+    /// @param num_shards The number of shards (rounded up to a power of two).
+    /// @param buckets_per_shard The number of hash buckets in each shard
+    /// (rounded up to a power of two).
+    explicit MemoryFragmentCache(size_t budget, size_t num_shards = 16,
+                                 size_t buckets_per_shard = 1024) {
+      size_t shards = RoundUpToPowerOfTwo(num_shards);
+      size_t buckets = RoundUpToPowerOfTwo(buckets_per_shard);
+      shards_.reserve(shards);
+      for (size_t i = 0; i < shards; ++i)
+        shards_.push_back(new Shard(epochs_, budget / shards, buckets));
+      shard_mask_ = shards - 1;
+    }
+
+    virtual ~MemoryFragmentCache() {
+      for (auto i = shards_.begin(); i != shards_.end(); ++i)
+        delete *i;
+    }
+
+    virtual bool Fetch(const Document::FragmentKey& key, std::string& out) {
+      return ShardFor(key.hash).Fetch(key, out);
+    }
+
+    virtual void Store(const Document::FragmentKey& key, const char* html,
+                       size_t len) {
+      ShardFor(key.hash).Store(key, html, len);
+    }
+
+    /// @brief Remove all entries from the cache.
+    void Clear() {
+      for (auto i = shards_.begin(); i != shards_.end(); ++i)
+        (*i)->Clear();
+    }
+
+    /// @brief Get the cache statistics, summed over all shards.
+    Stats GetStats() const {
+      Stats stats = Stats();
+      for (auto i = shards_.begin(); i != shards_.end(); ++i)
+        (*i)->AddStats(stats);
+      return stats;
+    }
+
+  private:
+    struct Entry {
+      Entry(const Document::FragmentKey& k, const char* html, size_t len) :
+          key(k.hash), check(k.check), next(nullptr), referenced(false),
+          clock_prev(nullptr), clock_next(nullptr), data(html, len) {}
+
+      size_t Cost() const {
+        return Cost(data.size());
+      }
+
+      static size_t Cost(size_t len) {
+        return sizeof(Entry) + len;
+      }
+
+      const uint64_t key;
+      const uint64_t check;          // Verified on lookup.
+      std::atomic<Entry*> next;      // Hash chain (read without the lock).
+      std::atomic<bool> referenced;  // Set on hits, cleared by the clock.
+      Entry* clock_prev;             // Clock ring (protected by the lock).
+      Entry* clock_next;
+      const std::string data;
+    };
+
+    /// @brief The state of the epoch based reclamation.
+    ///
+    /// A reader announces the current epoch in a free slot while it reads.
+    /// An entry that is unlinked and then retired in epoch r (which ends the
+    /// epoch) can only be seen by readers that announced an epoch of r or
+    /// earlier, so it can be freed once no slot holds such an epoch.
+    class Epochs {
+      public:
+        static const size_t kNumSlots = 128;
+
+        Epochs() : epoch_(1) {
+          for (size_t i = 0; i < kNumSlots; ++i)
+            slots_[i].epoch.store(kIdle, std::memory_order_relaxed);
+        }
+
+        /// @brief Announce a reader. Must be paired with Leave().
+        /// @returns The slot of the reader.
+        size_t Enter() {
+          // Start at the slot that this thread used last time, so threads
+          // tend to keep to their own slots.
+          static thread_local size_t hint = 0;
+          for (size_t i = hint;; i = (i + 1) & (kNumSlots - 1)) {
+            std::atomic<uint64_t>& slot = slots_[i].epoch;
+            uint64_t idle = kIdle;
+            uint64_t e = epoch_.load();
+            if (slot.load(std::memory_order_relaxed) != kIdle ||
+                !slot.compare_exchange_strong(idle, e))
+              continue;
+
+            // Make sure that the announced epoch is still the current one,
+            // so that a concurrent Retire() sees it.
+            for (uint64_t current; (current = epoch_.load()) != e;) {
+              e = current;
+              slot.store(e);
+            }
+            hint = i;
+            return i;
+          }
+        }
+
+        void Leave(size_t slot) {
+          slots_[slot].epoch.store(kIdle, std::memory_order_release);
+        }
+
+        /// @brief End the current epoch (after unlinking an entry).
+        /// @returns The epoch that the entry was retired in.
+        uint64_t Retire() {
+          return epoch_.fetch_add(1);
+        }
+
+        /// @brief Get the oldest epoch that a reader is active in, or
+        /// UINT64_MAX if there are no readers.
+        uint64_t OldestActive() const {
+          uint64_t oldest = UINT64_MAX;
+          for (size_t i = 0; i < kNumSlots; ++i) {
+            uint64_t e = slots_[i].epoch.load();
+            if (e != kIdle && e < oldest)
+              oldest = e;
+          }
+          return oldest;
+        }
+
+      private:
+        static const uint64_t kIdle = 0;
+
+        struct Slot {
+          std::atomic<uint64_t> epoch;
+          char padding[56];  // One slot per cache line.
+        };
+
+        std::atomic<uint64_t> epoch_;
+        char padding_[56];
+        Slot slots_[kNumSlots];
+    };
+
+    struct Shard {
+      Shard(Epochs& shared_epochs, size_t shard_budget, size_t num_buckets) :
+          epochs(shared_epochs), buckets(num_buckets),
+          bucket_mask(num_buckets - 1), budget(shard_budget), bytes(0),
+          retired_bytes(0), entries(0), clock_hand(nullptr), hits(0),
+          misses(0), insertions(0), evictions(0), oversized(0) {
+        for (auto i = buckets.begin(); i != buckets.end(); ++i)
+          i->store(nullptr, std::memory_order_relaxed);
+      }
+
+      ~Shard() {
+        Clear();
+      }
+
+      bool Fetch(const Document::FragmentKey& key, std::string& out) {
+        bool found = false;
+        size_t slot = epochs.Enter();
+        for (Entry* e = Bucket(key.hash).load(std::memory_order_acquire); e;
+             e = e->next.load(std::memory_order_acquire)) {
+          if (e->key == key.hash && e->check == key.check) {
+            out.append(e->data);
+            if (!e->referenced.load(std::memory_order_relaxed))
+              e->referenced.store(true, std::memory_order_relaxed);
+            found = true;
+            break;
+          }
+        }
+        epochs.Leave(slot);
+        (found ? hits : misses).fetch_add(1, std::memory_order_relaxed);
+        return found;
+      }
+
+      void Store(const Document::FragmentKey& key, const char* html,
+                 size_t len) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (Entry::Cost(len) > budget / 2) {
+          oversized.fetch_add(1, std::memory_order_relaxed);
+          return;
+        }
+        FreeRetired();
+        Entry* entry = new Entry(key, html, len);
+
+        // Replace any existing entry with the same hash.
+        for (Entry* e = Bucket(key.hash).load(std::memory_order_relaxed); e;
+             e = e->next.load(std::memory_order_relaxed)) {
+          if (e->key == key.hash) {
+            Remove(e);
+            break;
+          }
+        }
+
+        // Retired entries that may still be visible to readers count against
+        // the budget, so evict until the live entries leave room for them.
+        // A stalled (e.g. preempted) reader holds back reclamation, so stop
+        // at half of the budget rather than evicting the whole shard.
+        while (bytes + retired_bytes + entry->Cost() > budget && clock_hand &&
+               retired_bytes + entry->Cost() <= budget / 2) {
+          EvictOne();
+          FreeRetired();
+        }
+        if (bytes + retired_bytes + entry->Cost() > budget) {
+          delete entry;
+          return;
+        }
+
+        // Link the entry into the clock ring, just behind the hand.
+        if (clock_hand) {
+          entry->clock_next = clock_hand;
+          entry->clock_prev = clock_hand->clock_prev;
+          entry->clock_prev->clock_next = entry;
+          clock_hand->clock_prev = entry;
+        } else {
+          entry->clock_next = entry->clock_prev = entry;
+          clock_hand = entry;
+        }
+
+        // Publish the entry.
+        std::atomic<Entry*>& bucket = Bucket(key.hash);
+        entry->next.store(bucket.load(std::memory_order_relaxed),
+                          std::memory_order_relaxed);
+        bucket.store(entry, std::memory_order_release);
+        bytes += entry->Cost();
+        ++entries;
+        insertions.fetch_add(1, std::memory_order_relaxed);
+      }
+
+      void Clear() {
+        std::lock_guard<std::mutex> lock(mutex);
+        while (clock_hand)
+          Remove(clock_hand);
+        FreeRetired();
+      }
+
+      void AddStats(Stats& stats) {
+        stats.hits += hits.load(std::memory_order_relaxed);
+        stats.misses += misses.load(std::memory_order_relaxed);
+        stats.insertions += insertions.load(std::memory_order_relaxed);
+        stats.evictions += evictions.load(std::memory_order_relaxed);
+        stats.oversized += oversized.load(std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lock(mutex);
+        stats.entries += entries;
+        stats.bytes += bytes + retired_bytes;
+      }
+
+      std::atomic<Entry*>& Bucket(uint64_t key) {
+        // The low hash bits select the shard, so use the high bits here.
+        return buckets[(Mix(key) >> 32) & bucket_mask];
+      }
+
+      /// @brief Advance the clock hand until an unreferenced entry is found,
+      /// and evict it.
+      void EvictOne() {
+        while (clock_hand->referenced.load(std::memory_order_relaxed)) {
+          clock_hand->referenced.store(false, std::memory_order_relaxed);
+          clock_hand = clock_hand->clock_next;
+        }
+        Remove(clock_hand);
+        evictions.fetch_add(1, std::memory_order_relaxed);
+      }
+
+      /// @brief Unlink an entry and retire it. Must be called with the lock
+      /// held.
+      void Remove(Entry* entry) {
+        // Unlink from the hash chain. Readers that are currently at the entry
+        // can still follow its next pointer, which is left intact.
+        std::atomic<Entry*>* link = &Bucket(entry->key);
+        while (link->load(std::memory_order_relaxed) != entry)
+          link = &link->load(std::memory_order_relaxed)->next;
+        link->store(entry->next.load(std::memory_order_relaxed));
+
+        // Unlink from the clock ring.
+        if (entry->clock_next == entry) {
+          clock_hand = nullptr;
+        } else {
+          entry->clock_prev->clock_next = entry->clock_next;
+          entry->clock_next->clock_prev = entry->clock_prev;
+          if (clock_hand == entry)
+            clock_hand = entry->clock_next;
+        }
+
+        --entries;
+        bytes -= entry->Cost();
+        retired_bytes += entry->Cost();
+        retired.push_back(std::make_pair(epochs.Retire(), entry));
+      }
+
+      /// @brief Free the retired entries that no active reader can see.
+      /// Must be called with the lock held.
+      void FreeRetired() {
+        if (retired.empty())
+          return;
+        uint64_t oldest = epochs.OldestActive();
+        size_t kept = 0;
+        for (size_t i = 0; i < retired.size(); ++i) {
+          if (retired[i].first < oldest) {
+            retired_bytes -= retired[i].second->Cost();
+            delete retired[i].second;
+          } else {
+            retired[kept++] = retired[i];
+          }
+        }
+        retired.resize(kept);
+      }
+
+      Epochs& epochs;
+      std::mutex mutex;
+      std::vector<std::atomic<Entry*> > buckets;
+      const size_t bucket_mask;
+      const size_t budget;
+      size_t bytes;  // Live entries.
+      size_t retired_bytes;
+      size_t entries;
+      Entry* clock_hand;
+      std::vector<std::pair<uint64_t, Entry*> > retired;  // With epochs.
+
+      std::atomic<uint64_t> hits;
+      std::atomic<uint64_t> misses;
+      std::atomic<uint64_t> insertions;
+      std::atomic<uint64_t> evictions;
+      std::atomic<uint64_t> oversized;
+
+      // Keep the counters of different shards in different cache lines.
+      char padding[64];
+    };
+
+    /// @brief Mix the bits of a key, since caller provided keys may be small
+    /// integers.
+    static uint64_t Mix(uint64_t key) {
+      key ^= key >> 33;
+      key *= 0xff51afd7ed558ccdULL;
+      key ^= key >> 33;
+      key *= 0xc4ceb9fe1a85ec53ULL;
+      return key ^ (key >> 33);
+    }
+
+    static size_t RoundUpToPowerOfTwo(size_t x) {
+      size_t result = 1;
+      while (result < x)
+        result <<= 1;
+      return result;
+    }
+
+    Shard& ShardFor(uint64_t key) {
+      return *shards_[Mix(key) & shard_mask_];
+    }
+
+    Epochs epochs_;
+    std::vector<Shard*> shards_;
+    size_t shard_mask_;
+
+    MemoryFragmentCache(const MemoryFragmentCache&) = delete;
+    MemoryFragmentCache& operator=(const MemoryFragmentCache&) = delete;
+};
+
+} // namespace htmlgen
+
+#endif // FRAGMENT_CACHE_H_
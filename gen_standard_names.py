@@ -0,0 +1,218 @@
+#!/usr/bin/env python3
+# -*- mode: python; tab-width: 4; indent-tabs-mode: nil; -*-
+#-----------------------------------------------------------------------------
+# Generate the standard name tables of document.h.
+#-----------------------------------------------------------------------------
+# This is free and unencumbered software released into the public domain.
+#
+# For more information, please refer to <http://unlicense.org/>
+#-----------------------------------------------------------------------------
+#
+# The tables map the standard HTML5 tag and attribute names to IDs with a
+# minimal perfect hash (hash and displace), and IDs to flags. The generated
+# code replaces the block between the "BEGIN GENERATED" and "END GENERATED"
+# markers in document.h. Usage:
+#
+#   python3 gen_standard_names.py document.h
+
+import sys
+
+TAGS = """
+a abbr address area article aside audio b base bdi bdo blockquote body br
+button canvas caption cite code col colgroup data datalist dd del details dfn
+dialog div dl dt em embed fieldset figcaption figure footer form h1 h2 h3 h4
+h5 h6 head header hgroup hr html i iframe img input ins kbd keygen label
+legend li link main map mark math menu meta meter nav noscript object ol
+optgroup option output p param picture pre progress q rp rt ruby s samp
+script search section select slot small source span strong style sub summary
+sup svg table tbody td template textarea tfoot th thead time title tr track u
+ul var video wbr
+""".split()
+
+ATTRIBUTES = """
+abbr accept accept-charset accesskey action allow allowfullscreen alt as
+async autocapitalize autocomplete autofocus autoplay blocking charset checked
+cite class cols colspan content contenteditable controls coords crossorigin
+data datetime decoding default defer dir dirname disabled download draggable
+enctype enterkeyhint fetchpriority for form formaction formenctype formmethod
+formnovalidate formtarget headers height hidden high href hreflang http-equiv
+id imagesizes imagesrcset inert inputmode integrity is ismap itemid itemprop
+itemref itemscope itemtype kind label lang list loading loop low max
+maxlength media method min minlength multiple muted name nomodule nonce
+novalidate open optimum pattern ping placeholder playsinline popover
+popovertarget popovertargetaction poster preload readonly referrerpolicy rel
+required reversed role rows rowspan sandbox scope selected shadowrootmode
+shape size sizes slot span spellcheck src srcdoc srclang srcset start step
+style tabindex target title translate type usemap value width wrap
+aria-controls aria-current aria-describedby aria-disabled aria-expanded
+aria-hidden aria-label aria-labelledby aria-live aria-selected
+onabort onafterprint onauxclick onbeforeprint onbeforeunload onblur oncancel
+oncanplay oncanplaythrough onchange onclick onclose oncontextmenu oncopy
+oncuechange oncut ondblclick ondrag ondragend ondragenter ondragleave
+ondragover ondragstart ondrop ondurationchange onemptied onended onerror
+onfocus onhashchange oninput oninvalid onkeydown onkeypress onkeyup onload
+onloadeddata onloadedmetadata onloadstart onmessage onmousedown onmouseenter
+onmouseleave onmousemove onmouseout onmouseover onmouseup onoffline ononline
+onpagehide onpageshow onpaste onpause onplay onplaying onpopstate onprogress
+onratechange onreset onresize onscroll onseeked onseeking onselect onstalled
+onstorage onsubmit onsuspend ontimeupdate ontoggle onunload onvolumechange
+onwaiting onwheel
+""".split()
+
+# Elements without end tags, and elements with raw text or escapable raw text
+# content (https://html.spec.whatwg.org/multipage/syntax.html#elements-2).
+VOID_ELEMENTS = """
+area base br col embed hr img input keygen link meta param source track wbr
+""".split()
+RAW_TEXT_ELEMENTS = ['script', 'style']
+ESCAPABLE_RAW_TEXT_ELEMENTS = ['textarea', 'title']
+
+# Must match internal::StandardNames::Flag in document.h.
+FLAG_TAG = 1
+FLAG_ATTRIBUTE = 2
+FLAG_VOID = 4
+FLAG_RAW_TEXT = 8
+FLAG_ESCAPABLE_RAW_TEXT = 16
+
+MASK = (1 << 64) - 1
+MULTIPLIER = 0xff51afd7ed558ccd
+
+
+def name_hash(name):
+    """Must match internal::StandardNames::Hash() in document.h."""
+    data = name.encode()
+    n = min(len(data), 8)
+    a = int.from_bytes(data[:n], 'little')
+    b = int.from_bytes(data[len(data) - n:], 'little')
+    h = ((a * 0x9e3779b97f4a7c15) ^ ((b + len(data)) * 0xc2b2ae3d27d4eb4f))
+    h &= MASK
+    return h ^ (h >> 29)
+
+
+def reduce(x, n):
+    """Map the high 32 bits of x to [0, n)."""
+    return ((x >> 32) * n) >> 32
+
+
+def slot(h, displacement, num_names):
+    return reduce(((h ^ displacement) * MULTIPLIER) & MASK, num_names)
+
+
+def build(names):
+    num_names = len(names)
+    num_buckets = (num_names + 3) // 4
+    hashes = [name_hash(name) for name in names]
+    assert len(set(hashes)) == num_names, 'hash collision'
+    buckets = [[] for _ in range(num_buckets)]
+    for i, h in enumerate(hashes):
+        buckets[reduce(h, num_buckets)].append(i)
+
+    # Place the largest buckets first, while there are many free slots.
+    displacements = [0] * num_buckets
+    slots = [None] * num_names
+    order = sorted(range(num_buckets), key=lambda b: -len(buckets[b]))
+    for b in order:
+        for d in range(1 << 16):
+            s = [slot(hashes[i], d, num_names) for i in buckets[b]]
+            if len(set(s)) == len(s) and all(slots[x] is None for x in s):
+                break
+        else:
+            raise RuntimeError('no displacement found for bucket %d' % b)
+        displacements[b] = d
+        for i, x in zip(buckets[b], s):
+            slots[x] = names[i]
+    return displacements, slots
+
+
+def flags(name):
+    result = 0
+    if name in TAGS:
+        result |= FLAG_TAG
+    if name in ATTRIBUTES:
+        result |= FLAG_ATTRIBUTE
+    if name in VOID_ELEMENTS:
+        result |= FLAG_VOID
+    if name in RAW_TEXT_ELEMENTS:
+        result |= FLAG_RAW_TEXT
+    if name in ESCAPABLE_RAW_TEXT_ELEMENTS:
+        result |= FLAG_ESCAPABLE_RAW_TEXT
+    return result
+
+
+def format_list(items, indent):
+    lines = []
+    line = indent
+    for item in items:
+        if len(line) + len(item) + 1 > 80:
+            lines.append(line.rstrip())
+            line = indent
+        line += item + ' '
+    lines.append(line.rstrip())
+    return '\n'.join(lines)
+
+
+def generate():
+    assert set(VOID_ELEMENTS) <= set(TAGS)
+    assert set(RAW_TEXT_ELEMENTS + ESCAPABLE_RAW_TEXT_ELEMENTS) <= set(TAGS)
+    names = sorted(set(TAGS) | set(ATTRIBUTES))
+    displacements, slots = build(names)
+    indent = ' ' * 8
+    out = []
+    out.append('    enum {')
+    out.append('      kCount = %d,' % len(slots))
+    out.append('      kNumBuckets = %d' % len(displacements))
+    out.append('    };')
+    out.append('')
+    out.append('    /// @brief Get a name by its ID.')
+    out.append('    static constexpr const char* Name(int id) {')
+    out.append('      return Tables<>::kNames[id];')
+    out.append('    }')
+    out.append('')
+    out.append('    /// @brief Get the flags of a name (a combination of Flag '
+               'values).')
+    out.append('    static constexpr unsigned Flags(int id) {')
+    out.append('      return Tables<>::kFlags[id];')
+    out.append('    }')
+    out.append('')
+    out.append('  private:')
+    out.append('    /// @brief The tables, in a class template so that they '
+               'can be defined in')
+    out.append('    /// a header.')
+    out.append('    template <int = 0>')
+    out.append('    struct Tables {')
+    out.append('      static constexpr const char* kNames[kCount] = {')
+    out.append(format_list(['"%s",' % s for s in slots], indent)[:-1] + '};')
+    out.append('      static constexpr uint8_t kFlags[kCount] = {')
+    out.append(format_list(['%d,' % flags(s) for s in slots],
+                           indent)[:-1] + '};')
+    out.append('      static constexpr uint16_t kDisplacements[kNumBuckets] '
+               '= {')
+    out.append(format_list(['%d,' % d for d in displacements],
+                           indent)[:-1] + '};')
+    out.append('    };')
+    out.append('')
+    out.append('    /// @brief Map a name hash to the only ID that it can '
+               'have.')
+    out.append('    static constexpr int Slot(uint64_t h) {')
+    out.append('      return static_cast<int>(Reduce(')
+    out.append('          (h ^ Tables<>::kDisplacements[Reduce(h, '
+               'kNumBuckets)]) *')
+    out.append('              0x%xULL,' % MULTIPLIER)
+    out.append('          kCount));')
+    out.append('    }')
+    return '\n'.join(out) + '\n'
+
+
+def main():
+    path = sys.argv[1]
+    with open(path) as f:
+        text = f.read()
+    begin = text.index('\n', text.index('// BEGIN GENERATED')) + 1
+    end = text.rindex('\n', 0, text.index('// END GENERATED')) + 1
+    text = text[:begin] + generate() + text[end:]
+    with open(path, 'w') as f:
+        f.write(text)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,953 @@
+// -*- mode: c++; tab-width: 2; indent-tabs-mode: nil; -*-
+//----------------------------------------------------------------------------
+// A type-safe embedded DSL for building HTML.
+//----------------------------------------------------------------------------
+// This is free and unencumbered software released into the public domain.
+//
+// Anyone is free to copy, modify, publish, use, compile, sell, or
+// distribute this software, either in source code form or as a compiled
+// binary, for any purpose, commercial or non-commercial, and by any
+// means.
+//
+// In jurisdictions that recognize copyright laws, the author or authors
+// of this software dedicate any and all copyright interest in the
+// software to the public domain. We make this dedication for the benefit
+// of the public at large and to the detriment of our heirs and
+// successors. We intend this dedication to be an overt act of
+// relinquishment in perpetuity of all present and future rights to this
+// software under copyright law.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+// OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+// ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+//
+// For more information, please refer to <http://unlicense.org/>
+//----------------------------------------------------------------------------
+
+#ifndef HTML_DSL_H_
+#define HTML_DSL_H_
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "document.h"
+
+// Note: This header requires C++14.
+
+namespace htmlgen {
+
+/// @brief An embedded DSL for building HTML, where element and attribute
+/// names are types.
+///
+/// Element expressions are built with one function per element, taking
+/// attributes and content in any order. Misspelled names do not compile, and
+/// neither does content under a void element. The start and end tags are
+/// string literals that are put together by the preprocessor, so serializing
+/// an element copies constant byte sequences of known length and never looks
+/// at the element name at run time. Subtrees that are made only from string
+/// literals can be rendered at compile time (see Fuse()).
+///
+/// @code{.cpp}
+///   namespace h = htmlgen::h;
+///   std::string html;
+///   h::Render(h::div(h::cls("card"),
+///                    h::img(h::src(url), h::alt(caption)),
+///                    h::p("Price: ", price)),
+///             html);
+/// @endcode
+///
+/// @note Expressions refer to the strings that they were built from, so they
+/// should be rendered in the same full expression, or the strings must be kept
+/// alive.
+namespace h {
+
+/// @brief Text content (unescaped).
+struct Text {
+  constexpr Text(const char* text_data, size_t text_len) :
+      data(text_data), len(text_len) {}
+
+  const char* data;
+  size_t len;
+};
+
+/// @brief Pre-rendered HTML content, which is written as is.
+struct Raw {
+  constexpr Raw(const char* html_data, size_t html_len) :
+      data(html_data), len(html_len) {}
+
+  const char* data;
+  size_t len;
+};
+
+/// @brief An attribute with a name that is given by the type @c AttrName.
+template <class AttrName>
+struct Attr {
+  constexpr Attr(const char* value_data, size_t value_len) :
+      data(value_data), len(value_len) {}
+
+  const char* data;  ///< The value (unescaped).
+  size_t len;
+};
+
+/// @brief An attribute with a name that is given at run time.
+struct DynamicAttr {
+  const char* name;
+  size_t name_len;
+  const char* data;  ///< The value (unescaped).
+  size_t len;
+};
+
+/// @brief An element with the tag given by the type @c Tag.
+template <class Tag, class... Children>
+struct Elem {
+  std::tuple<Children...> children;
+};
+
+namespace internal {
+
+class StaticRenderer;
+
+/// @brief Get the length of a string in a char array of size @c N.
+template <size_t N>
+constexpr size_t ArrayStringLength(const char (&str)[N]) {
+  size_t len = 0;
+  while (len < N && str[len])
+    ++len;
+  return len;
+}
+
+/// @brief Get the StandardNames flags of a tag name (0 for a name that is
+/// not standard, such as a custom element name).
+constexpr unsigned TagFlags(const char* name, size_t len) {
+  int id = ::htmlgen::internal::StandardNames::Find(name, len);
+  return id < 0 ? 0 : ::htmlgen::internal::StandardNames::Flags(id);
+}
+
+} // namespace internal
+
+// The Literal types are made from char arrays (normally string literals), and
+// the array size gives an upper bound for the length of their HTML. Subtrees
+// that are made only from Literal nodes can be fused at compile time (see
+// Fuse()).
+
+/// @brief Text content from a char array of size @c N.
+template <size_t N>
+struct LiteralText : Text {
+  constexpr explicit LiteralText(const char (&str)[N]) :
+      Text(str, internal::ArrayStringLength(str)) {}
+};
+
+/// @brief Pre-rendered HTML content from a char array of size @c N.
+template <size_t N>
+struct LiteralRaw : Raw {
+  constexpr explicit LiteralRaw(const char (&str)[N]) :
+      Raw(str, internal::ArrayStringLength(str)) {}
+};
+
+/// @brief An attribute with a value from a char array of size @c N.
+template <class AttrName, size_t N>
+struct LiteralAttr : Attr<AttrName> {
+  constexpr explicit LiteralAttr(const char (&str)[N]) :
+      Attr<AttrName>(str, internal::ArrayStringLength(str)) {}
+};
+
+/// @brief HTML that was rendered by Fuse(), with room for @c N bytes.
+template <size_t N>
+class StaticHtml {
+  public:
+    constexpr StaticHtml() : data_(), size_(0) {}
+
+    constexpr const char* data() const {
+      return data_;
+    }
+
+    constexpr size_t size() const {
+      return size_;
+    }
+
+  private:
+    char data_[N + 1];
+    size_t size_;
+
+    friend class internal::StaticRenderer;
+};
+
+namespace internal {
+
+// Conversion of strings to DSL nodes. Char arrays become Literal nodes.
+template <size_t N>
+constexpr LiteralText<N> MakeText(const char (&value)[N], std::true_type) {
+  return LiteralText<N>(value);
+}
+
+inline Text MakeText(const char* value, std::false_type) {
+  return Text(value, std::strlen(value));
+}
+
+inline Text MakeText(const std::string& value, std::false_type) {
+  return Text(value.data(), value.size());
+}
+
+template <size_t N>
+constexpr LiteralRaw<N> MakeRaw(const char (&html)[N], std::true_type) {
+  return LiteralRaw<N>(html);
+}
+
+inline Raw MakeRaw(const char* html, std::false_type) {
+  return Raw(html, std::strlen(html));
+}
+
+inline Raw MakeRaw(const std::string& html, std::false_type) {
+  return Raw(html.data(), html.size());
+}
+
+template <class AttrName, size_t N>
+constexpr LiteralAttr<AttrName, N> MakeAttr(const char (&value)[N],
+                                            std::true_type) {
+  return LiteralAttr<AttrName, N>(value);
+}
+
+template <class AttrName>
+Attr<AttrName> MakeAttr(const char* value, std::false_type) {
+  return Attr<AttrName>(value, std::strlen(value));
+}
+
+template <class AttrName>
+Attr<AttrName> MakeAttr(const std::string& value, std::false_type) {
+  return Attr<AttrName>(value.data(), value.size());
+}
+
+// Conversion of the arguments of the element functions to DSL nodes. Strings
+// become text content, and nodes are passed through.
+template <size_t N>
+constexpr LiteralText<N> ToNode(const char (&value)[N], std::true_type) {
+  return LiteralText<N>(value);
+}
+
+inline Text ToNode(const char* value, std::false_type) {
+  return MakeText(value, std::false_type());
+}
+
+inline Text ToNode(const std::string& value, std::false_type) {
+  return MakeText(value, std::false_type());
+}
+
+template <class Node>
+constexpr Node ToNode(const Node& node, std::false_type) {
+  return node;
+}
+
+template <class T>
+constexpr auto ToNode(const T& arg) {
+  return ToNode(arg, std::is_array<T>());
+}
+
+} // namespace internal
+
+/// @brief Make text content from a string.
+template <class T>
+constexpr auto text(const T& value) {
+  return internal::MakeText(value, std::is_array<T>());
+}
+
+/// @brief Make pre-rendered content from a string of HTML.
+template <class T>
+constexpr auto raw(const T& html) {
+  return internal::MakeRaw(html, std::is_array<T>());
+}
+
+/// @brief Make an attribute with a name that is not known to the DSL (e.g.
+/// a data- attribute).
+inline DynamicAttr attr(const char* name, const char* value) {
+  return DynamicAttr{name, std::strlen(name), value, std::strlen(value)};
+}
+
+/// @brief Make an attribute with a name that is not known to the DSL (e.g.
+/// a data- attribute).
+inline DynamicAttr attr(const char* name, const std::string& value) {
+  return DynamicAttr{name, std::strlen(name), value.data(), value.size()};
+}
+
+namespace internal {
+
+template <class T>
+using NodeType = decltype(ToNode(std::declval<const T&>()));
+
+template <class T>
+struct IsAttribute : std::false_type {};
+
+template <class AttrName>
+struct IsAttribute<Attr<AttrName> > : std::true_type {};
+
+template <class AttrName, size_t N>
+struct IsAttribute<LiteralAttr<AttrName, N> > : std::true_type {};
+
+template <>
+struct IsAttribute<DynamicAttr> : std::true_type {};
+
+template <class T>
+struct IsText : std::is_base_of<Text, T> {};
+
+template <class... Nodes>
+struct CountAttributes : std::integral_constant<size_t, 0> {};
+
+template <class Node, class... Nodes>
+struct CountAttributes<Node, Nodes...> :
+    std::integral_constant<size_t, IsAttribute<Node>::value +
+                                       CountAttributes<Nodes...>::value> {};
+
+/// @brief Serialization of DSL expressions.
+class Renderer {
+  public:
+    static void Write(const Text& node, Document::Writer& writer) {
+      Document::TextNode::AppendEscaped(node.data, node.len, writer.out());
+    }
+
+    static void Write(const Raw& node, Document::Writer& writer) {
+      writer.out().append(node.data, node.len);
+    }
+
+    // Attributes are written with the start tag.
+    template <class AttrName>
+    static void Write(const Attr<AttrName>&, Document::Writer&) {}
+
+    static void Write(const DynamicAttr&, Document::Writer&) {}
+
+    template <class Tag, class... Children>
+    static void Write(const Elem<Tag, Children...>& node,
+                      Document::Writer& writer) {
+      WriteElement(node, writer, std::index_sequence_for<Children...>());
+    }
+
+    template <size_t N>
+    static void Write(const StaticHtml<N>& node, Document::Writer& writer) {
+      writer.out().append(node.data(), node.size());
+    }
+
+  private:
+    template <class Tag, class... Children, size_t... I>
+    static void WriteElement(const Elem<Tag, Children...>& node,
+                             Document::Writer& writer,
+                             std::index_sequence<I...>) {
+      std::string& out = writer.out();
+      if (CountAttributes<Children...>::value == 0) {
+        out.append(Tag::Open(), Tag::kNameLen + 2);
+      } else {
+        out.append(Tag::Start(), Tag::kNameLen + 1);
+        int unused[] = {0, (WriteAttribute(std::get<I>(node.children), writer,
+                                           IsAttribute<Children>()), 0)...};
+        (void)unused;
+        out += '>';
+      }
+      int unused[] = {0, (WriteContent<Tag>(std::get<I>(node.children),
+                                            writer), 0)...};
+      (void)unused;
+      if (!Tag::kIsVoid)
+        out.append(Tag::End(), Tag::kNameLen + 3);
+    }
+
+    template <class Tag, class Node>
+    static void WriteContent(const Node& node, Document::Writer& writer) {
+      WriteContent(node, writer, Tag::Name(), Tag::kNameLen,
+                   std::integral_constant<bool, Tag::kIsRawText &&
+                                                    IsText<Node>::value>());
+    }
+
+    template <class Node>
+    static void WriteContent(const Node& node, Document::Writer& writer,
+                             const char*, size_t, std::false_type) {
+      Write(node, writer);
+    }
+
+    // The text of raw text elements is not escaped.
+    static void WriteContent(const Text& node, Document::Writer& writer,
+                             const char* name, size_t name_len,
+                             std::true_type) {
+      Document::TextNode::AppendRawText(node.data, node.len, name, name_len,
+                                        writer.out());
+    }
+
+    template <class Node>
+    static void WriteAttribute(const Node&, Document::Writer&,
+                               std::false_type) {}
+
+    template <class AttrName>
+    static void WriteAttribute(const Attr<AttrName>& node,
+                               Document::Writer& writer, std::true_type) {
+      writer.out().append(AttrName::Prefix(), AttrName::kNameLen + 3);
+      WriteValue(AttrName::Name(), AttrName::kNameLen, node.data, node.len,
+                 writer);
+    }
+
+    static void WriteAttribute(const DynamicAttr& node,
+                               Document::Writer& writer, std::true_type) {
+      std::string& out = writer.out();
+      out += ' ';
+      out.append(node.name, node.name_len);
+      out.append("=\"", 2);
+      WriteValue(node.name, node.name_len, node.data, node.len, writer);
+    }
+
+    /// @brief Write an escaped attribute value and the closing quote,
+    /// applying the Writer's attribute rewrites in the same way as
+    /// Document::Attribute.
+    static void WriteValue(const char* name, size_t name_len,
+                           const char* value, size_t len,
+                           Document::Writer& writer) {
+      std::string& out = writer.out();
+      size_t start = out.size();
+      Document::Attribute::AppendEscaped(value, len, out);
+      const Document::AttributeRewrite* rewrite =
+          writer.FindAttributeRewrite(name, name_len, out.data() + start,
+                                      out.size() - start);
+      if (rewrite) {
+        out.insert(start, rewrite->escaped_prefix());
+        out.append(rewrite->escaped_suffix());
+      }
+      out += '"';
+    }
+};
+
+/// @brief Conversion of DSL expressions to Document nodes.
+class Builder {
+  public:
+    static void Add(const Text& node, Document::Element* parent) {
+      parent->AddTextChild(std::string(node.data, node.len));
+    }
+
+    static void Add(const Raw& node, Document::Element* parent) {
+      parent->AddRawChild(std::string(node.data, node.len));
+    }
+
+    template <class AttrName>
+    static void Add(const Attr<AttrName>& node,
+                    Document::Element* parent) {
+      parent->AddAttribute(
+          std::string(AttrName::Name(), AttrName::kNameLen),
+          std::string(node.data, node.len));
+    }
+
+    static void Add(const DynamicAttr& node, Document::Element* parent) {
+      parent->AddAttribute(std::string(node.name, node.name_len),
+                           std::string(node.data, node.len));
+    }
+
+    template <class Tag, class... Children>
+    static void Add(const Elem<Tag, Children...>& node,
+                    Document::Element* parent) {
+      AddElement(node, parent, std::index_sequence_for<Children...>());
+    }
+
+    template <size_t N>
+    static void Add(const StaticHtml<N>& node, Document::Element* parent) {
+      parent->AddRawChild(std::string(node.data(), node.size()));
+    }
+
+  private:
+    template <class Tag, class... Children, size_t... I>
+    static void AddElement(const Elem<Tag, Children...>& node,
+                           Document::Element* parent,
+                           std::index_sequence<I...>) {
+      Document::Element* element =
+          parent->AddChild(std::string(Tag::Name(), Tag::kNameLen));
+      int unused[] = {0, (Add(std::get<I>(node.children), element), 0)...};
+      (void)unused;
+      (void)element;  // Unused if there are no children.
+    }
+};
+
+/// @brief Check if an expression can be fused at compile time.
+template <class T>
+struct IsStatic : std::false_type {};
+
+template <size_t N>
+struct IsStatic<LiteralText<N> > : std::true_type {};
+
+template <size_t N>
+struct IsStatic<LiteralRaw<N> > : std::true_type {};
+
+template <class AttrName, size_t N>
+struct IsStatic<LiteralAttr<AttrName, N> > : std::true_type {};
+
+template <size_t N>
+struct IsStatic<StaticHtml<N> > : std::true_type {};
+
+template <class Tag>
+struct IsStatic<Elem<Tag> > : std::true_type {};
+
+template <class Tag, class Child, class... Children>
+struct IsStatic<Elem<Tag, Child, Children...> > :
+    std::integral_constant<bool,
+                           IsStatic<Child>::value &&
+                               IsStatic<Elem<Tag, Children...> >::value> {};
+
+/// @brief Get an upper bound for the HTML size of a static expression.
+/// Expressions that are not static get 0, and are rejected by Fuse().
+template <class T>
+struct MaxSize : std::integral_constant<size_t, 0> {};
+
+// Each escaped character takes at most five bytes (e.g. "&amp;").
+template <size_t N>
+struct MaxSize<LiteralText<N> > : std::integral_constant<size_t, N * 5> {};
+
+template <size_t N>
+struct MaxSize<LiteralRaw<N> > : std::integral_constant<size_t, N> {};
+
+template <class AttrName, size_t N>
+struct MaxSize<LiteralAttr<AttrName, N> > :
+    std::integral_constant<size_t, AttrName::kNameLen + 4 + N * 5> {};
+
+template <size_t N>
+struct MaxSize<StaticHtml<N> > : std::integral_constant<size_t, N> {};
+
+template <class Tag>
+struct MaxSize<Elem<Tag> > :
+    std::integral_constant<size_t, 2 * Tag::kNameLen + 5> {};
+
+template <class Tag, class Child, class... Children>
+struct MaxSize<Elem<Tag, Child, Children...> > :
+    std::integral_constant<size_t,
+                           MaxSize<Child>::value +
+                               MaxSize<Elem<Tag, Children...> >::value> {};
+
+/// @brief Compile time serialization of static DSL expressions.
+///
+/// This mirrors Renderer, with the escaping rules of Document::TextNode and
+/// Document::Attribute.
+class StaticRenderer {
+  public:
+    template <size_t N, class Expr>
+    static constexpr void Write(const Expr& expr, StaticHtml<N>& out) {
+      WriteNode(expr, out);
+    }
+
+  private:
+    template <size_t N>
+    static constexpr void Append(const char* str, size_t len,
+                                 StaticHtml<N>& out) {
+      for (size_t i = 0; i < len; ++i)
+        out.data_[out.size_++] = str[i];
+    }
+
+    template <size_t N>
+    static constexpr void AppendEscaped(const char* str, size_t len,
+                                        bool attribute, StaticHtml<N>& out) {
+      for (size_t i = 0; i < len; ++i) {
+        char c = str[i];
+        if (c == '&')
+          Append("&amp;", 5, out);
+        else if (c == '<')
+          Append("&lt;", 4, out);
+        else if (c == '>' && !attribute)
+          Append("&gt;", 4, out);
+        else if (c == '"' && attribute)
+          Append("&#34;", 5, out);
+        else
+          out.data_[out.size_++] = c;
+      }
+    }
+
+    template <size_t N>
+    static constexpr void WriteNode(const Text& node, StaticHtml<N>& out) {
+      AppendEscaped(node.data, node.len, false, out);
+    }
+
+    template <size_t N>
+    static constexpr void WriteNode(const Raw& node, StaticHtml<N>& out) {
+      Append(node.data, node.len, out);
+    }
+
+    template <class AttrName, size_t N>
+    static constexpr void WriteNode(const Attr<AttrName>&, StaticHtml<N>&) {}
+
+    template <size_t M, size_t N>
+    static constexpr void WriteNode(const StaticHtml<M>& node,
+                                    StaticHtml<N>& out) {
+      Append(node.data(), node.size(), out);
+    }
+
+    template <class Tag, class... Children, size_t N>
+    static constexpr void WriteNode(const Elem<Tag, Children...>& node,
+                                    StaticHtml<N>& out) {
+      WriteElement(node, out, std::index_sequence_for<Children...>());
+    }
+
+    template <class Tag, class... Children, size_t... I, size_t N>
+    static constexpr void WriteElement(const Elem<Tag, Children...>& node,
+                                       StaticHtml<N>& out,
+                                       std::index_sequence<I...>) {
+      if (CountAttributes<Children...>::value == 0) {
+        Append(Tag::Open(), Tag::kNameLen + 2, out);
+      } else {
+        Append(Tag::Start(), Tag::kNameLen + 1, out);
+        int unused[] = {0, (WriteAttribute(std::get<I>(node.children), out,
+                                           IsAttribute<Children>()), 0)...};
+        (void)unused;
+        Append(">", 1, out);
+      }
+      int unused[] = {0, (WriteContent<Tag>(std::get<I>(node.children),
+                                            out), 0)...};
+      (void)unused;
+      if (!Tag::kIsVoid)
+        Append(Tag::End(), Tag::kNameLen + 3, out);
+    }
+
+    template <class Tag, class Node, size_t N>
+    static constexpr void WriteContent(const Node& node, StaticHtml<N>& out) {
+      WriteContent(node, Tag::Name(), Tag::kNameLen, out,
+                   std::integral_constant<bool, Tag::kIsRawText &&
+                                                    IsText<Node>::value>());
+    }
+
+    template <class Node, size_t N>
+    static constexpr void WriteContent(const Node& node, const char*, size_t,
+                                       StaticHtml<N>& out, std::false_type) {
+      WriteNode(node, out);
+    }
+
+    /// @brief Write the text of a raw text element, with end tags for the
+    /// element broken up, and "<!--" and "<script" escaped in "script"
+    /// elements (see Document::TextNode::AppendRawText()).
+    template <size_t N>
+    static constexpr void WriteContent(const Text& node, const char* name,
+                                       size_t name_len, StaticHtml<N>& out,
+                                       std::true_type) {
+      bool script = name_len == 6 && StartsWithIgnoreCase(name, 6, "script");
+      for (size_t i = 0; i < node.len; ++i) {
+        if (node.data[i] != '<') {
+          out.data_[out.size_++] = node.data[i];
+          continue;
+        }
+        const char* p = node.data + i + 1;
+        size_t left = node.len - i - 1;
+        if (script && (StartsWithIgnoreCase(p, left, "!--") ||
+                       StartsWithIgnoreCase(p, left, "script"))) {
+          Append("\\x3C", 4, out);
+          continue;
+        }
+        out.data_[out.size_++] = '<';
+        if (left > name_len && *p == '/' &&
+            StartsWithIgnoreCase(p + 1, left - 1, name))
+          out.data_[out.size_++] = '\\';
+      }
+    }
+
+    /// @brief Compare the start of a string with a lower case ASCII name,
+    /// ignoring case.
+    static constexpr bool StartsWithIgnoreCase(const char* str, size_t len,
+                                               const char* name) {
+      for (size_t i = 0; name[i]; ++i) {
+        if (i == len)
+          return false;
+        char c = str[i];
+        if (c >= 'A' && c <= 'Z')
+          c = static_cast<char>(c - 'A' + 'a');
+        if (c != name[i])
+          return false;
+      }
+      return true;
+    }
+
+    template <class Node, size_t N>
+    static constexpr void WriteAttribute(const Node&, StaticHtml<N>&,
+                                         std::false_type) {}
+
+    template <class AttrName, size_t N>
+    static constexpr void WriteAttribute(const Attr<AttrName>& node,
+                                         StaticHtml<N>& out, std::true_type) {
+      Append(AttrName::Prefix(), AttrName::kNameLen + 3, out);
+      AppendEscaped(node.data, node.len, true, out);
+      Append("\"", 1, out);
+    }
+};
+
+} // namespace internal
+
+/// @brief Render a static expression at compile time.
+///
+/// A static expression only contains elements, attributes, text and raw
+/// HTML that are made from string literals (or char arrays). The result can
+/// be used as content in other expressions, where it is written with a
+/// single copy. Attribute rewrites of the Writer are not applied to it.
+///
+/// @code{.cpp}
+///   static constexpr auto kFooter = h::Fuse(
+///       h::footer(h::cls("site"), h::p("Copyright ", h::a(h::href("/"),
+///                                                           "Example"))));
+///   h::Render(h::body(content, kFooter), html);
+/// @endcode
+///
+/// @see HTMLGEN_STATIC
+template <class Expr>
+constexpr StaticHtml<internal::MaxSize<internal::NodeType<Expr> >::value>
+Fuse(const Expr& expr) {
+  static_assert(internal::IsStatic<internal::NodeType<Expr> >::value,
+                "Only expressions made from string literals can be fused");
+  StaticHtml<internal::MaxSize<internal::NodeType<Expr> >::value> html;
+  internal::StaticRenderer::Write(internal::ToNode(expr), html);
+  return html;
+}
+
+/// @brief Render a static expression at compile time, into a constant with
+/// static storage duration.
+///
+/// The result can be used in expressions and with AppendStatic().
+#define HTMLGEN_STATIC(...)                                                  \
+  ([]() -> const auto& {                                                     \
+    static constexpr auto kHtml = ::htmlgen::h::Fuse(__VA_ARGS__);           \
+    return kHtml;                                                            \
+  }())
+
+/// @brief A node that writes HTML from static storage without copying it
+/// (see AppendStatic()).
+class StaticNode : public Document::Node {
+  public:
+    StaticNode(const char* html, size_t len) : html_(html), len_(len) {}
+
+    virtual void Write(Document::Writer& writer) const {
+      writer.out().append(html_, len_);
+    }
+
+  private:
+    const char* html_;
+    size_t len_;
+};
+
+/// @brief Write the HTML of an expression.
+/// @param expr The expression.
+/// @param writer The Writer that receives the HTML.
+template <class Expr>
+void Render(const Expr& expr, Document::Writer& writer) {
+  internal::Renderer::Write(internal::ToNode(expr), writer);
+}
+
+/// @brief Write the HTML of an expression.
+/// @param expr The expression.
+/// @param[out] out The string that the HTML is appended to.
+template <class Expr>
+void Render(const Expr& expr, std::string& out) {
+  Document::Writer writer(out);
+  Render(expr, writer);
+}
+
+/// @brief Add the nodes of an expression as children of an Element.
+///
+/// The resulting nodes are ordinary Elements, Attributes and TextNodes that
+/// can be queried and modified.
+/// @param parent The Element that the nodes are added to.
+/// @param expr The expression.
+template <class Expr>
+void Append(Document::Element* parent, const Expr& expr) {
+  internal::Builder::Add(internal::ToNode(expr), parent);
+}
+
+/// @brief Add the HTML of an expression as a RawNode child of an Element.
+///
+/// This is faster than Append() when the nodes do not need to be accessed,
+/// but attribute rewrites are applied when the expression is rendered
+/// rather than when the document is written.
+/// @param parent The Element that the RawNode is added to.
+/// @param expr The expression.
+/// @returns The newly created RawNode.
+template <class Expr>
+Document::RawNode* AppendRendered(Document::Element* parent,
+                                  const Expr& expr) {
+  std::string html;
+  Render(expr, html);
+  return parent->AddRawChild(std::move(html));
+}
+
+/// @brief Add fused HTML as a child of an Element, without copying it.
+/// @param parent The Element that the node is added to.
+/// @param html The HTML, which must have static storage duration (e.g. from
+/// HTMLGEN_STATIC).
+/// @returns The newly created StaticNode.
+template <size_t N>
+StaticNode* AppendStatic(Document::Element* parent,
+                         const StaticHtml<N>& html) {
+  return parent->InsertChildBefore(new StaticNode(html.data(), html.size()),
+                                   nullptr);
+}
+
+/// @brief Define an element function @c func for the tag @c tag_name.
+///
+/// Whether the element is void or has raw text content is looked up in the
+/// standard name tables (see internal::StandardNames). Void elements only
+/// accept attributes, which is checked at compile time. The macro can be used
+/// in a namespace of its own to add custom elements.
+#define HTMLGEN_DSL_ELEMENT(func, tag_name)                                  \
+  struct func##_tag {                                                        \
+    static const size_t kNameLen = sizeof(tag_name) - 1;                     \
+    static constexpr unsigned kFlags =                                       \
+        ::htmlgen::h::internal::TagFlags(tag_name, kNameLen);                \
+    static constexpr bool kIsVoid =                                          \
+        (kFlags & ::htmlgen::internal::StandardNames::kVoid) != 0;           \
+    static constexpr bool kIsRawText =                                       \
+        (kFlags & ::htmlgen::internal::StandardNames::kRawText) != 0;        \
+    static constexpr const char* Name() { return tag_name; }                 \
+    static constexpr const char* Open() { return "<" tag_name ">"; }         \
+    static constexpr const char* Start() { return "<" tag_name; }            \
+    static constexpr const char* End() { return "</" tag_name ">"; }         \
+  };                                                                         \
+  template <class... Args>                                                   \
+  constexpr ::htmlgen::h::Elem<func##_tag,                                   \
+                               ::htmlgen::h::internal::NodeType<Args>...>    \
+  func(const Args&... args) {                                                \
+    static_assert(!func##_tag::kIsVoid ||                                    \
+                      ::htmlgen::h::internal::CountAttributes<               \
+                          ::htmlgen::h::internal::NodeType<Args>...>::value  \
+                          == sizeof...(Args),                                \
+                  "<" tag_name "> is a void element and can not have "       \
+                  "content");                                                \
+    return {std::make_tuple(::htmlgen::h::internal::ToNode(args)...)};       \
+  }
+
+/// @brief Define an attribute function @c func for the attribute
+/// @c attr_name.
+#define HTMLGEN_DSL_ATTRIBUTE(func, attr_name)                               \
+  struct func##_attr {                                                       \
+    static const size_t kNameLen = sizeof(attr_name) - 1;                    \
+    static constexpr const char* Name() { return attr_name; }                \
+    static constexpr const char* Prefix() { return " " attr_name "=\""; }    \
+  };                                                                         \
+  template <class T>                                                         \
+  constexpr auto func(const T& value) {                                      \
+    return ::htmlgen::h::internal::MakeAttr<func##_attr>(                    \
+        value, std::is_array<T>());                                          \
+  }
+
+// Document metadata and sections.
+HTMLGEN_DSL_ELEMENT(html, "html")
+HTMLGEN_DSL_ELEMENT(head, "head")
+HTMLGEN_DSL_ELEMENT(title, "title")
+HTMLGEN_DSL_ELEMENT(base, "base")
+HTMLGEN_DSL_ELEMENT(link, "link")
+HTMLGEN_DSL_ELEMENT(meta, "meta")
+HTMLGEN_DSL_ELEMENT(style, "style")
+HTMLGEN_DSL_ELEMENT(script, "script")
+HTMLGEN_DSL_ELEMENT(noscript, "noscript")
+HTMLGEN_DSL_ELEMENT(body, "body")
+HTMLGEN_DSL_ELEMENT(header, "header")
+HTMLGEN_DSL_ELEMENT(footer, "footer")
+HTMLGEN_DSL_ELEMENT(main, "main")
+HTMLGEN_DSL_ELEMENT(nav, "nav")
+HTMLGEN_DSL_ELEMENT(section, "section")
+HTMLGEN_DSL_ELEMENT(article, "article")
+HTMLGEN_DSL_ELEMENT(aside, "aside")
+HTMLGEN_DSL_ELEMENT(h1, "h1")
+HTMLGEN_DSL_ELEMENT(h2, "h2")
+HTMLGEN_DSL_ELEMENT(h3, "h3")
+HTMLGEN_DSL_ELEMENT(h4, "h4")
+HTMLGEN_DSL_ELEMENT(h5, "h5")
+HTMLGEN_DSL_ELEMENT(h6, "h6")
+
+// Grouping and text.
+HTMLGEN_DSL_ELEMENT(div, "div")
+HTMLGEN_DSL_ELEMENT(p, "p")
+HTMLGEN_DSL_ELEMENT(hr, "hr")
+HTMLGEN_DSL_ELEMENT(pre, "pre")
+HTMLGEN_DSL_ELEMENT(blockquote, "blockquote")
+HTMLGEN_DSL_ELEMENT(ul, "ul")
+HTMLGEN_DSL_ELEMENT(ol, "ol")
+HTMLGEN_DSL_ELEMENT(li, "li")
+HTMLGEN_DSL_ELEMENT(dl, "dl")
+HTMLGEN_DSL_ELEMENT(dt, "dt")
+HTMLGEN_DSL_ELEMENT(dd, "dd")
+HTMLGEN_DSL_ELEMENT(figure, "figure")
+HTMLGEN_DSL_ELEMENT(figcaption, "figcaption")
+HTMLGEN_DSL_ELEMENT(details, "details")
+HTMLGEN_DSL_ELEMENT(summary, "summary")
+HTMLGEN_DSL_ELEMENT(a, "a")
+HTMLGEN_DSL_ELEMENT(span, "span")
+HTMLGEN_DSL_ELEMENT(em, "em")
+HTMLGEN_DSL_ELEMENT(strong, "strong")
+HTMLGEN_DSL_ELEMENT(b, "b")
+HTMLGEN_DSL_ELEMENT(i, "i")
+HTMLGEN_DSL_ELEMENT(u, "u")
+HTMLGEN_DSL_ELEMENT(code, "code")
+HTMLGEN_DSL_ELEMENT(kbd, "kbd")
+HTMLGEN_DSL_ELEMENT(abbr, "abbr")
+HTMLGEN_DSL_ELEMENT(time, "time")
+HTMLGEN_DSL_ELEMENT(mark, "mark")
+HTMLGEN_DSL_ELEMENT(sub, "sub")
+HTMLGEN_DSL_ELEMENT(sup, "sup")
+HTMLGEN_DSL_ELEMENT(br, "br")
+HTMLGEN_DSL_ELEMENT(wbr, "wbr")
+
+// Embedded content.
+HTMLGEN_DSL_ELEMENT(img, "img")
+HTMLGEN_DSL_ELEMENT(picture, "picture")
+HTMLGEN_DSL_ELEMENT(source, "source")
+HTMLGEN_DSL_ELEMENT(video, "video")
+HTMLGEN_DSL_ELEMENT(audio, "audio")
+HTMLGEN_DSL_ELEMENT(track, "track")
+HTMLGEN_DSL_ELEMENT(iframe, "iframe")
+HTMLGEN_DSL_ELEMENT(embed, "embed")
+HTMLGEN_DSL_ELEMENT(canvas, "canvas")
+HTMLGEN_DSL_ELEMENT(template_, "template")
+
+// Tables.
+HTMLGEN_DSL_ELEMENT(table, "table")
+HTMLGEN_DSL_ELEMENT(caption, "caption")
+HTMLGEN_DSL_ELEMENT(colgroup, "colgroup")
+HTMLGEN_DSL_ELEMENT(col, "col")
+HTMLGEN_DSL_ELEMENT(thead, "thead")
+HTMLGEN_DSL_ELEMENT(tbody, "tbody")
+HTMLGEN_DSL_ELEMENT(tfoot, "tfoot")
+HTMLGEN_DSL_ELEMENT(tr, "tr")
+HTMLGEN_DSL_ELEMENT(th, "th")
+HTMLGEN_DSL_ELEMENT(td, "td")
+
+// Forms.
+HTMLGEN_DSL_ELEMENT(form, "form")
+HTMLGEN_DSL_ELEMENT(label, "label")
+HTMLGEN_DSL_ELEMENT(input, "input")
+HTMLGEN_DSL_ELEMENT(button, "button")
+HTMLGEN_DSL_ELEMENT(select, "select")
+HTMLGEN_DSL_ELEMENT(option, "option")
+HTMLGEN_DSL_ELEMENT(textarea, "textarea")
+HTMLGEN_DSL_ELEMENT(fieldset, "fieldset")
+HTMLGEN_DSL_ELEMENT(legend, "legend")
+
+// Attributes. Names that clash with element names get a trailing underscore.
+HTMLGEN_DSL_ATTRIBUTE(id, "id")
+HTMLGEN_DSL_ATTRIBUTE(cls, "class")
+HTMLGEN_DSL_ATTRIBUTE(style_, "style")
+HTMLGEN_DSL_ATTRIBUTE(title_, "title")
+HTMLGEN_DSL_ATTRIBUTE(lang, "lang")
+HTMLGEN_DSL_ATTRIBUTE(role, "role")
+HTMLGEN_DSL_ATTRIBUTE(tabindex, "tabindex")
+HTMLGEN_DSL_ATTRIBUTE(href, "href")
+HTMLGEN_DSL_ATTRIBUTE(target, "target")
+HTMLGEN_DSL_ATTRIBUTE(rel, "rel")
+HTMLGEN_DSL_ATTRIBUTE(src, "src")
+HTMLGEN_DSL_ATTRIBUTE(srcset, "srcset")
+HTMLGEN_DSL_ATTRIBUTE(alt, "alt")
+HTMLGEN_DSL_ATTRIBUTE(width, "width")
+HTMLGEN_DSL_ATTRIBUTE(height, "height")
+HTMLGEN_DSL_ATTRIBUTE(type, "type")
+HTMLGEN_DSL_ATTRIBUTE(name, "name")
+HTMLGEN_DSL_ATTRIBUTE(value, "value")
+HTMLGEN_DSL_ATTRIBUTE(content, "content")
+HTMLGEN_DSL_ATTRIBUTE(charset, "charset")
+HTMLGEN_DSL_ATTRIBUTE(http_equiv, "http-equiv")
+HTMLGEN_DSL_ATTRIBUTE(action, "action")
+HTMLGEN_DSL_ATTRIBUTE(method, "method")
+HTMLGEN_DSL_ATTRIBUTE(for_, "for")
+HTMLGEN_DSL_ATTRIBUTE(placeholder, "placeholder")
+HTMLGEN_DSL_ATTRIBUTE(colspan, "colspan")
+HTMLGEN_DSL_ATTRIBUTE(rowspan, "rowspan")
+
+} // namespace h
+
+} // namespace htmlgen
+
+#endif // HTML_DSL_H_
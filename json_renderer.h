@@ -0,0 +1,459 @@
+// -*- mode: c++; tab-width: 2; indent-tabs-mode: nil; -*-
+//----------------------------------------------------------------------------
+// A streaming JSON to HTML renderer.
+//----------------------------------------------------------------------------
+// This is free and unencumbered software released into the public domain.
+//
+// Anyone is free to copy, modify, publish, use, compile, sell, or
+// distribute this software, either in source code form or as a compiled
+// binary, for any purpose, commercial or non-commercial, and by any
+// means.
+//
+// In jurisdictions that recognize copyright laws, the author or authors
+// of this software dedicate any and all copyright interest in the
+// software to the public domain. We make this dedication for the benefit
+// of the public at large and to the detriment of our heirs and
+// successors. We intend this dedication to be an overt act of
+// relinquishment in perpetuity of all present and future rights to this
+// software under copyright law.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+// OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+// ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+//
+// For more information, please refer to <http://unlicense.org/>
+//----------------------------------------------------------------------------
+
+#ifndef JSON_RENDERER_H_
+#define JSON_RENDERER_H_
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include "document.h"
+
+namespace htmlgen {
+
+/// @brief The mapping from JSON values to HTML elements.
+///
+/// An empty tag name means that no element is written for that part of the
+/// structure.
+struct JsonHtmlSchema {
+  JsonHtmlSchema() : object_tag("dl"), key_tag("dt"), value_tag("dd"),
+      array_tag("table"), array_row_tag("tr"), array_cell_tag("td"),
+      null_text("null"), true_text("true"), false_text("false"),
+      max_depth(256) {}
+
+  std::string object_tag;      ///< Wraps the members of an object.
+  std::string key_tag;         ///< Wraps each member name.
+  std::string value_tag;       ///< Wraps each member value.
+  std::string array_tag;       ///< Wraps the items of an array.
+  std::string array_row_tag;   ///< Wraps each array item (outer).
+  std::string array_cell_tag;  ///< Wraps each array item (inner).
+  std::string null_text;       ///< The text for null (unescaped).
+  std::string true_text;       ///< The text for true (unescaped).
+  std::string false_text;      ///< The text for false (unescaped).
+  size_t max_depth;            ///< The maximum nesting depth.
+};
+
+/// @brief A renderer that converts JSON directly to HTML.
+///
+/// The JSON is parsed in a single pass and the HTML is written directly to
+/// the output, without building an intermediate node tree. Strings are
+/// unescaped from JSON and escaped for HTML with the same escaper as
+/// Document::TextNode, and elements follow the same void element rules as
+/// Document::Element.
+///
+/// @code{.cpp}
+///   htmlgen::JsonRenderer renderer;
+///   std::string html;
+///   if (renderer.Render(json.data(), json.size(), html))
+///     body->AddRawChild(std::move(html));
+/// @endcode
+class JsonRenderer {
+  public:
+    explicit JsonRenderer(const JsonHtmlSchema& schema = JsonHtmlSchema()) :
+        schema_(schema) {
+      MakeTags(schema.object_tag, object_);
+      MakeTags(schema.key_tag, key_);
+      MakeTags(schema.value_tag, value_);
+      MakeTags(schema.array_tag, array_);
+      MakeTags(schema.array_row_tag, row_);
+      MakeTags(schema.array_cell_tag, cell_);
+      Document::TextNode::AppendEscaped(schema.null_text.data(),
+                                        schema.null_text.size(), null_);
+      Document::TextNode::AppendEscaped(schema.true_text.data(),
+                                        schema.true_text.size(), true_);
+      Document::TextNode::AppendEscaped(schema.false_text.data(),
+                                        schema.false_text.size(), false_);
+    }
+
+    /// @brief Render a JSON document as HTML.
+    /// @param json The JSON data (UTF-8).
+    /// @param len The length of the JSON data.
+    /// @param writer The Writer that receives the HTML. If it streams to a
+    /// Sink, the HTML is flushed between array items and object members.
+    /// @returns false if the JSON is malformed or nested too deeply, in which
+    /// case the output is incomplete.
+    bool Render(const char* json, size_t len, Document::Writer& writer) const {
+      Parser parser(*this, json, len, writer);
+      return parser.ParseDocument();
+    }
+
+    /// @brief Render a JSON document as HTML.
+    /// @param json The JSON data (UTF-8).
+    /// @param len The length of the JSON data.
+    /// @param[out] out The string that the HTML is appended to.
+    /// @returns false if the JSON is malformed or nested too deeply, in which
+    /// case the output is incomplete.
+    bool Render(const char* json, size_t len, std::string& out) const {
+      Document::Writer writer(out);
+      return Render(json, len, writer);
+    }
+
+  private:
+    /// @brief The pre-formatted start and end tags of an element.
+    struct Tags {
+      std::string start;
+      std::string end;
+      bool is_void;
+    };
+
+    static void MakeTags(const std::string& name, Tags& tags) {
+      tags.is_void = Document::Element::IsVoidElement(name.c_str());
+      if (name.empty())
+        return;
+      tags.start = "<" + name + ">";
+      tags.end = "</" + name + ">";
+    }
+
+    class Parser {
+      public:
+        Parser(const JsonRenderer& renderer, const char* json, size_t len,
+               Document::Writer& writer) :
+            r_(renderer), p_(json), end_(json + len), writer_(writer),
+            out_(writer.out()), flushed_(0) {}
+
+        bool ParseDocument() {
+          if (!ParseValue(0))
+            return false;
+          SkipSpace();
+          return p_ == end_;
+        }
+
+      private:
+        void SkipSpace() {
+          while (p_ != end_ &&
+                 (*p_ == ' ' || *p_ == '\n' || *p_ == '\r' || *p_ == '\t'))
+            ++p_;
+        }
+
+        bool Consume(char c) {
+          SkipSpace();
+          if (p_ == end_ || *p_ != c)
+            return false;
+          ++p_;
+          return true;
+        }
+
+        /// @brief Get the number of bytes written so far, including the
+        /// ones that were flushed to the Sink.
+        size_t Position() const {
+          return flushed_ + out_.size();
+        }
+
+        /// @brief Let the Writer pass the buffered HTML to its Sink.
+        void MaybeFlush() {
+          size_t size = out_.size();
+          writer_.MaybeFlush();
+          flushed_ += size - out_.size();
+        }
+
+        void Start(const Tags& tags) {
+          out_.append(tags.start);
+          content_start_ = Position();
+        }
+
+        /// @brief Write an end tag, following the Document::Element rule that
+        /// void elements get no end tag unless they have content.
+        void End(const Tags& tags, size_t content_start) {
+          if (!tags.is_void || Position() != content_start)
+            out_.append(tags.end);
+        }
+
+        bool ParseValue(size_t depth) {
+          SkipSpace();
+          if (p_ == end_)
+            return false;
+          switch (*p_) {
+          case '{':
+            return depth < r_.schema_.max_depth && ParseObject(depth + 1);
+          case '[':
+            return depth < r_.schema_.max_depth && ParseArray(depth + 1);
+          case '"':
+            ++p_;
+            return ParseString();
+          case 't':
+            return ParseLiteral("true", 4, r_.true_);
+          case 'f':
+            return ParseLiteral("false", 5, r_.false_);
+          case 'n':
+            return ParseLiteral("null", 4, r_.null_);
+          default:
+            return ParseNumber();
+          }
+        }
+
+        bool ParseObject(size_t depth) {
+          ++p_;
+          Start(r_.object_);
+          size_t object_start = content_start_;
+          if (!Consume('}')) {
+            do {
+              if (!Consume('"'))
+                return false;
+              Start(r_.key_);
+              size_t key_start = content_start_;
+              if (!ParseString())
+                return false;
+              End(r_.key_, key_start);
+              if (!Consume(':'))
+                return false;
+              Start(r_.value_);
+              size_t value_start = content_start_;
+              if (!ParseValue(depth))
+                return false;
+              End(r_.value_, value_start);
+              MaybeFlush();
+            } while (Consume(','));
+            if (!Consume('}'))
+              return false;
+          }
+          End(r_.object_, object_start);
+          return true;
+        }
+
+        bool ParseArray(size_t depth) {
+          ++p_;
+          Start(r_.array_);
+          size_t array_start = content_start_;
+          if (!Consume(']')) {
+            do {
+              Start(r_.row_);
+              size_t row_start = content_start_;
+              Start(r_.cell_);
+              size_t cell_start = content_start_;
+              if (!ParseValue(depth))
+                return false;
+              End(r_.cell_, cell_start);
+              End(r_.row_, row_start);
+              MaybeFlush();
+            } while (Consume(','));
+            if (!Consume(']'))
+              return false;
+          }
+          End(r_.array_, array_start);
+          return true;
+        }
+
+        bool ParseLiteral(const char* literal, size_t len,
+                          const std::string& html) {
+          if (static_cast<size_t>(end_ - p_) < len ||
+              std::memcmp(p_, literal, len) != 0)
+            return false;
+          p_ += len;
+          out_.append(html);
+          return true;
+        }
+
+        bool ParseNumber() {
+          // Numbers only contain characters that need no escaping, so they
+          // are validated and copied as is.
+          const char* start = p_;
+          if (p_ != end_ && *p_ == '-')
+            ++p_;
+          if (!SkipDigits())
+            return false;
+          if (p_ != end_ && *p_ == '.') {
+            ++p_;
+            if (!SkipDigits())
+              return false;
+          }
+          if (p_ != end_ && (*p_ == 'e' || *p_ == 'E')) {
+            ++p_;
+            if (p_ != end_ && (*p_ == '+' || *p_ == '-'))
+              ++p_;
+            if (!SkipDigits())
+              return false;
+          }
+          out_.append(start, p_ - start);
+          return true;
+        }
+
+        bool SkipDigits() {
+          const char* start = p_;
+          while (p_ != end_ && *p_ >= '0' && *p_ <= '9')
+            ++p_;
+          return p_ != start;
+        }
+
+        /// @brief Parse a string (after the opening quote), and write it as
+        /// escaped HTML text.
+        bool ParseString() {
+          const char* run = p_;
+          while (p_ != end_) {
+            unsigned char c = static_cast<unsigned char>(*p_);
+            if (c == '"') {
+              Document::TextNode::AppendEscaped(run, p_ - run, out_);
+              ++p_;
+              return true;
+            }
+            if (c < 0x20)
+              return false;
+            if (c != '\\') {
+              ++p_;
+              continue;
+            }
+
+            Document::TextNode::AppendEscaped(run, p_ - run, out_);
+            ++p_;
+            if (!ParseEscape())
+              return false;
+            run = p_;
+          }
+          return false;
+        }
+
+        bool ParseEscape() {
+          if (p_ == end_)
+            return false;
+          char c = *p_++;
+          switch (c) {
+          case '"':
+            out_ += '"';
+            return true;
+          case '\\':
+            out_ += '\\';
+            return true;
+          case '/':
+            out_ += '/';
+            return true;
+          case 'b':
+            out_ += '\b';
+            return true;
+          case 'f':
+            out_ += '\f';
+            return true;
+          case 'n':
+            out_ += '\n';
+            return true;
+          case 'r':
+            out_ += '\r';
+            return true;
+          case 't':
+            out_ += '\t';
+            return true;
+          case 'u':
+            break;
+          default:
+            return false;
+          }
+
+          uint32_t code;
+          if (!ParseHex4(code))
+            return false;
+          if (code >= 0xd800 && code < 0xdc00) {
+            // A high surrogate must be followed by a low surrogate.
+            uint32_t low;
+            if (end_ - p_ >= 6 && p_[0] == '\\' && p_[1] == 'u') {
+              const char* save = p_;
+              p_ += 2;
+              if (!ParseHex4(low))
+                return false;
+              if (low >= 0xdc00 && low < 0xe000)
+                code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+              else {
+                p_ = save;
+                code = 0xfffd;
+              }
+            }
+            else
+              code = 0xfffd;
+          }
+          else if (code >= 0xdc00 && code < 0xe000) {
+            code = 0xfffd;
+          }
+
+          // The only code points that need HTML escaping are ASCII.
+          if (code < 0x80) {
+            char ch = static_cast<char>(code);
+            Document::TextNode::AppendEscaped(&ch, 1, out_);
+          }
+          else
+            AppendUtf8(code);
+          return true;
+        }
+
+        bool ParseHex4(uint32_t& code) {
+          if (end_ - p_ < 4)
+            return false;
+          code = 0;
+          for (int i = 0; i < 4; ++i) {
+            char c = *p_++;
+            code <<= 4;
+            if (c >= '0' && c <= '9')
+              code |= c - '0';
+            else if (c >= 'a' && c <= 'f')
+              code |= c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F')
+              code |= c - 'A' + 10;
+            else
+              return false;
+          }
+          return true;
+        }
+
+        void AppendUtf8(uint32_t code) {
+          if (code < 0x800) {
+            out_ += static_cast<char>(0xc0 | (code >> 6));
+          } else {
+            if (code < 0x10000) {
+              out_ += static_cast<char>(0xe0 | (code >> 12));
+            } else {
+              out_ += static_cast<char>(0xf0 | (code >> 18));
+              out_ += static_cast<char>(0x80 | ((code >> 12) & 0x3f));
+            }
+            out_ += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+          }
+          out_ += static_cast<char>(0x80 | (code & 0x3f));
+        }
+
+        const JsonRenderer& r_;
+        const char* p_;
+        const char* const end_;
+        Document::Writer& writer_;
+        std::string& out_;
+        size_t flushed_;  // Bytes passed to the Sink by MaybeFlush().
+        size_t content_start_;
+    };
+
+    const JsonHtmlSchema schema_;
+    Tags object_;
+    Tags key_;
+    Tags value_;
+    Tags array_;
+    Tags row_;
+    Tags cell_;
+    std::string null_;
+    std::string true_;
+    std::string false_;
+};
+
+} // namespace htmlgen
+
+#endif // JSON_RENDERER_H_
@@ -0,0 +1,1089 @@
+// -*- mode: c++; tab-width: 2; indent-tabs-mode: nil; -*-
+//----------------------------------------------------------------------------
+// A Markdown to HTML converter.
+//----------------------------------------------------------------------------
+// This is free and unencumbered software released into the public domain.
+//
+// Anyone is free to copy, modify, publish, use, compile, sell, or
+// distribute this software, either in source code form or as a compiled
+// binary, for any purpose, commercial or non-commercial, and by any
+// means.
+//
+// In jurisdictions that recognize copyright laws, the author or authors
+// of this software dedicate any and all copyright interest in the
+// software to the public domain. We make this dedication for the benefit
+// of the public at large and to the detriment of our heirs and
+// successors. We intend this dedication to be an overt act of
+// relinquishment in perpetuity of all present and future rights to this
+// software under copyright law.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+// OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+// ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+//
+// For more information, please refer to <http://unlicense.org/>
+//----------------------------------------------------------------------------
+
+#ifndef MARKDOWN_H_
+#define MARKDOWN_H_
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "document.h"
+
+namespace htmlgen {
+
+/// @brief Options for MarkdownConverter.
+struct MarkdownOptions {
+  MarkdownOptions() : max_depth(32), safe_links(true) {}
+
+  /// The maximum nesting depth of block quotes, lists, emphasis and links.
+  /// Deeper constructs are written as plain text.
+  size_t max_depth;
+
+  /// Drop link and image destinations with a URL scheme other than http,
+  /// https and mailto (e.g. javascript:).
+  bool safe_links;
+};
+
+/// @brief A converter from a subset of CommonMark to HTML.
+///
+/// The supported blocks are ATX headings, paragraphs, thematic breaks, fenced
+/// and indented code blocks, block quotes and bullet and ordered lists. The
+/// supported inlines are code spans, emphasis, strong emphasis, links, images,
+/// backslash escapes and hard line breaks. Setext headings, reference links
+/// and entities are not supported, and raw HTML is escaped as text, which
+/// makes the converter suitable for user-generated content.
+///
+/// The result is either added as Element and TextNode children of an Element,
+/// or written directly to a Writer without building a node tree. In both
+/// cases text is escaped by the Document::TextNode and Document::Attribute
+/// escapers.
+///
+/// @code{.cpp}
+///   htmlgen::MarkdownConverter markdown;
+///   markdown.Convert(comment.data(), comment.size(),
+///                    body->AddChild("article"));
+/// @endcode
+class MarkdownConverter {
+  public:
+    explicit MarkdownConverter(
+        const MarkdownOptions& options = MarkdownOptions()) :
+        options_(options) {}
+
+    /// @brief Convert Markdown to HTML nodes.
+    /// @param markdown The Markdown text (UTF-8).
+    /// @param len The length of the Markdown text.
+    /// @param parent The Element that the nodes are added to.
+    void Convert(const char* markdown, size_t len,
+                 Document::Element* parent) const {
+      TreeEmitter emitter(parent);
+      Parser<TreeEmitter> parser(options_, emitter);
+      parser.ParseBlocks(markdown, markdown + len, 0, false);
+      emitter.FlushText();
+    }
+
+    /// @brief Convert Markdown to HTML.
+    /// @param markdown The Markdown text (UTF-8).
+    /// @param len The length of the Markdown text.
+    /// @param writer The Writer that receives the HTML. If it streams to a
+    /// Sink, the HTML is flushed between blocks.
+    void Render(const char* markdown, size_t len,
+                Document::Writer& writer) const {
+      WriterEmitter emitter(writer);
+      Parser<WriterEmitter> parser(options_, emitter);
+      parser.ParseBlocks(markdown, markdown + len, 0, false);
+    }
+
+    /// @brief Convert Markdown to HTML.
+    /// @param markdown The Markdown text (UTF-8).
+    /// @param len The length of the Markdown text.
+    /// @param[out] out The string that the HTML is appended to.
+    void Render(const char* markdown, size_t len, std::string& out) const {
+      Document::Writer writer(out);
+      Render(markdown, len, writer);
+    }
+
+  private:
+    /// @brief An emitter that builds a node tree.
+    class TreeEmitter {
+      public:
+        explicit TreeEmitter(Document::Element* parent) : element_(parent) {}
+
+        void Start(const char* name) {
+          FlushText();
+          element_ = element_->AddChild(name);
+        }
+
+        void AddAttribute(const char* name, const std::string& value) {
+          element_->AddAttribute(std::string(name), value);
+        }
+
+        void EndStart() {}
+
+        void End(const char*) {
+          FlushText();
+          element_ = element_->parent();
+        }
+
+        void Text(const char* text, size_t len) {
+          text_.append(text, len);
+        }
+
+        void MaybeFlush() {}
+
+        /// @brief Add the pending text as a single TextNode.
+        void FlushText() {
+          if (!text_.empty()) {
+            element_->AddTextChild(text_);
+            text_.clear();
+          }
+        }
+
+      private:
+        Document::Element* element_;
+        std::string text_;
+    };
+
+    /// @brief An emitter that writes HTML directly.
+    class WriterEmitter {
+      public:
+        explicit WriterEmitter(Document::Writer& writer) :
+            writer_(writer), out_(writer.out()) {}
+
+        void Start(const char* name) {
+          out_ += '<';
+          out_.append(name);
+        }
+
+        /// @brief Write an attribute, applying the Writer's attribute
+        /// rewrites in the same way as Document::Attribute.
+        void AddAttribute(const char* name, const std::string& value) {
+          size_t name_len = std::strlen(name);
+          escaped_.clear();
+          Document::Attribute::AppendEscaped(value.data(), value.size(),
+                                             escaped_);
+          out_ += ' ';
+          out_.append(name, name_len);
+          out_.append("=\"", 2);
+          const Document::AttributeRewrite* rewrite =
+              writer_.FindAttributeRewrite(name, name_len, escaped_.data(),
+                                           escaped_.size());
+          if (rewrite) {
+            out_.append(rewrite->escaped_prefix());
+            out_.append(escaped_);
+            out_.append(rewrite->escaped_suffix());
+          }
+          else
+            out_.append(escaped_);
+          out_ += '"';
+        }
+
+        void EndStart() {
+          out_ += '>';
+        }
+
+        void End(const char* name) {
+          if (Document::Element::IsVoidElement(name))
+            return;
+          out_.append("</", 2);
+          out_.append(name);
+          out_ += '>';
+        }
+
+        void Text(const char* text, size_t len) {
+          Document::TextNode::AppendEscaped(text, len, out_);
+        }
+
+        /// @brief Let the Writer pass the buffered HTML to its Sink (called
+        /// between blocks).
+        void MaybeFlush() {
+          writer_.MaybeFlush();
+        }
+
+      private:
+        Document::Writer& writer_;
+        std::string& out_;
+        std::string escaped_;
+    };
+
+    /// @brief A list item marker.
+    struct ListMarker {
+      bool ordered;
+      char delimiter;       // The bullet character, or '.' or ')'.
+      unsigned long start;  // The number of an ordered list item.
+      size_t indent;        // The column of the item content.
+      const char* content;  // The start of the item content.
+    };
+
+    template <class Emitter>
+    class Parser {
+      public:
+        Parser(const MarkdownOptions& options, Emitter& emitter) :
+            options_(options), e_(emitter) {}
+
+        /// @brief Parse a sequence of blocks.
+        /// @param tight true if paragraphs should not be wrapped in <p>
+        /// elements (inside tight lists).
+        void ParseBlocks(const char* p, const char* end, size_t depth,
+                         bool tight) {
+          std::string paragraph;
+          while (p != end) {
+            e_.MaybeFlush();
+            const char* next;
+            const char* line_end = LineEnd(p, end, next);
+            size_t indent;
+            const char* s = SkipIndent(p, line_end, indent);
+            if (s == line_end) {
+              EndParagraph(paragraph, tight);
+              p = next;
+              continue;
+            }
+
+            ListMarker marker;
+            if (indent >= 4) {
+              if (!paragraph.empty()) {
+                // A lazy continuation line.
+                AppendLine(paragraph, s, line_end);
+                p = next;
+              } else {
+                p = ParseIndentedCode(p, end);
+              }
+            } else if (IsThematicBreak(s, line_end)) {
+              EndParagraph(paragraph, tight);
+              Void("hr");
+              p = next;
+            } else if (IsHeading(s, line_end)) {
+              EndParagraph(paragraph, tight);
+              ParseHeading(s, line_end);
+              p = next;
+            } else if (IsFence(s, line_end)) {
+              EndParagraph(paragraph, tight);
+              p = ParseFencedCode(s, indent, end);
+            } else if (*s == '>' && depth < options_.max_depth) {
+              EndParagraph(paragraph, tight);
+              p = ParseBlockQuote(p, end, depth);
+            } else if (depth < options_.max_depth &&
+                       ParseListMarker(s, line_end, indent, marker) &&
+                       (paragraph.empty() || CanInterrupt(marker, line_end))) {
+              EndParagraph(paragraph, tight);
+              p = ParseList(marker, line_end, next, end, depth);
+            } else {
+              AppendLine(paragraph, s, line_end);
+              p = next;
+            }
+          }
+          EndParagraph(paragraph, tight);
+        }
+
+      private:
+        /// @brief Find the end of a line, excluding the line break.
+        /// @param[out] next The start of the next line.
+        static const char* LineEnd(const char* p, const char* end,
+                                   const char*& next) {
+          const char* nl = static_cast<const char*>(
+              std::memchr(p, '\n', end - p));
+          if (!nl) {
+            next = end;
+            nl = end;
+          } else {
+            next = nl + 1;
+          }
+          if (nl != p && nl[-1] == '\r')
+            --nl;
+          return nl;
+        }
+
+        /// @brief Skip the leading white space of a line.
+        /// @param[out] indent The indentation, in columns.
+        static const char* SkipIndent(const char* p, const char* end,
+                                      size_t& indent) {
+          indent = 0;
+          for (; p != end; ++p) {
+            if (*p == ' ')
+              ++indent;
+            else if (*p == '\t')
+              indent = (indent + 4) & ~static_cast<size_t>(3);
+            else
+              break;
+          }
+          return p;
+        }
+
+        /// @brief Skip up to @c columns columns of leading white space.
+        static const char* SkipColumns(const char* p, const char* end,
+                                       size_t columns) {
+          size_t column = 0;
+          for (; p != end && column < columns; ++p) {
+            if (*p == ' ')
+              ++column;
+            else if (*p == '\t')
+              column = (column + 4) & ~static_cast<size_t>(3);
+            else
+              break;
+          }
+          return p;
+        }
+
+        static bool IsSpace(char c) {
+          return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+        }
+
+        static bool IsAlnum(char c) {
+          return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') ||
+                 (c >= 'A' && c <= 'Z');
+        }
+
+        static bool IsPunctuation(char c) {
+          return (c >= '!' && c <= '/') || (c >= ':' && c <= '@') ||
+                 (c >= '[' && c <= '`') || (c >= '{' && c <= '~');
+        }
+
+        static void AppendLine(std::string& text, const char* s,
+                               const char* end) {
+          if (!text.empty())
+            text += '\n';
+          text.append(s, end - s);
+        }
+
+        static bool IsThematicBreak(const char* s, const char* end) {
+          char c = *s;
+          if (c != '-' && c != '*' && c != '_')
+            return false;
+          int count = 0;
+          for (; s != end; ++s) {
+            if (*s == c)
+              ++count;
+            else if (*s != ' ' && *s != '\t')
+              return false;
+          }
+          return count >= 3;
+        }
+
+        static bool IsHeading(const char* s, const char* end) {
+          int level = 0;
+          while (s != end && *s == '#' && level < 7) {
+            ++s;
+            ++level;
+          }
+          return level >= 1 && level <= 6 &&
+                 (s == end || *s == ' ' || *s == '\t');
+        }
+
+        static bool IsFence(const char* s, const char* end) {
+          char c = *s;
+          if (c != '`' && c != '~')
+            return false;
+          const char* p = s;
+          while (p != end && *p == c)
+            ++p;
+          if (p - s < 3)
+            return false;
+          // The info string of a backtick fence may not contain backticks.
+          return c == '~' || !std::memchr(p, '`', end - p);
+        }
+
+        static bool ParseListMarker(const char* s, const char* end,
+                                    size_t indent, ListMarker& marker) {
+          const char* p = s;
+          if (*p == '-' || *p == '+' || *p == '*') {
+            marker.ordered = false;
+            marker.delimiter = *p++;
+            marker.start = 1;
+          } else {
+            unsigned long number = 0;
+            while (p != end && *p >= '0' && *p <= '9' && p - s < 9)
+              number = number * 10 + static_cast<unsigned long>(*p++ - '0');
+            if (p == s || p == end || (*p != '.' && *p != ')'))
+              return false;
+            marker.ordered = true;
+            marker.delimiter = *p++;
+            marker.start = number;
+          }
+          if (p != end && *p != ' ' && *p != '\t')
+            return false;
+
+          // The content starts after 1-4 spaces, or 1 space if the item
+          // starts with an indented code block or is empty.
+          size_t spaces;
+          const char* content = SkipIndent(p, end, spaces);
+          if (content == end || spaces > 4) {
+            content = p == end ? p : p + 1;
+            spaces = 1;
+          }
+          marker.indent = indent + (p - s) + spaces;
+          marker.content = content;
+          return true;
+        }
+
+        /// @brief Check if a list item can interrupt a paragraph.
+        static bool CanInterrupt(const ListMarker& marker, const char* end) {
+          return marker.content != end &&
+                 (!marker.ordered || marker.start == 1);
+        }
+
+        /// @brief Check if a line starts a block (other than a paragraph or
+        /// an indented code block).
+        static bool IsBlockStart(const char* s, const char* end,
+                                 size_t indent) {
+          ListMarker marker;
+          return IsThematicBreak(s, end) || IsHeading(s, end) ||
+                 IsFence(s, end) || *s == '>' ||
+                 (ParseListMarker(s, end, indent, marker) &&
+                  CanInterrupt(marker, end));
+        }
+
+        void Void(const char* name) {
+          e_.Start(name);
+          e_.EndStart();
+          e_.End(name);
+        }
+
+        void EndParagraph(std::string& paragraph, bool tight) {
+          if (paragraph.empty())
+            return;
+          size_t len = paragraph.size();
+          while (len > 0 && IsSpace(paragraph[len - 1]))
+            --len;
+          if (!tight) {
+            e_.Start("p");
+            e_.EndStart();
+          }
+          ParseInlines(paragraph.data(), paragraph.data() + len, 0);
+          if (!tight)
+            e_.End("p");
+          paragraph.clear();
+        }
+
+        void ParseHeading(const char* s, const char* end) {
+          static const char* const kNames[6] = {"h1", "h2", "h3", "h4", "h5",
+                                                "h6"};
+          int level = 0;
+          while (*s == '#') {
+            ++s;
+            ++level;
+          }
+
+          // Strip white space and an optional closing sequence of #s.
+          while (s != end && IsSpace(*s))
+            ++s;
+          while (end != s && IsSpace(end[-1]))
+            --end;
+          const char* closing = end;
+          while (closing != s && closing[-1] == '#')
+            --closing;
+          if (closing == s || closing[-1] == ' ' || closing[-1] == '\t') {
+            end = closing;
+            while (end != s && IsSpace(end[-1]))
+              --end;
+          }
+
+          e_.Start(kNames[level - 1]);
+          e_.EndStart();
+          ParseInlines(s, end, 0);
+          e_.End(kNames[level - 1]);
+        }
+
+        /// @returns The start of the line after the code block.
+        const char* ParseIndentedCode(const char* p, const char* end) {
+          e_.Start("pre");
+          e_.EndStart();
+          e_.Start("code");
+          e_.EndStart();
+          size_t blank_lines = 0;
+          while (p != end) {
+            const char* next;
+            const char* line_end = LineEnd(p, end, next);
+            size_t indent;
+            const char* s = SkipIndent(p, line_end, indent);
+            if (s == line_end) {
+              // Blank lines are only kept if more code follows.
+              ++blank_lines;
+            } else if (indent >= 4) {
+              for (; blank_lines > 0; --blank_lines)
+                e_.Text("\n", 1);
+              s = SkipColumns(p, line_end, 4);
+              e_.Text(s, line_end - s);
+              e_.Text("\n", 1);
+            } else {
+              break;
+            }
+            p = next;
+          }
+          e_.End("code");
+          e_.End("pre");
+          return p;
+        }
+
+        /// @param s The start of the opening fence.
+        /// @param indent The indentation of the opening fence.
+        /// @returns The start of the line after the code block.
+        const char* ParseFencedCode(const char* s, size_t indent,
+                                    const char* end) {
+          const char* next;
+          const char* line_end = LineEnd(s, end, next);
+          char fence = *s;
+          const char* p = s;
+          while (*p == fence)
+            ++p;
+          size_t fence_len = p - s;
+
+          // The first word of the info string is the language.
+          size_t unused;
+          const char* info = SkipIndent(p, line_end, unused);
+          const char* info_end = info;
+          while (info_end != line_end && !IsSpace(*info_end))
+            ++info_end;
+
+          e_.Start("pre");
+          e_.EndStart();
+          e_.Start("code");
+          if (info != info_end) {
+            std::string language("language-");
+            AppendUnescaped(info, info_end, language);
+            e_.AddAttribute("class", language);
+          }
+          e_.EndStart();
+
+          p = next;
+          while (p != end) {
+            line_end = LineEnd(p, end, next);
+            size_t line_indent;
+            const char* t = SkipIndent(p, line_end, line_indent);
+            if (line_indent < 4 && t != line_end && *t == fence) {
+              const char* q = t;
+              while (q != line_end && *q == fence)
+                ++q;
+              const char* rest = SkipIndent(q, line_end, unused);
+              if (static_cast<size_t>(q - t) >= fence_len &&
+                  rest == line_end) {
+                p = next;
+                break;
+              }
+            }
+            t = SkipColumns(p, line_end, indent);
+            e_.Text(t, line_end - t);
+            e_.Text("\n", 1);
+            p = next;
+          }
+
+          e_.End("code");
+          e_.End("pre");
+          return p;
+        }
+
+        /// @returns The start of the line after the block quote.
+        const char* ParseBlockQuote(const char* p, const char* end,
+                                    size_t depth) {
+          std::string content;
+          bool lazy_ok = false;
+          while (p != end) {
+            const char* next;
+            const char* line_end = LineEnd(p, end, next);
+            size_t indent;
+            const char* s = SkipIndent(p, line_end, indent);
+            if (indent < 4 && s != line_end && *s == '>') {
+              ++s;
+              if (s != line_end && (*s == ' ' || *s == '\t'))
+                ++s;
+              size_t unused;
+              lazy_ok = SkipIndent(s, line_end, unused) != line_end;
+            } else if (lazy_ok && s != line_end &&
+                       !IsBlockStart(s, line_end, indent)) {
+              // A lazy paragraph continuation line.
+            } else {
+              break;
+            }
+            content.append(s, line_end - s);
+            content += '\n';
+            p = next;
+          }
+
+          e_.Start("blockquote");
+          e_.EndStart();
+          ParseBlocks(content.data(), content.data() + content.size(),
+                      depth + 1, false);
+          e_.End("blockquote");
+          return p;
+        }
+
+        /// @param first The marker of the first item.
+        /// @param line_end The end of the first line of the first item.
+        /// @param p The start of the line after the first line.
+        /// @returns The start of the line after the list.
+        const char* ParseList(const ListMarker& first, const char* line_end,
+                              const char* p, const char* end, size_t depth) {
+          std::vector<std::string> items(1);
+          items.back().assign(first.content, line_end - first.content);
+          items.back() += '\n';
+          ListMarker item = first;
+          bool loose = false;
+          bool blank = false;
+          while (p != end) {
+            const char* next;
+            line_end = LineEnd(p, end, next);
+            size_t indent;
+            const char* s = SkipIndent(p, line_end, indent);
+            ListMarker marker;
+            if (s == line_end) {
+              blank = true;
+              items.back() += '\n';
+            } else if (indent >= item.indent) {
+              if (blank) {
+                // A blank line between two blocks of an item.
+                loose = true;
+                blank = false;
+              }
+              s = SkipColumns(p, line_end, item.indent);
+              items.back().append(s, line_end - s);
+              items.back() += '\n';
+            } else if (indent < 4 && !IsThematicBreak(s, line_end) &&
+                       ParseListMarker(s, line_end, indent, marker) &&
+                       marker.ordered == first.ordered &&
+                       marker.delimiter == first.delimiter) {
+              if (blank) {
+                // A blank line between two items.
+                loose = true;
+                blank = false;
+              }
+              item = marker;
+              items.push_back(std::string());
+              items.back().assign(marker.content, line_end - marker.content);
+              items.back() += '\n';
+            } else if (!blank && !IsBlockStart(s, line_end, indent)) {
+              // A lazy paragraph continuation line.
+              items.back().append(s, line_end - s);
+              items.back() += '\n';
+            } else {
+              break;
+            }
+            p = next;
+          }
+
+          const char* name = first.ordered ? "ol" : "ul";
+          e_.Start(name);
+          if (first.ordered && first.start != 1)
+            e_.AddAttribute("start", std::to_string(first.start));
+          e_.EndStart();
+          for (auto i = items.begin(); i != items.end(); ++i) {
+            e_.Start("li");
+            e_.EndStart();
+            ParseBlocks(i->data(), i->data() + i->size(), depth + 1, !loose);
+            e_.End("li");
+          }
+          e_.End(name);
+          return p;
+        }
+
+        /// @brief Parse inline content and emit it.
+        void ParseInlines(const char* p, const char* end, size_t depth) {
+          // Searches for closing delimiters that failed. Later searches from
+          // further on would fail as well, so they are skipped to avoid
+          // quadratic run time on unmatched delimiters.
+          bool no_emphasis_end[4] = {false, false, false, false};
+          bool no_bracket = false;
+          LinkSearches link_searches;
+
+          const char* text = p;
+          while (p != end) {
+            char c = *p;
+            const char* q = p;
+            if (c == '\\') {
+              if (p + 1 != end && IsPunctuation(p[1])) {
+                EmitText(text, p);
+                text = p + 1;
+                p += 2;
+                continue;
+              }
+              if (p + 1 != end && p[1] == '\n') {
+                EmitText(text, p);
+                Void("br");
+                text = p + 1;
+                p += 2;
+                continue;
+              }
+            } else if (c == '\n') {
+              // Trailing spaces are stripped, and two or more make a hard
+              // line break.
+              while (q != text && q[-1] == ' ')
+                --q;
+              EmitText(text, q);
+              if (p - q >= 2)
+                Void("br");
+              text = p;
+              ++p;
+              // Leading spaces on the next line are stripped as well.
+              while (p != end && (*p == ' ' || *p == '\t'))
+                ++p;
+              EmitText(text, text + 1);
+              text = p;
+              continue;
+            } else if (c == '`') {
+              const char* close;
+              size_t n = RunLength(p, end, c);
+              if (FindCodeSpanEnd(p + n, end, n, close)) {
+                EmitText(text, p);
+                EmitCodeSpan(p + n, close);
+                p = text = close + n;
+                continue;
+              }
+              p += n;
+              continue;
+            } else if (c == '*' || c == '_') {
+              size_t n = RunLength(p, end, c);
+              if (depth < options_.max_depth && p + n != end &&
+                  !IsSpace(p[n]) &&
+                  (c == '*' || p == text || !IsAlnum(p[-1]))) {
+                bool* failed = no_emphasis_end + (c == '_' ? 2 : 0);
+                size_t k = n >= 2 ? 2 : 1;
+                const char* close = nullptr;
+                for (; k > 0 && !close; --k) {
+                  if (!failed[k - 1]) {
+                    close = FindEmphasisEnd(p + k, end, c, k);
+                    failed[k - 1] = !close;
+                  }
+                }
+                ++k;
+                if (close) {
+                  const char* name = k == 2 ? "strong" : "em";
+                  EmitText(text, p);
+                  e_.Start(name);
+                  e_.EndStart();
+                  ParseInlines(p + k, close, depth + 1);
+                  e_.End(name);
+                  p = text = close + k;
+                  continue;
+                }
+              }
+              p += n;
+              continue;
+            } else if (c == '[' || (c == '!' && p + 1 != end && p[1] == '[')) {
+              if (!no_bracket && !std::memchr(p, ']', end - p))
+                no_bracket = true;
+              if (depth < options_.max_depth && !no_bracket) {
+                const char* next =
+                    ParseLink(text, p, end, depth, link_searches);
+                if (next) {
+                  p = text = next;
+                  continue;
+                }
+              }
+              p += c == '!' ? 2 : 1;
+              continue;
+            }
+            ++p;
+          }
+          EmitText(text, end);
+        }
+
+        void EmitText(const char* begin, const char* end) {
+          if (begin != end)
+            e_.Text(begin, end - begin);
+        }
+
+        static size_t RunLength(const char* p, const char* end, char c) {
+          const char* q = p;
+          while (q != end && *q == c)
+            ++q;
+          return q - p;
+        }
+
+        /// @brief Find the closing backtick run of a code span.
+        static bool FindCodeSpanEnd(const char* p, const char* end, size_t n,
+                                    const char*& close) {
+          while (p != end) {
+            p = static_cast<const char*>(std::memchr(p, '`', end - p));
+            if (!p)
+              return false;
+            size_t run = RunLength(p, end, '`');
+            if (run == n) {
+              close = p;
+              return true;
+            }
+            p += run;
+          }
+          return false;
+        }
+
+        void EmitCodeSpan(const char* p, const char* end) {
+          // Strip one space from both ends, unless the span is all spaces.
+          if (end - p >= 2 && (*p == ' ' || *p == '\n') &&
+              (end[-1] == ' ' || end[-1] == '\n') &&
+              RunLength(p, end, ' ') != static_cast<size_t>(end - p)) {
+            ++p;
+            --end;
+          }
+          e_.Start("code");
+          e_.EndStart();
+          // Line breaks are written as spaces.
+          const char* text = p;
+          for (; p != end; ++p) {
+            if (*p == '\n') {
+              EmitText(text, p);
+              e_.Text(" ", 1);
+              text = p + 1;
+            }
+          }
+          EmitText(text, end);
+          e_.End("code");
+        }
+
+        /// @brief Find the closing delimiter run of an emphasis.
+        ///
+        /// A closing run has @c k delimiters, or at least three (it then
+        /// closes several emphases), and is not preceded by white space.
+        /// Escaped characters and code spans are skipped.
+        /// @returns The start of the last @c k delimiters of the closing
+        /// run, or nullptr if there is none.
+        static const char* FindEmphasisEnd(const char* p, const char* end,
+                                           char c, size_t k) {
+          const char* start = p;
+          while (p != end) {
+            if (*p == '\\') {
+              p += p + 1 != end ? 2 : 1;
+            } else if (*p == '`') {
+              const char* close;
+              size_t n = RunLength(p, end, '`');
+              p = FindCodeSpanEnd(p + n, end, n, close) ? close + n : p + n;
+            } else if (*p == c) {
+              size_t n = RunLength(p, end, c);
+              if (p != start && !IsSpace(p[-1]) && (n == k || n >= 3) &&
+                  (c == '*' || p + n == end || !IsAlnum(p[n])))
+                return p + n - k;
+              p += n;
+            } else {
+              ++p;
+            }
+          }
+          return nullptr;
+        }
+
+        /// @brief The results of the searches for the ends of link labels,
+        /// destinations and titles in one run of inline content.
+        ///
+        /// A search for a closing bracket (or parenthesis) passes over the
+        /// nested pairs, and a search from any of those would end where the
+        /// nested pair does, so that is recorded for them as well. A title
+        /// search that reaches the end fails from any later start as well.
+        /// Each bracket is therefore searched from only once, which keeps the
+        /// run time linear on unmatched or deeply nested brackets.
+        struct LinkSearches {
+          LinkSearches() {
+            no_title_end[0] = no_title_end[1] = no_title_end[2] = nullptr;
+          }
+
+          /// The closing bracket for each label start (nullptr if none).
+          std::unordered_map<const char*, const char*> label_ends;
+          /// The end of the destination for each destination start.
+          std::unordered_map<const char*, const char*> dest_ends;
+          /// The earliest start of a title search (for '"', '\'' and ')')
+          /// that failed, or nullptr.
+          const char* no_title_end[3];
+        };
+
+        /// @brief Find the closing bracket of a link label.
+        /// @param label The start of the label, after the opening bracket.
+        /// @returns The closing bracket, or nullptr if there is none.
+        static const char* FindLabelEnd(const char* label, const char* end,
+                                        LinkSearches& searches) {
+          auto found = searches.label_ends.find(label);
+          if (found != searches.label_ends.end())
+            return found->second;
+
+          // The starts of the labels whose brackets are open.
+          std::vector<const char*> open(1, label);
+          const char* q = label;
+          while (q != end) {
+            if (*q == '\\' && q + 1 != end) {
+              q += 2;
+              continue;
+            }
+            if (*q == '`') {
+              const char* close;
+              size_t n = RunLength(q, end, '`');
+              q = FindCodeSpanEnd(q + n, end, n, close) ? close + n : q + n;
+              continue;
+            }
+            if (*q == '[') {
+              open.push_back(q + 1);
+            } else if (*q == ']') {
+              searches.label_ends[open.back()] = q;
+              open.pop_back();
+              if (open.empty())
+                return q;
+            }
+            ++q;
+          }
+          for (auto i = open.begin(); i != open.end(); ++i)
+            searches.label_ends[*i] = nullptr;
+          return nullptr;
+        }
+
+        /// @brief Find the end of a link destination that is not in angle
+        /// brackets: white space, or a closing parenthesis that is not part
+        /// of a balanced pair.
+        static const char* FindDestinationEnd(const char* dest,
+                                              const char* end,
+                                              LinkSearches& searches) {
+          auto found = searches.dest_ends.find(dest);
+          if (found != searches.dest_ends.end())
+            return found->second;
+
+          // The starts of the destinations whose parentheses are open.
+          std::vector<const char*> open(1, dest);
+          const char* q = dest;
+          while (q != end && !IsSpace(*q)) {
+            if (*q == '(') {
+              open.push_back(q + 1);
+            } else if (*q == ')') {
+              if (open.size() == 1)
+                break;
+              searches.dest_ends[open.back()] = q;
+              open.pop_back();
+            }
+            q += *q == '\\' && q + 1 != end ? 2 : 1;
+          }
+          for (auto i = open.begin(); i != open.end(); ++i)
+            searches.dest_ends[*i] = q;
+          return q;
+        }
+
+        /// @brief Parse a link or image, and emit it with the text that
+        /// precedes it.
+        /// @param text The start of the pending text.
+        /// @param p The start of the link ('[') or image ('!').
+        /// @param searches The searches of earlier links in the same run of
+        /// inline content.
+        /// @returns The end of the link, or nullptr if there is no link.
+        const char* ParseLink(const char* text, const char* p,
+                              const char* end, size_t depth,
+                              LinkSearches& searches) {
+          bool image = *p == '!';
+          const char* label = p + (image ? 2 : 1);
+
+          // Find the matching closing bracket.
+          const char* label_end = FindLabelEnd(label, end, searches);
+          if (!label_end)
+            return nullptr;
+          const char* q = label_end + 1;
+          if (q == end || *q != '(')
+            return nullptr;
+
+          // Parse the destination and the optional title.
+          q = SkipSpace(q + 1, end);
+          const char* dest = q;
+          const char* dest_end;
+          if (q != end && *q == '<') {
+            dest = ++q;
+            while (q != end && *q != '>' && *q != '\n' && *q != '<')
+              q += *q == '\\' && q + 1 != end ? 2 : 1;
+            if (q == end || *q != '>')
+              return nullptr;
+            dest_end = q++;
+          } else {
+            q = dest_end = FindDestinationEnd(q, end, searches);
+          }
+          const char* title = nullptr;
+          const char* title_end = nullptr;
+          const char* after_dest = q;
+          q = SkipSpace(q, end);
+          if (q != end && q != after_dest &&
+              (*q == '"' || *q == '\'' || *q == '(')) {
+            char close = *q == '(' ? ')' : *q;
+            const char** failed = searches.no_title_end +
+                                  (close == '"' ? 0 : close == ')' ? 2 : 1);
+            title = ++q;
+            if (*failed && title >= *failed)
+              return nullptr;
+            while (q != end && *q != close)
+              q += *q == '\\' && q + 1 != end ? 2 : 1;
+            if (q == end) {
+              *failed = title;
+              return nullptr;
+            }
+            title_end = q++;
+            q = SkipSpace(q, end);
+          }
+          if (q == end || *q != ')')
+            return nullptr;
+
+          EmitText(text, p);
+          std::string url;
+          AppendUnescaped(dest, dest_end, url);
+          bool keep_url = !options_.safe_links || IsSafeUrl(url);
+          if (image) {
+            e_.Start("img");
+            if (keep_url)
+              e_.AddAttribute("src", url);
+            std::string alt;
+            AppendUnescaped(label, label_end, alt);
+            e_.AddAttribute("alt", alt);
+          } else {
+            e_.Start("a");
+            if (keep_url)
+              e_.AddAttribute("href", url);
+          }
+          if (title) {
+            std::string title_text;
+            AppendUnescaped(title, title_end, title_text);
+            e_.AddAttribute("title", title_text);
+          }
+          e_.EndStart();
+          if (image) {
+            e_.End("img");
+          } else {
+            ParseInlines(label, label_end, depth + 1);
+            e_.End("a");
+          }
+          return q + 1;
+        }
+
+        static const char* SkipSpace(const char* p, const char* end) {
+          while (p != end && IsSpace(*p))
+            ++p;
+          return p;
+        }
+
+        /// @brief Append a string with backslash escapes removed.
+        static void AppendUnescaped(const char* p, const char* end,
+                                    std::string& out) {
+          for (; p != end; ++p) {
+            if (*p == '\\' && p + 1 != end && IsPunctuation(p[1]))
+              ++p;
+            out += *p;
+          }
+        }
+
+        /// @brief Check if a URL is relative, or uses the http, https or
+        /// mailto scheme.
+        static bool IsSafeUrl(const std::string& url) {
+          size_t colon = url.find(':');
+          if (colon == std::string::npos ||
+              url.find_first_of("/?#") < colon)
+            return true;
+          std::string scheme;
+          for (size_t i = 0; i < colon; ++i) {
+            char c = url[i];
+            scheme += c >= 'A' && c <= 'Z' ? static_cast<char>(c + 32) : c;
+          }
+          return scheme == "http" || scheme == "https" || scheme == "mailto";
+        }
+
+        const MarkdownOptions& options_;
+        Emitter& e_;
+    };
+
+    const MarkdownOptions options_;
+};
+
+} // namespace htmlgen
+
+#endif // MARKDOWN_H_
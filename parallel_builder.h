@@ -0,0 +1,278 @@
+// -*- mode: c++; tab-width: 2; indent-tabs-mode: nil; -*-
+//----------------------------------------------------------------------------
+// Parallel construction of node trees.
+//----------------------------------------------------------------------------
+// This is free and unencumbered software released into the public domain.
+//
+// Anyone is free to copy, modify, publish, use, compile, sell, or
+// distribute this software, either in source code form or as a compiled
+// binary, for any purpose, commercial or non-commercial, and by any
+// means.
+//
+// In jurisdictions that recognize copyright laws, the author or authors
+// of this software dedicate any and all copyright interest in the
+// software to the public domain. We make this dedication for the benefit
+// of the public at large and to the detriment of our heirs and
+// successors. We intend this dedication to be an overt act of
+// relinquishment in perpetuity of all present and future rights to this
+// software under copyright law.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+// OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+// ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+//
+// For more information, please refer to <http://unlicense.org/>
+//----------------------------------------------------------------------------
+
+#ifndef PARALLEL_BUILDER_H_
+#define PARALLEL_BUILDER_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "document.h"
+
+namespace htmlgen {
+
+/// @brief A thread pool that runs parallel loops with work stealing.
+///
+/// Each thread (including the calling thread) starts with an equal share of
+/// the loop indices. When a thread runs out, it steals half of the remaining
+/// indices of another thread. Shares are packed in a single atomic word, so
+/// taking and stealing indices is lock-free.
+class WorkStealingPool {
+  public:
+    /// @param num_threads The number of threads that run a loop, including
+    /// the calling thread (0 means one per hardware thread).
+    explicit WorkStealingPool(size_t num_threads = 0) : invoke_(nullptr),
+        context_(nullptr), generation_(0), active_(0), stop_(false),
+        failed_(false) {
+      if (num_threads == 0)
+        num_threads = std::thread::hardware_concurrency();
+      if (num_threads == 0)
+        num_threads = 1;
+      shares_.reset(new Share[num_threads]);
+      num_shares_ = num_threads;
+      for (size_t i = 1; i < num_threads; ++i)
+        threads_.push_back(std::thread(&WorkStealingPool::WorkerMain, this, i));
+    }
+
+    ~WorkStealingPool() {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+      }
+      start_.notify_all();
+      for (auto i = threads_.begin(); i != threads_.end(); ++i)
+        i->join();
+    }
+
+    /// @brief Get the number of threads that run a loop.
+    size_t num_threads() const {
+      return num_shares_;
+    }
+
+    /// @brief Call @c function(i) for all i in [0, count), in parallel.
+    ///
+    /// Returns when all calls have returned. If a call throws, the remaining
+    /// calls are skipped and the first exception is rethrown. Loops may be
+    /// run from several threads, but they are run one at a time. The count
+    /// must be less than 2^32.
+    template <class Function>
+    void ParallelFor(size_t count, Function function) {
+      if (count == 0)
+        return;
+      std::lock_guard<std::mutex> run_lock(run_mutex_);
+      invoke_ = &Invoke<Function>;
+      context_ = &function;
+      failed_.store(false);
+      for (size_t i = 0; i < num_shares_; ++i) {
+        uint64_t begin = count * i / num_shares_;
+        uint64_t end = count * (i + 1) / num_shares_;
+        shares_[i].range.store(Pack(begin, end));
+      }
+
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        active_ = threads_.size();
+        ++generation_;
+      }
+      start_.notify_all();
+      Work(0);
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait(lock, [this]() { return active_ == 0; });
+      }
+
+      if (exception_) {
+        std::exception_ptr exception;
+        std::swap(exception, exception_);
+        std::rethrow_exception(exception);
+      }
+    }
+
+  private:
+    /// @brief A range of loop indices, packed as begin (low 32 bits) and end
+    /// (high 32 bits), padded to a cache line.
+    struct Share {
+      std::atomic<uint64_t> range;
+      char padding[64 - sizeof(std::atomic<uint64_t>)];
+    };
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    template <class Function>
+    static void Invoke(void* context, size_t index) {
+      (*static_cast<Function*>(context))(index);
+    }
+
+    static uint64_t Pack(uint64_t begin, uint64_t end) {
+      return begin | (end << 32);
+    }
+
+    void WorkerMain(size_t self) {
+      uint64_t seen = 0;
+      while (true) {
+        {
+          std::unique_lock<std::mutex> lock(mutex_);
+          start_.wait(lock,
+                      [this, seen]() { return stop_ || generation_ != seen; });
+          if (stop_)
+            return;
+          seen = generation_;
+        }
+        Work(self);
+        {
+          std::lock_guard<std::mutex> lock(mutex_);
+          if (--active_ == 0)
+            done_.notify_all();
+        }
+      }
+    }
+
+    /// @brief Run loop indices until there are none left.
+    void Work(size_t self) {
+      size_t index;
+      while (Take(self, index) || (Steal(self) && Take(self, index))) {
+        if (failed_.load(std::memory_order_relaxed))
+          continue;
+        try {
+          invoke_(context_, index);
+        } catch (...) {
+          std::lock_guard<std::mutex> lock(mutex_);
+          if (!exception_)
+            exception_ = std::current_exception();
+          failed_.store(true);
+        }
+      }
+    }
+
+    /// @brief Take the first index of a thread's own share.
+    bool Take(size_t self, size_t& index) {
+      std::atomic<uint64_t>& range = shares_[self].range;
+      uint64_t old = range.load();
+      while (true) {
+        uint64_t begin = old & 0xffffffffu;
+        uint64_t end = old >> 32;
+        if (begin >= end)
+          return false;
+        if (range.compare_exchange_weak(old, Pack(begin + 1, end))) {
+          index = static_cast<size_t>(begin);
+          return true;
+        }
+      }
+    }
+
+    /// @brief Steal the second half of another thread's share.
+    /// @returns false if all shares are empty.
+    bool Steal(size_t self) {
+      for (size_t i = 1; i < num_shares_; ++i) {
+        std::atomic<uint64_t>& victim = shares_[(self + i) % num_shares_].range;
+        uint64_t old = victim.load();
+        while (true) {
+          uint64_t begin = old & 0xffffffffu;
+          uint64_t end = old >> 32;
+          if (begin >= end)
+            break;
+          uint64_t middle = end - (end - begin + 1) / 2;
+          if (victim.compare_exchange_weak(old, Pack(begin, middle))) {
+            shares_[self].range.store(Pack(middle, end));
+            return true;
+          }
+        }
+      }
+      return false;
+    }
+
+    std::unique_ptr<Share[]> shares_;
+    size_t num_shares_;
+    std::vector<std::thread> threads_;
+
+    std::mutex run_mutex_;  // Serializes loops.
+    void (*invoke_)(void*, size_t);
+    void* context_;
+
+    std::mutex mutex_;
+    std::condition_variable start_;
+    std::condition_variable done_;
+    uint64_t generation_;
+    size_t active_;
+    bool stop_;
+    std::atomic<bool> failed_;
+    std::exception_ptr exception_;
+};
+
+/// @brief Build the children of an Element in parallel.
+///
+/// @c build(i, container) is called for all i in [0, count) on the threads of
+/// the pool, and adds the nodes of part i to a detached container Element of
+/// its own, so the calls share no data. Each container has the name and the
+/// ASCII-only mode of @c parent, so its children are created as they would
+/// be in @c parent (e.g. text in a "script" element is raw text). When all
+/// calls have returned, the nodes are moved to @c parent in order of i. The
+/// result is the same as calling @c build(i, parent) for each i in order.
+///
+/// @code{.cpp}
+///   htmlgen::WorkStealingPool pool;
+///   htmlgen::BuildChildrenInParallel(
+///       pool, report, customers.size(),
+///       [&](size_t i, htmlgen::Document::Element* container) {
+///         BuildCustomerSection(customers[i], container->AddChild("section"));
+///       });
+/// @endcode
+/// @param pool The thread pool.
+/// @param parent The Element that the nodes are added to.
+/// @param count The number of parts.
+/// @param build The function that builds a part.
+template <class Build>
+void BuildChildrenInParallel(WorkStealingPool& pool,
+                             Document::Element* parent, size_t count,
+                             Build build) {
+  std::vector<std::unique_ptr<Document::Element> > containers(count);
+  pool.ParallelFor(count, [parent, &containers, &build](size_t i) {
+    containers[i].reset(new Document::Element(parent->name()));
+    containers[i]->SetAsciiOnly(parent->ascii_only());
+    build(i, containers[i].get());
+  });
+  for (auto i = containers.begin(); i != containers.end(); ++i) {
+    if (!*i)
+      continue;
+    while (Document::Node* child = (*i)->first_child())
+      parent->MoveChild(child, nullptr);
+  }
+}
+
+} // namespace htmlgen
+
+#endif // PARALLEL_BUILDER_H_
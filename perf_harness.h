@@ -0,0 +1,920 @@
+// -*- mode: c++; tab-width: 2; indent-tabs-mode: nil; -*-
+//----------------------------------------------------------------------------
+// Benchmarks with hardware performance counters.
+//----------------------------------------------------------------------------
+// This is free and unencumbered software released into the public domain.
+//
+// Anyone is free to copy, modify, publish, use, compile, sell, or
+// distribute this software, either in source code form or as a compiled
+// binary, for any purpose, commercial or non-commercial, and by any
+// means.
+//
+// In jurisdictions that recognize copyright laws, the author or authors
+// of this software dedicate any and all copyright interest in the
+// software to the public domain. We make this dedication for the benefit
+// of the public at large and to the detriment of our heirs and
+// successors. We intend this dedication to be an overt act of
+// relinquishment in perpetuity of all present and future rights to this
+// software under copyright law.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+// OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+// ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+//
+// For more information, please refer to <http://unlicense.org/>
+//----------------------------------------------------------------------------
+
+#ifndef PERF_HARNESS_H_
+#define PERF_HARNESS_H_
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/perf_event.h>)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#if defined(__NR_perf_event_open)
+#define HTMLGEN_HAVE_PERF_EVENTS
+#endif
+#endif
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "csv_table.h"
+#include "document.h"
+#include "fd_sink.h"
+#include "file_node.h"
+#include "markdown.h"
+
+namespace htmlgen {
+
+/// @brief Hardware performance counters of the calling thread.
+///
+/// The counters are read through perf_event_open on Linux, counting user
+/// space only. They are opened as one group, so that they count over exactly
+/// the same time, and ratios such as instructions per cycle are consistent
+/// even when the kernel multiplexes the group with other events. Counters
+/// that can not be opened (e.g. on other systems, in virtual machines without
+/// a PMU, or when perf_event_paranoid forbids it) are reported as
+/// unavailable, while the wall time is always measured.
+class PerfCounters {
+  public:
+    enum Counter {
+      kCycles,
+      kInstructions,
+      kL1dMisses,    ///< L1 data cache read misses.
+      kLlcMisses,    ///< Last level cache read misses.
+      kBranchMisses,
+      kNumCounters
+    };
+
+    /// @brief The counts of a measurement.
+    struct Sample {
+      Sample() : wall_ns(0), available(0) {
+        for (int i = 0; i < kNumCounters; ++i)
+          values[i] = 0;
+      }
+
+      /// @brief Determine if a counter was measured.
+      bool has(Counter counter) const {
+        return (available & (1u << counter)) != 0;
+      }
+
+      double wall_ns;
+      double values[kNumCounters];
+      unsigned available;  ///< A bit for each measured Counter.
+    };
+
+    PerfCounters() : leader_(-1), group_size_(0) {
+      // The first counter that can be opened leads the group.
+      for (int i = 0; i < kNumCounters; ++i) {
+        fds_[i] = Open(static_cast<Counter>(i), leader_);
+        group_index_[i] = -1;
+        if (fds_[i] >= 0) {
+          if (leader_ < 0)
+            leader_ = fds_[i];
+          group_index_[i] = group_size_++;
+        }
+      }
+    }
+
+    ~PerfCounters() {
+#if defined(HTMLGEN_HAVE_PERF_EVENTS)
+      for (int i = 0; i < kNumCounters; ++i) {
+        if (fds_[i] >= 0)
+          close(fds_[i]);
+      }
+#endif
+    }
+
+    /// @brief Determine if a counter can be measured.
+    bool available(Counter counter) const {
+      return fds_[counter] >= 0;
+    }
+
+    /// @brief Get the name of a counter (as used in baseline files).
+    static const char* Name(Counter counter) {
+      static const char* const kNames[kNumCounters] = {
+          "cycles", "instructions", "l1d_misses", "llc_misses",
+          "branch_misses"};
+      return kNames[counter];
+    }
+
+    /// @brief Reset and start the counters.
+    void Start() {
+#if defined(HTMLGEN_HAVE_PERF_EVENTS)
+      if (leader_ >= 0) {
+        ioctl(leader_, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(leader_, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+      }
+#endif
+      start_ = std::chrono::steady_clock::now();
+    }
+
+    /// @brief Stop the counters and read them.
+    Sample Stop() {
+      Sample sample;
+      std::chrono::steady_clock::time_point stop =
+          std::chrono::steady_clock::now();
+#if defined(HTMLGEN_HAVE_PERF_EVENTS)
+      if (leader_ >= 0) {
+        ioctl(leader_, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+        // Number of counters, time enabled, time running, and the values in
+        // the order in which the counters were added to the group.
+        uint64_t data[3 + kNumCounters];
+        size_t size = (3 + group_size_) * sizeof(uint64_t);
+        if (read(leader_, data, size) == static_cast<ssize_t>(size) &&
+            data[0] == static_cast<uint64_t>(group_size_) && data[2]) {
+          // If the group was multiplexed with other events, scale it.
+          double scale = data[2] < data[1] ?
+              static_cast<double>(data[1]) / data[2] : 1;
+          for (int i = 0; i < kNumCounters; ++i) {
+            if (group_index_[i] < 0)
+              continue;
+            sample.values[i] =
+                static_cast<double>(data[3 + group_index_[i]]) * scale;
+            sample.available |= 1u << i;
+          }
+        }
+      }
+#endif
+      sample.wall_ns = static_cast<double>(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start_)
+              .count());
+      return sample;
+    }
+
+  private:
+    /// @brief Open a counter.
+    /// @param group_fd The group leader, or -1 to open a new group.
+    /// @returns The file descriptor, or -1.
+    static int Open(Counter counter, int group_fd) {
+#if defined(HTMLGEN_HAVE_PERF_EVENTS)
+      struct perf_event_attr attr;
+      std::memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      switch (counter) {
+      case kCycles:
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CPU_CYCLES;
+        break;
+      case kInstructions:
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+        break;
+      case kL1dMisses:
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_L1D |
+                      (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        break;
+      case kLlcMisses:
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_LL |
+                      (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        break;
+      default:
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+      }
+      // The members of a group are enabled and disabled with the leader.
+      attr.disabled = group_fd < 0;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                         PERF_FORMAT_TOTAL_TIME_RUNNING;
+      return static_cast<int>(
+          syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0));
+#else
+      (void)counter;
+      (void)group_fd;
+      return -1;
+#endif
+    }
+
+    int fds_[kNumCounters];
+    int group_index_[kNumCounters];  // The position in the group, or -1.
+    int leader_;                     // The group leader, or -1.
+    int group_size_;
+    std::chrono::steady_clock::time_point start_;
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+};
+
+/// @brief A benchmark harness that measures phases with PerfCounters, and
+/// compares them with a stored baseline.
+///
+/// Each phase is measured a number of times (repetitions), and the median
+/// of each counter is reported per iteration.
+///
+/// @code{.cpp}
+///   htmlgen::PerfHarness harness;
+///   htmlgen::MeasureDocumentPhases(harness, "catalog", 100, BuildCatalog);
+///   std::fputs(harness.Report().c_str(), stdout);
+///   if (harness.LoadBaseline("catalog.baseline")) {
+///     if (!harness.FindRegressions(0.05).empty())
+///       return 1;
+///   } else {
+///     harness.SaveBaseline("catalog.baseline");
+///   }
+/// @endcode
+class PerfHarness {
+  public:
+    /// @brief The median counts per iteration of a phase.
+    struct Result {
+      std::string phase;
+      PerfCounters::Sample per_iteration;
+    };
+
+    /// @brief A counter of a phase that got worse than its baseline.
+    struct Regression {
+      std::string phase;
+      std::string counter;  ///< A PerfCounters::Name(), or "wall_ns".
+      double baseline;
+      double current;
+    };
+
+    /// @param repetitions The number of times that each phase is measured.
+    explicit PerfHarness(int repetitions = 9) :
+        repetitions_(repetitions > 0 ? repetitions : 1) {}
+
+    /// @brief Measure a phase.
+    ///
+    /// Each repetition calls @c setup() without measuring it, and then
+    /// measures @c function(i) for i in [0, iterations).
+    /// @param phase The phase name (without white space).
+    /// @param iterations The number of iterations per repetition.
+    /// @param setup The setup function.
+    /// @param function The function to measure.
+    /// @returns The result.
+    template <class Setup, class Function>
+    const Result& Measure(const std::string& phase, size_t iterations,
+                          Setup setup, Function function) {
+      if (iterations == 0)
+        iterations = 1;
+      std::vector<PerfCounters::Sample> samples;
+      for (int r = 0; r < repetitions_; ++r) {
+        setup();
+        counters_.Start();
+        for (size_t i = 0; i < iterations; ++i)
+          function(i);
+        samples.push_back(counters_.Stop());
+      }
+
+      Result result;
+      result.phase = phase;
+      result.per_iteration = Median(samples, static_cast<double>(iterations));
+      for (auto i = results_.begin(); i != results_.end(); ++i) {
+        if (i->phase == phase) {
+          *i = result;
+          return *i;
+        }
+      }
+      results_.push_back(result);
+      return results_.back();
+    }
+
+    /// @brief Measure a phase that needs no setup.
+    template <class Function>
+    const Result& Measure(const std::string& phase, size_t iterations,
+                          Function function) {
+      return Measure(phase, iterations, []() {}, function);
+    }
+
+    /// @brief Get the results, in order of measurement.
+    const std::vector<Result>& results() const {
+      return results_;
+    }
+
+    /// @brief Get the counters.
+    const PerfCounters& counters() const {
+      return counters_;
+    }
+
+    /// @brief Format the results as a table, with changes relative to the
+    /// baseline if one is loaded.
+    std::string Report() const {
+      std::string out;
+      char line[256];
+      std::snprintf(line, sizeof(line),
+                    "%-24s %12s %14s %14s %6s %12s %12s %12s\n", "phase",
+                    "wall_ns", "cycles", "instructions", "ipc", "l1d_misses",
+                    "llc_misses", "branch_misses");
+      out += line;
+      for (auto i = results_.begin(); i != results_.end(); ++i) {
+        const PerfCounters::Sample& s = i->per_iteration;
+        std::snprintf(line, sizeof(line), "%-24s %12.0f", i->phase.c_str(),
+                      s.wall_ns);
+        out += line;
+        AppendValue(out, s, PerfCounters::kCycles, 14);
+        AppendValue(out, s, PerfCounters::kInstructions, 14);
+        if (s.has(PerfCounters::kCycles) &&
+            s.has(PerfCounters::kInstructions) &&
+            s.values[PerfCounters::kCycles] > 0) {
+          std::snprintf(line, sizeof(line), " %6.2f",
+                        s.values[PerfCounters::kInstructions] /
+                            s.values[PerfCounters::kCycles]);
+          out += line;
+        } else {
+          out += "      -";
+        }
+        AppendValue(out, s, PerfCounters::kL1dMisses, 12);
+        AppendValue(out, s, PerfCounters::kLlcMisses, 12);
+        AppendValue(out, s, PerfCounters::kBranchMisses, 12);
+        out += '\n';
+      }
+      return out;
+    }
+
+    /// @brief Save the results as a baseline file, with one
+    /// "phase counter value" line per measured counter.
+    /// @returns false if the file could not be written.
+    bool SaveBaseline(const std::string& path) const {
+      std::ofstream out(path.c_str());
+      out.precision(17);
+      for (auto i = results_.begin(); i != results_.end(); ++i) {
+        const PerfCounters::Sample& s = i->per_iteration;
+        out << i->phase << " wall_ns " << s.wall_ns << '\n';
+        for (int c = 0; c < PerfCounters::kNumCounters; ++c) {
+          PerfCounters::Counter counter = static_cast<PerfCounters::Counter>(c);
+          if (s.has(counter))
+            out << i->phase << ' ' << PerfCounters::Name(counter) << ' '
+                << s.values[c] << '\n';
+        }
+      }
+      out.close();
+      return !out.fail();
+    }
+
+    /// @brief Load a baseline file that was written by SaveBaseline().
+    /// @returns false if the file could not be read or is malformed.
+    bool LoadBaseline(const std::string& path) {
+      baseline_.clear();
+      std::ifstream in(path.c_str());
+      if (!in)
+        return false;
+      std::string phase, counter;
+      double value;
+      while (in >> phase >> counter >> value)
+        baseline_[phase + ' ' + counter] = value;
+      if (!in.eof()) {
+        baseline_.clear();
+        return false;
+      }
+      return true;
+    }
+
+    /// @brief Find the counters that are more than a threshold above their
+    /// baseline (all counters are better when lower).
+    /// @param threshold The allowed relative increase (e.g. 0.05 for 5%).
+    /// @returns The regressions, which are empty if no baseline is loaded.
+    std::vector<Regression> FindRegressions(double threshold) const {
+      std::vector<Regression> regressions;
+      for (auto i = results_.begin(); i != results_.end(); ++i) {
+        const PerfCounters::Sample& s = i->per_iteration;
+        CheckRegression(i->phase, "wall_ns", s.wall_ns, threshold,
+                        regressions);
+        for (int c = 0; c < PerfCounters::kNumCounters; ++c) {
+          PerfCounters::Counter counter = static_cast<PerfCounters::Counter>(c);
+          if (s.has(counter))
+            CheckRegression(i->phase, PerfCounters::Name(counter),
+                            s.values[c], threshold, regressions);
+        }
+      }
+      return regressions;
+    }
+
+  private:
+    static PerfCounters::Sample Median(
+        const std::vector<PerfCounters::Sample>& samples, double iterations) {
+      PerfCounters::Sample result;
+      std::vector<double> values;
+      for (auto i = samples.begin(); i != samples.end(); ++i)
+        values.push_back(i->wall_ns);
+      result.wall_ns = MedianOf(values) / iterations;
+      for (int c = 0; c < PerfCounters::kNumCounters; ++c) {
+        PerfCounters::Counter counter = static_cast<PerfCounters::Counter>(c);
+        values.clear();
+        for (auto i = samples.begin(); i != samples.end(); ++i) {
+          if (i->has(counter))
+            values.push_back(i->values[c]);
+        }
+        // Only report counters that were read in every repetition.
+        if (values.size() == samples.size()) {
+          result.values[c] = MedianOf(values) / iterations;
+          result.available |= 1u << c;
+        }
+      }
+      return result;
+    }
+
+    static double MedianOf(std::vector<double>& values) {
+      std::sort(values.begin(), values.end());
+      size_t n = values.size();
+      return n % 2 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2;
+    }
+
+    static void AppendValue(std::string& out, const PerfCounters::Sample& s,
+                            PerfCounters::Counter counter, int width) {
+      char field[64];
+      if (s.has(counter))
+        std::snprintf(field, sizeof(field), " %*.0f", width, s.values[counter]);
+      else
+        std::snprintf(field, sizeof(field), " %*s", width, "-");
+      out += field;
+    }
+
+    void CheckRegression(const std::string& phase, const char* counter,
+                         double value, double threshold,
+                         std::vector<Regression>& regressions) const {
+      auto i = baseline_.find(phase + ' ' + counter);
+      if (i == baseline_.end() || value <= i->second * (1 + threshold))
+        return;
+      Regression regression;
+      regression.phase = phase;
+      regression.counter = counter;
+      regression.baseline = i->second;
+      regression.current = value;
+      regressions.push_back(regression);
+    }
+
+    int repetitions_;
+    PerfCounters counters_;
+    std::vector<Result> results_;
+    std::map<std::string, double> baseline_;  // "phase counter" -> value.
+};
+
+namespace internal {
+
+/// @brief Undo the escaping of TextNode and Attribute.
+inline std::string UnescapeForBenchmark(const std::string& escaped) {
+  static const char* const kReferences[] = {"&amp;", "&lt;", "&gt;", "&#34;"};
+  static const char kChars[] = {'&', '<', '>', '"'};
+  std::string out;
+  for (size_t i = 0; i < escaped.size();) {
+    size_t r = 0;
+    while (r < 4 && escaped.compare(i, std::strlen(kReferences[r]),
+                                    kReferences[r]) != 0)
+      ++r;
+    if (r < 4) {
+      out += kChars[r];
+      i += std::strlen(kReferences[r]);
+    } else {
+      out += escaped[i++];
+    }
+  }
+  return out;
+}
+
+/// @brief A Sink that passes HTML on to an FdSink, but not file regions, so
+/// that files are copied through the Writer (see MeasureFileSending()).
+class CopyingSink : public Document::Sink {
+  public:
+    explicit CopyingSink(Document::Sink& target) : target_(target) {}
+
+    virtual void Write(const char* data, size_t len) {
+      target_.Write(data, len);
+    }
+
+  private:
+    Document::Sink& target_;
+};
+
+/// @brief The void element check that StandardNames replaced: a binary
+/// search with strcmp over the void element names.
+inline bool IsVoidByBinarySearch(const char* name) {
+  static const char* const kVoidNames[] = {
+      "area", "base", "br", "col", "embed", "hr", "img", "input",
+      "keygen", "link", "meta", "param", "source", "track", "wbr"};
+  int imin = 0, imax = sizeof(kVoidNames) / sizeof(kVoidNames[0]) - 1;
+  while (imax >= imin) {
+    int imid = (imin + imax) / 2;
+    int diff = std::strcmp(kVoidNames[imid], name);
+    if (diff == 0)
+      return true;
+    if (diff < 0)
+      imin = imid + 1;
+    else
+      imax = imid - 1;
+  }
+  return false;
+}
+
+} // namespace internal
+
+/// @brief Measure the build, escape and serialize phases of a document.
+///
+/// The phases are named "<prefix>.build", "<prefix>.escape" and
+/// "<prefix>.serialize":
+/// - build: @c build(doc) on a new Document (destruction is not measured).
+/// - escape: escaping the text and attribute values of the document, as
+///   done when they are added.
+/// - serialize: Document::GetHTML() into a string with reserved capacity.
+/// @param harness The harness.
+/// @param prefix The prefix of the phase names.
+/// @param iterations The number of iterations per repetition.
+/// @param build A function that builds a document, called as
+/// @c build(Document&).
+template <class Build>
+void MeasureDocumentPhases(PerfHarness& harness, const std::string& prefix,
+                           size_t iterations, Build build) {
+  std::vector<std::unique_ptr<Document> > docs;
+  harness.Measure(
+      prefix + ".build", iterations,
+      [&docs, iterations]() {
+        docs.clear();
+        docs.resize(iterations);
+      },
+      [&docs, &build](size_t i) {
+        docs[i].reset(new Document());
+        build(*docs[i]);
+      });
+
+  // Collect the unescaped strings, excluding the content of raw text
+  // elements (which is not escaped).
+  Document doc;
+  build(doc);
+  std::vector<std::string> texts, values;
+  Document::PreOrderIterator end;
+  for (Document::PreOrderIterator i(doc.root()); i != end; ++i) {
+    if ((*i)->type() == Document::Node::kElement) {
+      const Document::Element* element =
+          static_cast<const Document::Element*>(*i);
+      for (auto a = element->attributes().begin();
+           a != element->attributes().end(); ++a)
+        values.push_back(internal::UnescapeForBenchmark(a->escaped_value()));
+    } else if ((*i)->type() == Document::Node::kText &&
+               !(*i)->parent()->IsRawTextElement()) {
+      texts.push_back(internal::UnescapeForBenchmark(
+          static_cast<const Document::TextNode*>(*i)->escaped_value()));
+    }
+  }
+  std::string out;
+  harness.Measure(prefix + ".escape", iterations,
+                  [&out, &texts, &values](size_t) {
+    out.clear();
+    for (auto i = texts.begin(); i != texts.end(); ++i)
+      Document::TextNode::AppendEscaped(i->data(), i->size(), out);
+    for (auto i = values.begin(); i != values.end(); ++i)
+      Document::Attribute::AppendEscaped(i->data(), i->size(), out);
+  });
+
+  doc.GetHTML(out);
+  out.reserve(out.size() * 2);
+  harness.Measure(prefix + ".serialize", iterations, [&out, &doc](size_t) {
+    out.clear();
+    doc.GetHTML(out);
+  });
+}
+
+/// @brief Measure the lookup of standard names with the perfect hash of
+/// internal::StandardNames, against a binary search.
+///
+/// An iteration looks up each standard tag name, and a few custom element
+/// names. The phases are:
+/// - "<prefix>.void_binary_search": the void element check as a binary search
+///   with strcmp over the void element names (as done before StandardNames).
+/// - "<prefix>.void_perfect_hash": the same check with StandardNames.
+/// - "<prefix>.id_binary_search": finding the ID of a name with a binary
+///   search over all standard names.
+/// - "<prefix>.id_perfect_hash": the same with StandardNames::Find().
+/// @param harness The harness.
+/// @param prefix The prefix of the phase names.
+/// @param iterations The number of iterations per repetition.
+inline void MeasureStandardNameLookup(PerfHarness& harness,
+                                      const std::string& prefix,
+                                      size_t iterations) {
+  typedef internal::StandardNames StandardNames;
+  std::vector<std::string> names;
+  std::vector<std::pair<std::string, int> > sorted;
+  for (int i = 0; i < StandardNames::kCount; ++i) {
+    if (StandardNames::Flags(i) & StandardNames::kTag)
+      names.push_back(StandardNames::Name(i));
+    sorted.push_back(std::make_pair(std::string(StandardNames::Name(i)), i));
+  }
+  std::sort(sorted.begin(), sorted.end());
+  names.push_back("x-widget");
+  names.push_back("my-component");
+  names.push_back("app-root");
+
+  // The results are summed up, so that the lookups are not optimized away.
+  volatile size_t sink = 0;
+  harness.Measure(prefix + ".void_binary_search", iterations,
+                  [&names, &sink](size_t) {
+    size_t count = 0;
+    for (auto i = names.begin(); i != names.end(); ++i)
+      count += internal::IsVoidByBinarySearch(i->c_str());
+    sink = sink + count;
+  });
+  harness.Measure(prefix + ".void_perfect_hash", iterations,
+                  [&names, &sink](size_t) {
+    size_t count = 0;
+    for (auto i = names.begin(); i != names.end(); ++i) {
+      int id = StandardNames::Find(i->data(), i->size());
+      count += id >= 0 && (StandardNames::Flags(id) & StandardNames::kVoid);
+    }
+    sink = sink + count;
+  });
+  harness.Measure(prefix + ".id_binary_search", iterations,
+                  [&names, &sorted, &sink](size_t) {
+    size_t sum = 0;
+    for (auto i = names.begin(); i != names.end(); ++i) {
+      auto found = std::lower_bound(sorted.begin(), sorted.end(),
+                                    std::make_pair(*i, -1));
+      if (found != sorted.end() && found->first == *i)
+        sum += static_cast<size_t>(found->second);
+    }
+    sink = sink + sum;
+  });
+  harness.Measure(prefix + ".id_perfect_hash", iterations,
+                  [&names, &sink](size_t) {
+    size_t sum = 0;
+    for (auto i = names.begin(); i != names.end(); ++i) {
+      int id = StandardNames::Find(i->data(), i->size());
+      if (id >= 0)
+        sum += static_cast<size_t>(id);
+    }
+    sink = sink + sum;
+  });
+}
+
+/// @brief Measure the throughput of the name table (see
+/// internal::NameTable), from one and from several threads.
+///
+/// An iteration interns each of a set of names once. The phases are:
+/// - "<prefix>.intern_standard": standard names (found by StandardNames).
+/// - "<prefix>.intern_custom": custom element names that are already in the
+///   table (found without a lock).
+/// - "<prefix>.intern_custom_mt": the same, while @c num_threads - 1 other
+///   threads intern the same names as many times. The counters only count the
+///   calling thread, but the wall time covers all of the threads.
+/// @param harness The harness.
+/// @param prefix The prefix of the phase names.
+/// @param num_threads The number of threads in the last phase.
+/// @param iterations The number of iterations per repetition.
+inline void MeasureNameInterning(PerfHarness& harness,
+                                 const std::string& prefix,
+                                 size_t num_threads, size_t iterations) {
+  std::vector<std::string> standard, custom;
+  for (int i = 0; i < internal::StandardNames::kCount; ++i)
+    standard.push_back(internal::StandardNames::Name(i));
+  for (int i = 0; i < 256; ++i) {
+    custom.push_back("x-widget-" + std::to_string(i));
+    internal::NameTable::Intern(custom.back());
+  }
+
+  harness.Measure(prefix + ".intern_standard", iterations,
+                  [&standard](size_t) {
+    for (auto i = standard.begin(); i != standard.end(); ++i)
+      internal::NameTable::Intern(*i);
+  });
+  auto intern_custom = [&custom]() {
+    for (auto i = custom.begin(); i != custom.end(); ++i)
+      internal::NameTable::Intern(*i);
+  };
+  harness.Measure(prefix + ".intern_custom", iterations,
+                  [&intern_custom](size_t) { intern_custom(); });
+
+  // The other threads are started before the measurement, and wait for the
+  // first iteration.
+  std::vector<std::thread> threads;
+  std::atomic<bool> go(false);
+  harness.Measure(
+      prefix + ".intern_custom_mt", iterations,
+      [&]() {
+        go.store(false);
+        for (size_t t = 1; t < num_threads; ++t) {
+          threads.push_back(std::thread([&go, &intern_custom, iterations]() {
+            while (!go.load())
+              std::this_thread::yield();
+            for (size_t i = 0; i < iterations; ++i)
+              intern_custom();
+          }));
+        }
+      },
+      [&](size_t i) {
+        if (i == 0)
+          go.store(true);
+        intern_custom();
+        if (i + 1 == iterations) {
+          for (auto t = threads.begin(); t != threads.end(); ++t)
+            t->join();
+          threads.clear();
+        }
+      });
+}
+
+/// @brief Measure the throughput of CsvTableConverter on generated data.
+///
+/// The data has @c rows rows of eight fields: numbers, words, a quoted field
+/// with a delimiter and doubled quotes, and text with characters that need
+/// escaping and non-ASCII characters. An iteration converts all of it, and
+/// the HTML is passed to a consumer that only counts it. The phases are:
+/// - "<prefix>.csv_table": the default options.
+/// - "<prefix>.csv_table_ascii": ASCII-only mode.
+///
+/// The throughput in MB/s is the returned input size divided by the
+/// wall_ns of a phase, times 1000.
+/// @param harness The harness.
+/// @param prefix The prefix of the phase names.
+/// @param rows The number of rows.
+/// @param iterations The number of iterations per repetition.
+/// @returns The size of the input, in bytes.
+inline size_t MeasureCsvTable(PerfHarness& harness, const std::string& prefix,
+                              size_t rows, size_t iterations) {
+  std::string csv = "id,name,price,stock,description,tags,city,note\n";
+  for (size_t i = 0; i < rows; ++i) {
+    std::string n = std::to_string(i);
+    csv += n + ",Product " + n + "," + std::to_string(i % 997) + ".99," +
+           std::to_string(i % 13) +
+           ",\"A \"\"quoted\"\" text, with a comma\",red blue green," +
+           (i % 4 ? "Z\xc3\xbcrich" : "Montr\xc3\xa9" "al") +
+           ",Fish & chips <b>for</b> two\n";
+  }
+
+  volatile size_t sink = 0;
+  CsvTableOptions options;
+  CsvTableConverter converter(options);
+  harness.Measure(prefix + ".csv_table", iterations,
+                  [&csv, &converter, &sink](size_t) {
+    size_t total = 0;
+    converter.Convert(csv.data(), csv.size(),
+                      [&total](const char*, size_t len) { total += len; });
+    sink = sink + total;
+  });
+  options.ascii_only = true;
+  CsvTableConverter ascii_converter(options);
+  harness.Measure(prefix + ".csv_table_ascii", iterations,
+                  [&csv, &ascii_converter, &sink](size_t) {
+    size_t total = 0;
+    ascii_converter.Convert(
+        csv.data(), csv.size(),
+        [&total](const char*, size_t len) { total += len; });
+    sink = sink + total;
+  });
+  return csv.size();
+}
+
+/// @brief Measure MarkdownConverter on a large generated document.
+///
+/// The document has @c sections sections, each with a heading, paragraphs
+/// with emphasis, code spans, links and characters that need escaping, a
+/// list, a block quote and a fenced code block. The phases are:
+/// - "<prefix>.markdown_render": MarkdownConverter::Render() into a string
+///   with reserved capacity.
+/// - "<prefix>.markdown_tree": MarkdownConverter::Convert() into the root
+///   of a new Document (destruction is not measured).
+///
+/// The throughput in MB/s is the returned input size divided by the
+/// wall_ns of a phase, times 1000.
+/// @param harness The harness.
+/// @param prefix The prefix of the phase names.
+/// @param sections The number of sections.
+/// @param iterations The number of iterations per repetition.
+/// @returns The size of the input, in bytes.
+inline size_t MeasureMarkdown(PerfHarness& harness, const std::string& prefix,
+                              size_t sections, size_t iterations) {
+  std::string markdown;
+  for (size_t i = 0; i < sections; ++i) {
+    std::string n = std::to_string(i);
+    markdown += "## Section " + n + "\n\n"
+        "Some *emphasized* and **strong** text with `code` and a "
+        "[link](https://example.com/" + n + " \"Title\"), and 1 < 2 & 3 > 2."
+        "\nA second line of the paragraph, with an ![image](/i/" + n +
+        ".png).\n\n"
+        "- First item\n- Second item with _emphasis_\n- Third item\n\n"
+        "> A quoted paragraph\n> over two lines.\n\n"
+        "```cpp\nint main() { return x < y && y > z; }\n```\n\n";
+  }
+
+  MarkdownConverter converter;
+  std::string out;
+  converter.Render(markdown.data(), markdown.size(), out);
+  out.reserve(out.size() * 2);
+  harness.Measure(prefix + ".markdown_render", iterations,
+                  [&markdown, &converter, &out](size_t) {
+    out.clear();
+    converter.Render(markdown.data(), markdown.size(), out);
+  });
+
+  std::vector<std::unique_ptr<Document> > docs;
+  harness.Measure(
+      prefix + ".markdown_tree", iterations,
+      [&docs, iterations]() {
+        docs.clear();
+        docs.resize(iterations);
+      },
+      [&docs, &markdown, &converter](size_t i) {
+        docs[i].reset(new Document());
+        converter.Convert(markdown.data(), markdown.size(), docs[i]->root());
+      });
+  return markdown.size();
+}
+
+/// @brief Measure the output of a page with file assets through an FdSink,
+/// with the files sent in the kernel and with the files copied.
+///
+/// The page has a section with a heading and a raw FileNode for each asset
+/// (e.g. pre-rendered HTML or SVG). It is written to a pipe, which another
+/// thread drains. The phases are:
+/// - "<prefix>.send_file": the FdSink transfers the files with splice (or
+///   sendfile), so their content never enters user space.
+/// - "<prefix>.copy_file": the files are appended to the Writer's buffer and
+///   written with write, as with a Sink that can not transfer files.
+///
+/// The counters only count the calling thread, which is where the copies are
+/// saved.
+/// @param harness The harness.
+/// @param prefix The prefix of the phase names.
+/// @param asset_paths The asset files (files that can not be mapped are
+/// left out).
+/// @param iterations The number of iterations per repetition.
+/// @returns The size of the page, in bytes.
+inline size_t MeasureFileSending(PerfHarness& harness,
+                                 const std::string& prefix,
+                                 const std::vector<std::string>& asset_paths,
+                                 size_t iterations) {
+  Document doc;
+  Document::Element* body = doc.root()->AddChild("body");
+  for (auto i = asset_paths.begin(); i != asset_paths.end(); ++i) {
+    Document::Element* section = body->AddChild("section");
+    section->AddChild("h2")->AddTextChild(*i);
+    AddFileChild(section->AddChild("div"), i->c_str(), FileNode::kRaw);
+  }
+  std::string html;
+  doc.GetHTML(html);
+
+  int fds[2];
+  if (::pipe(fds) != 0)
+    return 0;
+  std::thread drain([&fds]() {
+    char buffer[64 * 1024];
+    while (::read(fds[0], buffer, sizeof(buffer)) > 0) {
+    }
+  });
+
+  FdSink sink(fds[1]);
+  internal::CopyingSink copying_sink(sink);
+  std::string buffer;
+  buffer.reserve(64 * 1024);
+  harness.Measure(prefix + ".send_file", iterations,
+                  [&doc, &sink, &buffer](size_t) {
+    Document::Writer writer(buffer);
+    writer.SetSink(&sink);
+    doc.Write(writer);
+  });
+  harness.Measure(prefix + ".copy_file", iterations,
+                  [&doc, &copying_sink, &buffer](size_t) {
+    Document::Writer writer(buffer);
+    writer.SetSink(&copying_sink);
+    doc.Write(writer);
+  });
+
+  ::close(fds[1]);
+  drain.join();
+  ::close(fds[0]);
+  return html.size();
+}
+
+} // namespace htmlgen
+
+#endif // PERF_HARNESS_H_
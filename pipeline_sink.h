@@ -0,0 +1,293 @@
+// -*- mode: c++; tab-width: 2; indent-tabs-mode: nil; -*-
+//----------------------------------------------------------------------------
+// A Sink that writes on a background thread.
+//----------------------------------------------------------------------------
+// This is free and unencumbered software released into the public domain.
+//
+// Anyone is free to copy, modify, publish, use, compile, sell, or
+// distribute this software, either in source code form or as a compiled
+// binary, for any purpose, commercial or non-commercial, and by any
+// means.
+//
+// In jurisdictions that recognize copyright laws, the author or authors
+// of this software dedicate any and all copyright interest in the
+// software to the public domain. We make this dedication for the benefit
+// of the public at large and to the detriment of our heirs and
+// successors. We intend this dedication to be an overt act of
+// relinquishment in perpetuity of all present and future rights to this
+// software under copyright law.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+// OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+// ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+//
+// For more information, please refer to <http://unlicense.org/>
+//----------------------------------------------------------------------------
+
+#ifndef PIPELINE_SINK_H_
+#define PIPELINE_SINK_H_
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "document.h"
+
+namespace htmlgen {
+
+/// @brief A Sink that passes the HTML on to another Sink from a background
+/// thread, so that serialization and writing overlap.
+///
+/// The HTML is collected in a ring of fixed size buffers. The serializing
+/// thread fills one buffer while the writer thread passes the previous ones
+/// to the target Sink. The ring is a single producer, single consumer queue
+/// with atomic indices. A thread only sleeps (on a condition variable) when
+/// the ring is full or empty, so a steady stream of buffers needs no locks.
+///
+/// File regions (see Sink::WriteFile()) are queued in order with the HTML,
+/// and are passed to the target Sink on the writer thread. The descriptor is
+/// duplicated when the region is queued, so the caller may close the file
+/// right after writing.
+///
+/// Errors are sticky: after a write of the target Sink fails (see
+/// Sink::error()), or a file region can not be read, further output is
+/// dropped and ok() returns false.
+///
+/// @code{.cpp}
+///   htmlgen::FdSink socket_sink(client_socket);
+///   htmlgen::PipelineSink sink(socket_sink);
+///   std::string buffer;
+///   htmlgen::Document::Writer writer(buffer);
+///   writer.SetSink(&sink, htmlgen::PipelineSink::kDefaultBufferSize);
+///   doc.Write(writer);
+///   sink.Finish();
+///   if (!sink.ok())
+///     perror("write");
+/// @endcode
+class PipelineSink : public Document::Sink {
+  public:
+    static const size_t kDefaultBufferSize = 64 * 1024;
+
+    /// @param target The Sink that the HTML is passed on to. It is only
+    /// called from the writer thread.
+    /// @param num_buffers The number of buffers in the ring (at least 2).
+    /// @param buffer_size The size of each buffer.
+    explicit PipelineSink(Document::Sink& target, size_t num_buffers = 4,
+                          size_t buffer_size = kDefaultBufferSize) :
+        target_(target), slots_(num_buffers < 2 ? 2 : num_buffers),
+        buffer_size_(buffer_size ? buffer_size : 1), head_(0), tail_(0),
+        error_(0), stop_(false), producer_waiting_(false),
+        consumer_waiting_(false) {
+      for (auto i = slots_.begin(); i != slots_.end(); ++i) {
+        i->data.resize(buffer_size_);
+        i->size = 0;
+        i->file_fd = -1;
+      }
+      thread_ = std::thread(&PipelineSink::Run, this);
+    }
+
+    /// @brief Write the remaining HTML, and stop the writer thread.
+    virtual ~PipelineSink() {
+      Finish();
+      stop_.store(true);
+      Wake(consumer_waiting_);
+      thread_.join();
+    }
+
+    virtual void Write(const char* data, size_t len) {
+      if (error_.load() != 0)
+        return;
+      while (len > 0) {
+        Slot& slot = AcquireSlot();
+        size_t n = buffer_size_ - slot.size;
+        if (n > len)
+          n = len;
+        std::memcpy(&slot.data[slot.size], data, n);
+        slot.size += n;
+        data += n;
+        len -= n;
+        if (slot.size == buffer_size_)
+          Publish();
+      }
+    }
+
+    virtual bool WriteFile(int fd, uint64_t offset, size_t len) {
+      if (error_.load() != 0)
+        return true;  // The output is dropped.
+      int file_fd = ::fcntl(fd, F_DUPFD_CLOEXEC, 0);
+      if (file_fd < 0)
+        return false;
+      if (AcquireSlot().size > 0)
+        Publish();
+      Slot& slot = AcquireSlot();
+      slot.file_fd = file_fd;
+      slot.file_offset = offset;
+      slot.file_len = len;
+      Publish();
+      return true;
+    }
+
+    /// @brief Wait until all HTML has been passed to the target Sink.
+    void Finish() {
+      size_t tail = tail_.load(std::memory_order_relaxed);
+      if (tail - head_.load() < slots_.size() &&
+          slots_[tail % slots_.size()].size > 0)
+        Publish();
+      WaitFor(producer_waiting_, [this]() {
+        return head_.load() == tail_.load(std::memory_order_relaxed);
+      });
+    }
+
+    /// @brief Check if all output has been written. Call Finish() first to
+    /// include the output that is still queued.
+    bool ok() const {
+      return error_.load() == 0;
+    }
+
+    /// @brief Get the error number of the failed write or read, or 0.
+    virtual int error() const {
+      return error_.load();
+    }
+
+  private:
+    /// @brief A buffer of HTML, or a file region.
+    struct Slot {
+      std::vector<char> data;
+      size_t size;
+      int file_fd;  // -1 for HTML, otherwise a descriptor that we own.
+      uint64_t file_offset;
+      size_t file_len;
+    };
+
+    static const int kSpinCount = 64;
+
+    PipelineSink(const PipelineSink&) = delete;
+    PipelineSink& operator=(const PipelineSink&) = delete;
+
+    /// @brief Get the slot that is being filled, waiting for the writer
+    /// thread if the ring is full.
+    Slot& AcquireSlot() {
+      size_t tail = tail_.load(std::memory_order_relaxed);
+      if (tail - head_.load(std::memory_order_acquire) == slots_.size()) {
+        WaitFor(producer_waiting_, [this, tail]() {
+          return tail - head_.load() < slots_.size();
+        });
+      }
+      return slots_[tail % slots_.size()];
+    }
+
+    /// @brief Pass the slot that is being filled to the writer thread.
+    void Publish() {
+      tail_.store(tail_.load(std::memory_order_relaxed) + 1);
+      Wake(consumer_waiting_);
+    }
+
+    /// @brief The writer thread.
+    void Run() {
+      size_t head = head_.load(std::memory_order_relaxed);
+      while (true) {
+        if (tail_.load(std::memory_order_acquire) == head) {
+          WaitFor(consumer_waiting_, [this, head]() {
+            return tail_.load() != head || stop_.load();
+          });
+          if (tail_.load(std::memory_order_acquire) == head)
+            return;  // Stopped.
+        }
+
+        Slot& slot = slots_[head % slots_.size()];
+        if (error_.load() == 0) {
+          if (slot.file_fd < 0) {
+            target_.Write(slot.data.data(), slot.size);
+          } else if (!target_.WriteFile(slot.file_fd, slot.file_offset,
+                                        slot.file_len)) {
+            CopyFile(slot);
+          }
+          if (error_.load() == 0 && target_.error() != 0)
+            error_.store(target_.error());
+        }
+        if (slot.file_fd >= 0) {
+          ::close(slot.file_fd);
+          slot.file_fd = -1;
+        }
+        slot.size = 0;
+        head_.store(++head);
+        Wake(producer_waiting_);
+      }
+    }
+
+    /// @brief Pass a file region to the target Sink through a buffer.
+    void CopyFile(Slot& slot) {
+      uint64_t offset = slot.file_offset;
+      size_t len = slot.file_len;
+      while (len > 0 && target_.error() == 0) {
+        size_t chunk = len < buffer_size_ ? len : buffer_size_;
+        ssize_t n = ::pread(slot.file_fd, slot.data.data(), chunk,
+                            static_cast<off_t>(offset));
+        if (n < 0 && errno == EINTR)
+          continue;
+        if (n <= 0) {
+          // A read error, or the file is shorter than expected.
+          error_.store(n < 0 ? errno : EIO);
+          return;
+        }
+        target_.Write(slot.data.data(), static_cast<size_t>(n));
+        offset += static_cast<uint64_t>(n);
+        len -= static_cast<size_t>(n);
+      }
+    }
+
+    /// @brief Wait until a condition is true, first by spinning, then by
+    /// sleeping until woken by the other thread.
+    template <class Predicate>
+    void WaitFor(std::atomic<bool>& waiting, Predicate ready) {
+      for (int i = 0; i < kSpinCount; ++i) {
+        if (ready())
+          return;
+        std::this_thread::yield();
+      }
+      std::unique_lock<std::mutex> lock(mutex_);
+      waiting.store(true);
+      condition_.wait(lock, ready);
+      waiting.store(false);
+    }
+
+    /// @brief Wake the other thread if it is sleeping.
+    ///
+    /// The index updates and the waiting flags are sequentially consistent,
+    /// so either the waiting thread sees the update, or this sees the flag.
+    void Wake(std::atomic<bool>& waiting) {
+      if (waiting.load()) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        condition_.notify_all();
+      }
+    }
+
+    Document::Sink& target_;
+    std::vector<Slot> slots_;
+    const size_t buffer_size_;
+    std::atomic<size_t> head_;  // The next slot to write (writer thread).
+    std::atomic<size_t> tail_;  // The slot being filled (serializer).
+    std::atomic<int> error_;
+    std::atomic<bool> stop_;
+    std::atomic<bool> producer_waiting_;
+    std::atomic<bool> consumer_waiting_;
+    std::mutex mutex_;
+    std::condition_variable condition_;
+    std::thread thread_;
+};
+
+} // namespace htmlgen
+
+#endif // PIPELINE_SINK_H_
@@ -0,0 +1,448 @@
+// -*- mode: c++; tab-width: 2; indent-tabs-mode: nil; -*-
+//----------------------------------------------------------------------------
+// A persistent, file backed cache of rendered htmlgen fragments.
+//----------------------------------------------------------------------------
+// This is free and unencumbered software released into the public domain.
+//
+// Anyone is free to copy, modify, publish, use, compile, sell, or
+// distribute this software, either in source code form or as a compiled
+// binary, for any purpose, commercial or non-commercial, and by any
+// means.
+//
+// In jurisdictions that recognize copyright laws, the author or authors
+// of this software dedicate any and all copyright interest in the
+// software to the public domain. We make this dedication for the benefit
+// of the public at large and to the detriment of our heirs and
+// successors. We intend this dedication to be an overt act of
+// relinquishment in perpetuity of all present and future rights to this
+// software under copyright law.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+// OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+// ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+//
+// For more information, please refer to <http://unlicense.org/>
+//----------------------------------------------------------------------------
+
+#ifndef RENDER_CACHE_H_
+#define RENDER_CACHE_H_
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "document.h"
+
+namespace htmlgen {
+
+/// @brief A fragment cache that is persisted in a memory mapped file.
+///
+/// The file is an append-only log of (key, HTML) records, so cached fragments
+/// survive restarts and are shared between all processes on the host that use
+/// the same file. Appends are serialized between processes with an advisory
+/// file lock, and each record carries a checksum so that records that were
+/// torn by a crash are ignored. Each record also stores the full 128-bit
+/// fragment key, which is verified on lookup, so a fragment is never served
+/// for a key that merely shares its 64-bit hash.
+///
+/// When the file grows beyond its size bound, it is compacted: the least
+/// recently used records are dropped, and the remaining records are written
+/// to a new file that atomically replaces the old one. Other processes notice
+/// the replacement and re-open the file.
+///
+/// @code{.cpp}
+///   htmlgen::DiskRenderCache cache("/var/cache/app/fragments", 64 << 20);
+///   leaderboard->EnableCaching();
+///
+///   htmlgen::Document::Writer writer(html_string);
+///   writer.SetFragmentCache(&cache);
+///   doc.Write(writer);
+/// @endcode
+///
+/// @note The cache is thread safe (but not lock free).
+class DiskRenderCache : public Document::FragmentCache {
+  public:
+    /// @param path The cache file name. It is created if it does not exist.
+    /// @param max_bytes The maximum size of the cache file.
+    DiskRenderCache(const std::string& path, size_t max_bytes) :
+        path_(path), max_bytes_(max_bytes), fd_(-1), inode_(0),
+        data_(nullptr), mapped_size_(0), scanned_end_(0) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      Reopen();
+    }
+
+    virtual ~DiskRenderCache() {
+      Close();
+    }
+
+    virtual bool Fetch(const Document::FragmentKey& key, std::string& out) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      RecordHeader* record = Find(key);
+      if (!record) {
+        // The record may have been added by another process.
+        if (!Refresh())
+          return false;
+        record = Find(key);
+        if (!record)
+          return false;
+      }
+
+      out.append(reinterpret_cast<const char*>(record + 1), record->size);
+
+      // Update the LRU time stamp, but avoid dirtying the page on every hit.
+      uint64_t now = Now();
+      if (now - record->last_used > kTimeStampResolution)
+        record->last_used = now;
+      return true;
+    }
+
+    virtual void Store(const Document::FragmentKey& key, const char* html,
+                       size_t len) {
+      if (RecordSize(len) > max_bytes_ / 2)
+        return;
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (fd_ < 0 || !LockFile())
+        return;
+
+      // Append the record at the end of the valid part of the file. A torn
+      // record that a crashed process may have left there is overwritten
+      // rather than truncated, since other processes may have the file
+      // mapped. Nothing is written unless the whole file could be scanned.
+      Scan();
+      if (ScannedWholeFile() && !Find(key)) {
+        std::vector<char> buf(RecordSize(len), 0);
+        RecordHeader* record = reinterpret_cast<RecordHeader*>(buf.data());
+        record->key = key.hash;
+        record->check = key.check;
+        record->last_used = Now();
+        record->size = static_cast<uint32_t>(len);
+        std::memcpy(record + 1, html, len);
+        record->checksum = Checksum(*record);
+        if (WriteAll(buf.data(), buf.size(), scanned_end_))
+          Scan();
+      }
+
+      if (scanned_end_ > max_bytes_)
+        Compact();
+      ::flock(fd_, LOCK_UN);
+    }
+
+  private:
+    /// @brief The time stamp resolution for LRU tracking, in seconds.
+    static const uint64_t kTimeStampResolution = 1;
+
+    struct FileHeader {
+      char magic[8];
+      uint32_t version;
+      uint32_t reserved;
+    };
+
+    struct RecordHeader {
+      uint64_t key;    // FragmentKey::hash.
+      uint64_t check;  // FragmentKey::check.
+      uint64_t last_used;
+      uint32_t size;
+      uint32_t checksum;
+    };
+
+    static const uint32_t kVersion = 2;
+
+    static const char* Magic() {
+      return "HGCACHE";
+    }
+
+    static uint64_t Now() {
+      return static_cast<uint64_t>(std::time(nullptr));
+    }
+
+    /// @brief Get the size of a record, including padding to 8 bytes.
+    static size_t RecordSize(size_t len) {
+      return (sizeof(RecordHeader) + len + 7) & ~static_cast<size_t>(7);
+    }
+
+    static uint32_t Checksum(uint32_t h, const void* data, size_t len) {
+      const unsigned char* p = static_cast<const unsigned char*>(data);
+      for (size_t i = 0; i < len; ++i)
+        h = (h ^ p[i]) * 16777619u;
+      return h;
+    }
+
+    /// @brief Get the checksum of a record (which must be complete), covering
+    /// the key, size and HTML.
+    static uint32_t Checksum(const RecordHeader& record) {
+      uint32_t h = Checksum(2166136261u, &record.key, sizeof(record.key));
+      h = Checksum(h, &record.check, sizeof(record.check));
+      h = Checksum(h, &record.size, sizeof(record.size));
+      return Checksum(h, &record + 1, record.size);
+    }
+
+    RecordHeader* RecordAt(size_t offset) const {
+      return reinterpret_cast<RecordHeader*>(data_ + offset);
+    }
+
+    /// @brief Check that the last Scan() covered the whole file (it may have
+    /// failed to map the file, in which case appending at scanned_end_ would
+    /// overwrite valid records).
+    bool ScannedWholeFile() const {
+      struct stat st;
+      if (::fstat(fd_, &st) != 0)
+        return false;
+      size_t file_size = static_cast<size_t>(st.st_size);
+      return data_ ? mapped_size_ >= file_size
+                   : file_size <= sizeof(FileHeader);
+    }
+
+    /// @brief Find the record for a key in the index.
+    RecordHeader* Find(const Document::FragmentKey& key) const {
+      auto i = index_.find(key.hash);
+      if (i == index_.end())
+        return nullptr;
+      RecordHeader* record = RecordAt(i->second);
+      return record->check == key.check ? record : nullptr;
+    }
+
+    bool WriteAll(const char* data, size_t len, size_t offset) {
+      while (len > 0) {
+        ssize_t n = ::pwrite(fd_, data, len, static_cast<off_t>(offset));
+        if (n <= 0)
+          return false;
+        data += n;
+        len -= static_cast<size_t>(n);
+        offset += static_cast<size_t>(n);
+      }
+      return true;
+    }
+
+    /// @brief Take the inter-process lock, making sure that it is taken on
+    /// the current cache file (which may have been replaced by compaction).
+    bool LockFile() {
+      for (int attempt = 0; attempt < 3; ++attempt) {
+        if (::flock(fd_, LOCK_EX) != 0)
+          return false;
+        struct stat st;
+        if (::stat(path_.c_str(), &st) == 0 && st.st_ino == inode_)
+          return true;
+        ::flock(fd_, LOCK_UN);
+        if (!Reopen())
+          return false;
+      }
+      return false;
+    }
+
+    void Close() {
+      if (data_)
+        ::munmap(data_, mapped_size_);
+      if (fd_ >= 0)
+        ::close(fd_);
+      fd_ = -1;
+      data_ = nullptr;
+      mapped_size_ = 0;
+      scanned_end_ = 0;
+      index_.clear();
+    }
+
+    bool Reopen() {
+      Close();
+      fd_ = ::open(path_.c_str(), O_RDWR | O_CREAT, 0644);
+      if (fd_ < 0)
+        return false;
+      struct stat st;
+      if (::fstat(fd_, &st) != 0) {
+        Close();
+        return false;
+      }
+      inode_ = st.st_ino;
+
+      // Initialize a new file.
+      FileHeader header = MakeFileHeader();
+      if (st.st_size == 0) {
+        if (::flock(fd_, LOCK_EX) == 0) {
+          if (::fstat(fd_, &st) == 0 && st.st_size == 0)
+            WriteAll(reinterpret_cast<const char*>(&header), sizeof(header), 0);
+          ::flock(fd_, LOCK_UN);
+        }
+      }
+
+      FileHeader existing;
+      std::memset(&existing, 0, sizeof(existing));
+      if (::pread(fd_, &existing, sizeof(existing), 0) !=
+              static_cast<ssize_t>(sizeof(existing)) ||
+          std::memcmp(&existing, &header, sizeof(header)) != 0) {
+        // Replace a cache file of another version (but nothing else).
+        bool replaced = false;
+        if (std::memcmp(existing.magic, header.magic, sizeof(header.magic)) ==
+                0 &&
+            ::flock(fd_, LOCK_EX) == 0) {
+          // Another process may have replaced it while we waited.
+          replaced = ::stat(path_.c_str(), &st) != 0 || st.st_ino != inode_ ||
+                     ReplaceFile(std::string(
+                         reinterpret_cast<const char*>(&header),
+                         sizeof(header)));
+        }
+        Close();
+        return replaced && Reopen();
+      }
+      scanned_end_ = sizeof(FileHeader);
+      Scan();
+      return true;
+    }
+
+    /// @brief Check if the file has been replaced or extended by another
+    /// process, and if so pick up the changes.
+    /// @returns true if new records may have been found.
+    bool Refresh() {
+      struct stat st;
+      if (::stat(path_.c_str(), &st) != 0)
+        return false;
+      if (fd_ < 0 || st.st_ino != inode_)
+        return Reopen();
+      return Scan();
+    }
+
+    /// @brief Map the file and index all complete records after the part of
+    /// the file that has already been scanned.
+    /// @returns true if the file has grown since the last scan.
+    bool Scan() {
+      struct stat st;
+      if (::fstat(fd_, &st) != 0)
+        return false;
+      size_t file_size = static_cast<size_t>(st.st_size);
+      if (file_size <= scanned_end_)
+        return false;
+
+      if (file_size > mapped_size_) {
+        if (data_)
+          ::munmap(data_, mapped_size_);
+        void* data = ::mmap(nullptr, file_size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED, fd_, 0);
+        if (data == MAP_FAILED) {
+          data_ = nullptr;
+          mapped_size_ = 0;
+          index_.clear();
+          scanned_end_ = sizeof(FileHeader);
+          return false;
+        }
+        data_ = static_cast<char*>(data);
+        mapped_size_ = file_size;
+      }
+
+      while (scanned_end_ + sizeof(RecordHeader) <= file_size) {
+        const RecordHeader* record = RecordAt(scanned_end_);
+        size_t size = RecordSize(record->size);
+        if (record->size > file_size ||
+            size > file_size - scanned_end_ ||
+            Checksum(*record) != record->checksum)
+          break;
+        index_[record->key] = scanned_end_;
+        scanned_end_ += size;
+      }
+      return true;
+    }
+
+    /// @brief Drop the least recently used records, so that the file is at
+    /// most half full. Must be called with the file lock held.
+    void Compact() {
+      std::vector<std::pair<uint64_t, size_t> > records;
+      records.reserve(index_.size());
+      for (auto i = index_.begin(); i != index_.end(); ++i)
+        records.push_back(std::make_pair(RecordAt(i->second)->last_used,
+                                         i->second));
+      std::sort(records.begin(), records.end(),
+                [](const std::pair<uint64_t, size_t>& a,
+                   const std::pair<uint64_t, size_t>& b) {
+                  return a.first > b.first;
+                });
+
+      std::string data;
+      FileHeader header = MakeFileHeader();
+      data.append(reinterpret_cast<const char*>(&header), sizeof(header));
+      for (auto i = records.begin(); i != records.end(); ++i) {
+        size_t size = RecordSize(RecordAt(i->second)->size);
+        if (data.size() + size > max_bytes_ / 2)
+          break;
+        data.append(data_ + i->second, size);
+      }
+
+      if (!ReplaceFile(data))
+        return;
+
+      // Switch to the new file. The lock on the old file is released when it
+      // is closed.
+      Reopen();
+    }
+
+    static FileHeader MakeFileHeader() {
+      FileHeader header;
+      std::memset(&header, 0, sizeof(header));
+      std::memcpy(header.magic, Magic(), sizeof(header.magic));
+      header.version = kVersion;
+      return header;
+    }
+
+    /// @brief Atomically replace the cache file. Must be called with the file
+    /// lock held.
+    ///
+    /// The data is written to a uniquely named temporary file (so concurrent
+    /// replacements can not mix their data), which is synced and renamed.
+    bool ReplaceFile(const std::string& data) {
+      std::string tmp_path(path_);
+      tmp_path.append(".XXXXXX");
+      int fd = ::mkstemp(&tmp_path[0]);
+      if (fd < 0)
+        return false;
+      bool ok = ::fchmod(fd, 0644) == 0;
+      const char* p = data.data();
+      size_t len = data.size();
+      while (ok && len > 0) {
+        ssize_t n = ::write(fd, p, len);
+        if (n < 0 && errno == EINTR)
+          continue;
+        ok = n > 0;
+        if (ok) {
+          p += n;
+          len -= static_cast<size_t>(n);
+        }
+      }
+      ok = ok && ::fsync(fd) == 0;
+      ok = (::close(fd) == 0) && ok;
+      if (!ok || ::rename(tmp_path.c_str(), path_.c_str()) != 0) {
+        ::unlink(tmp_path.c_str());
+        return false;
+      }
+      return true;
+    }
+
+    std::mutex mutex_;
+    const std::string path_;
+    const size_t max_bytes_;
+    int fd_;
+    ino_t inode_;
+    char* data_;
+    size_t mapped_size_;
+    size_t scanned_end_;
+    std::unordered_map<uint64_t, size_t> index_;
+
+    DiskRenderCache(const DiskRenderCache&) = delete;
+    DiskRenderCache& operator=(const DiskRenderCache&) = delete;
+};
+
+} // namespace htmlgen
+
+#endif // RENDER_CACHE_H_
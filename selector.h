@@ -0,0 +1,496 @@
+// -*- mode: c++; tab-width: 2; indent-tabs-mode: nil; -*-
+//----------------------------------------------------------------------------
+// CSS selector queries for the htmlgen document tree.
+//----------------------------------------------------------------------------
+// This is free and unencumbered software released into the public domain.
+//
+// Anyone is free to copy, modify, publish, use, compile, sell, or
+// distribute this software, either in source code form or as a compiled
+// binary, for any purpose, commercial or non-commercial, and by any
+// means.
+//
+// In jurisdictions that recognize copyright laws, the author or authors
+// of this software dedicate any and all copyright interest in the
+// software to the public domain. We make this dedication for the benefit
+// of the public at large and to the detriment of our heirs and
+// successors. We intend this dedication to be an overt act of
+// relinquishment in perpetuity of all present and future rights to this
+// software under copyright law.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+// OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+// ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+//
+// For more information, please refer to <http://unlicense.org/>
+//----------------------------------------------------------------------------
+
+#ifndef SELECTOR_H_
+#define SELECTOR_H_
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "document.h"
+
+namespace htmlgen {
+
+/// @brief A compiled CSS selector that can be matched against Elements.
+///
+/// The selector text is compiled once into a flat matcher program, which can
+/// then be run against any number of node trees. The following subset of the
+/// CSS selector syntax is supported:
+///   - Type selectors (@c p) and the universal selector (@c *).
+///   - ID selectors (@c \#main) and class selectors (@c .note).
+///   - Attribute selectors: @c [a], @c [a=v], @c [a~=v], @c [a|=v],
+///     @c [a^=v], @c [a$=v] and @c [a*=v]. Values may be quoted.
+///   - Descendant (@c "a b") and child (@c "a > b") combinators.
+///   - Selector lists (@c "a, b").
+///
+/// @note Like the rest of the document builder, matching is case sensitive.
+///
+/// Attribute values are compared in their escaped form, with the selector
+/// value escaped in the same mode as the attribute (see
+/// Document::Attribute::ascii_only()), so "é" matches a value that is stored
+/// as "&#xE9;".
+///
+/// The names in a selector are looked up in the name table, but not added to
+/// it (see internal::NameTable::Lookup()), so selectors from untrusted input
+/// do not use memory for the lifetime of the process. Interned names are
+/// compared by address, and the names that elements and attributes own once
+/// the table is full (see Document::Element::name()) by content.
+///
+/// @code{.cpp}
+///   htmlgen::Selector scripts("script");
+///   std::vector<htmlgen::Document::Element*> result;
+///   scripts.Select(doc.root(), result);
+///   for (auto i = result.begin(); i != result.end(); ++i)
+///     (*i)->AddAttribute("nonce", nonce);
+/// @endcode
+class Selector {
+  public:
+    explicit Selector(const char* text) {
+      valid_ = Compile(text);
+      if (!valid_)
+        selectors_.clear();
+    }
+
+    explicit Selector(const std::string& text) {
+      valid_ = Compile(text.c_str());
+      if (!valid_)
+        selectors_.clear();
+    }
+
+    /// @brief Check if the selector text could be compiled.
+    /// @note An invalid selector does not match any elements.
+    bool valid() const {
+      return valid_;
+    }
+
+    /// @brief Check if an Element matches this selector.
+    /// @param element The element to test.
+    /// @returns true if the element matches.
+    bool Matches(const Document::Element* element) const {
+      for (auto i = selectors_.begin(); i != selectors_.end(); ++i) {
+        if (MatchFrom(i->first, i->second, element))
+          return true;
+      }
+      return false;
+    }
+
+    /// @brief Find all descendants of an Element that match this selector.
+    /// @param root The element whose descendants are searched.
+    /// @param[out] result The matching elements are appended to this vector,
+    /// in document order.
+    void Select(Document::Element* root,
+                std::vector<Document::Element*>& result) const {
+      Document::PreOrderIterator end;
+      for (Document::PreOrderIterator i(root); ++i != end;) {
+        if ((*i)->type() != Document::Node::kElement)
+          continue;
+        Document::Element* e = static_cast<Document::Element*>(*i);
+        if (Matches(e))
+          result.push_back(e);
+      }
+    }
+
+    /// @brief Find the first descendant of an Element that matches this
+    /// selector.
+    /// @param root The element whose descendants are searched.
+    /// @returns The first matching element in document order, or nullptr if
+    /// there is no match.
+    Document::Element* SelectFirst(Document::Element* root) const {
+      Document::PreOrderIterator end;
+      for (Document::PreOrderIterator i(root); ++i != end;) {
+        if ((*i)->type() != Document::Node::kElement)
+          continue;
+        Document::Element* e = static_cast<Document::Element*>(*i);
+        if (Matches(e))
+          return e;
+      }
+      return nullptr;
+    }
+
+  private:
+    /// @brief A single test that is part of a compound selector.
+    struct Test {
+      enum Op {
+        kTag,        // name == tag
+        kHas,        // [name]
+        kEquals,     // [name=value]
+        kIncludes,   // [name~=value]
+        kDashMatch,  // [name|=value]
+        kPrefix,     // [name^=value]
+        kSuffix,     // [name$=value]
+        kSubstring   // [name*=value]
+      };
+
+      Op op;
+      const std::string* name;  // Interned, so it is compared by address.
+      std::string unknown_name;  // The name, if it was not interned yet.
+      // Escaped, so that it can be compared directly, in the same form as
+      // attribute values with and without ASCII-only escaping.
+      std::string value;
+      std::string ascii_value;
+    };
+
+    /// @brief A compound selector (a sequence of tests without combinators).
+    struct Compound {
+      enum Combinator {
+        kNone,        // This is the leftmost compound.
+        kDescendant,  // The next compound must match an ancestor.
+        kChild        // The next compound must match the parent.
+      };
+
+      size_t first_test;
+      size_t num_tests;
+      Combinator combinator;
+    };
+
+    /// @brief Match the compounds [first, end) right to left, starting at an
+    /// Element.
+    bool MatchFrom(size_t first, size_t end,
+                   const Document::Element* element) const {
+      const Compound& compound = compounds_[first];
+      if (!MatchCompound(compound, element))
+        return false;
+      if (first + 1 == end)
+        return true;
+      const Document::Element* ancestor = element->parent();
+      if (compound.combinator == Compound::kChild)
+        return ancestor && MatchFrom(first + 1, end, ancestor);
+      for (; ancestor; ancestor = ancestor->parent()) {
+        if (MatchFrom(first + 1, end, ancestor))
+          return true;
+      }
+      return false;
+    }
+
+    bool MatchCompound(const Compound& compound,
+                       const Document::Element* element) const {
+      const Test* test = tests_.data() + compound.first_test;
+      const Test* tests_end = test + compound.num_tests;
+      for (; test != tests_end; ++test) {
+        const std::string* name = test->name;
+        if (!name) {
+          // The name was not interned when the selector was compiled. If it
+          // still is not, only owned names can have it.
+          name = internal::NameTable::Lookup(test->unknown_name);
+        }
+        const std::string& text = name ? *name : test->unknown_name;
+        if (test->op == Test::kTag) {
+          if (!SameName(element->name(), element->name_interned(), name,
+                        text))
+            return false;
+          continue;
+        }
+        const Document::Attribute* attr = nullptr;
+        for (auto a = element->attributes().begin();
+             a != element->attributes().end(); ++a) {
+          if (SameName(a->name(), a->name_interned(), name, text)) {
+            attr = &(*a);
+            break;
+          }
+        }
+        if (!attr ||
+            !MatchValue(test->op,
+                        attr->ascii_only() ? test->ascii_value : test->value,
+                        attr->escaped_value()))
+          return false;
+      }
+      return true;
+    }
+
+    /// @brief Compare the name of an element or attribute with the name of a
+    /// test.
+    /// @param name The element or attribute name.
+    /// @param interned Whether @p name is interned.
+    /// @param test_name The interned name of the test, or nullptr.
+    /// @param text The name of the test.
+    static bool SameName(const std::string& name, bool interned,
+                         const std::string* test_name,
+                         const std::string& text) {
+      if (interned)
+        return &name == test_name;
+      return name == text;
+    }
+
+    static bool MatchValue(Test::Op op, const std::string& v,
+                           const std::string& value) {
+      switch (op) {
+      case Test::kHas:
+        return true;
+      case Test::kEquals:
+        return value == v;
+      case Test::kIncludes:
+        // An empty value, or one with whitespace, never matches a token.
+        if (v.empty() || v.find_first_of(" \t\n\f\r") != std::string::npos)
+          return false;
+        for (size_t pos = 0; pos < value.size();) {
+          size_t end = value.find_first_of(" \t\n\f\r", pos);
+          if (end == std::string::npos)
+            end = value.size();
+          if (end - pos == v.size() && value.compare(pos, v.size(), v) == 0)
+            return true;
+          pos = end + 1;
+        }
+        return false;
+      case Test::kDashMatch:
+        return value.compare(0, v.size(), v) == 0 &&
+               (value.size() == v.size() || value[v.size()] == '-');
+      case Test::kPrefix:
+        return !v.empty() && value.compare(0, v.size(), v) == 0;
+      case Test::kSuffix:
+        return !v.empty() && value.size() >= v.size() &&
+               value.compare(value.size() - v.size(), v.size(), v) == 0 &&
+               IsCharBoundary(value, value.size() - v.size());
+      case Test::kSubstring:
+        if (v.empty())
+          return false;
+        for (size_t pos = value.find(v); pos != std::string::npos;
+             pos = value.find(v, pos + 1)) {
+          if (IsCharBoundary(value, pos))
+            return true;
+        }
+        return false;
+      default:
+        return false;
+      }
+    }
+
+    /// @brief Check that a position in an escaped string is not inside a
+    /// character reference (e.g. "&amp;"), so that matches against escaped
+    /// values give the same result as matches against unescaped values.
+    static bool IsCharBoundary(const std::string& value, size_t pos) {
+      // The longest reference that the escapers produce is ten characters
+      // ("&#x10FFFF;"), so its '&' is at most nine characters back.
+      size_t stop = pos > 9 ? pos - 9 : 0;
+      while (pos > stop) {
+        char c = value[--pos];
+        if (c == ';')
+          return true;
+        if (c == '&')
+          return false;
+      }
+      return true;
+    }
+
+    static bool IsNameChar(char c) {
+      return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+             (c >= '0' && c <= '9') || c == '-' || c == '_' ||
+             (static_cast<unsigned char>(c) >= 0x80);
+    }
+
+    static bool IsSpace(char c) {
+      return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f';
+    }
+
+    static const char* SkipSpace(const char* p) {
+      while (IsSpace(*p))
+        ++p;
+      return p;
+    }
+
+    static const char* ParseName(const char* p, std::string& name) {
+      const char* start = p;
+      while (IsNameChar(*p))
+        ++p;
+      name.assign(start, p - start);
+      return p;
+    }
+
+    void AddTest(Test::Op op, const std::string& name, const char* value,
+                 size_t value_len) {
+      tests_.push_back(Test());
+      Test& test = tests_.back();
+      test.op = op;
+      // Names are looked up rather than interned, so that selectors (e.g.
+      // from untrusted input) do not grow the name table.
+      test.name = internal::NameTable::Lookup(name);
+      if (!test.name)
+        test.unknown_name = name;
+      Document::Attribute::AppendEscaped(value, value_len, test.value);
+      Document::Attribute::AppendEscapedAscii(value, value_len,
+                                              test.ascii_value);
+    }
+
+    /// @brief Parse an attribute selector, starting after the '['.
+    const char* ParseAttribute(const char* p) {
+      std::string name;
+      p = ParseName(SkipSpace(p), name);
+      if (name.empty())
+        return nullptr;
+      p = SkipSpace(p);
+      if (*p == ']') {
+        AddTest(Test::kHas, name, "", 0);
+        return p + 1;
+      }
+
+      Test::Op op;
+      switch (*p) {
+      case '=':
+        op = Test::kEquals;
+        break;
+      case '~':
+        op = Test::kIncludes;
+        break;
+      case '|':
+        op = Test::kDashMatch;
+        break;
+      case '^':
+        op = Test::kPrefix;
+        break;
+      case '$':
+        op = Test::kSuffix;
+        break;
+      case '*':
+        op = Test::kSubstring;
+        break;
+      default:
+        return nullptr;
+      }
+      if (op != Test::kEquals) {
+        if (*++p != '=')
+          return nullptr;
+      }
+      p = SkipSpace(p + 1);
+
+      std::string value;
+      if (*p == '"' || *p == '\'') {
+        char quote = *p++;
+        const char* start = p;
+        while (*p && *p != quote)
+          ++p;
+        if (!*p)
+          return nullptr;
+        value.assign(start, p - start);
+        ++p;
+      } else {
+        p = ParseName(p, value);
+        if (value.empty())
+          return nullptr;
+      }
+
+      p = SkipSpace(p);
+      if (*p != ']')
+        return nullptr;
+      AddTest(op, name, value.data(), value.size());
+      return p + 1;
+    }
+
+    /// @brief Parse a compound selector.
+    /// @returns The position after the compound, or nullptr on error.
+    const char* ParseCompound(const char* p) {
+      Compound compound;
+      compound.first_test = tests_.size();
+      compound.combinator = Compound::kNone;
+
+      std::string name;
+      if (*p == '*') {
+        ++p;
+      } else if (IsNameChar(*p)) {
+        p = ParseName(p, name);
+        AddTest(Test::kTag, name, "", 0);
+      }
+
+      while (true) {
+        if (*p == '#' || *p == '.') {
+          bool is_id = (*p == '#');
+          p = ParseName(p + 1, name);
+          if (name.empty())
+            return nullptr;
+          AddTest(is_id ? Test::kEquals : Test::kIncludes,
+                  is_id ? "id" : "class", name.data(), name.size());
+        } else if (*p == '[') {
+          p = ParseAttribute(p + 1);
+          if (!p)
+            return nullptr;
+        } else {
+          break;
+        }
+      }
+
+      compound.num_tests = tests_.size() - compound.first_test;
+      compounds_.push_back(compound);
+      return p;
+    }
+
+    /// @brief Compile a selector list.
+    /// @returns false if the selector text could not be parsed.
+    bool Compile(const char* p) {
+      while (true) {
+        // Parse a complex selector (compounds separated by combinators). The
+        // compounds are parsed left to right, but stored right to left since
+        // that is the order in which they are matched.
+        size_t first = compounds_.size();
+        p = SkipSpace(p);
+        while (true) {
+          const char* start = p;
+          p = ParseCompound(p);
+          if (!p || p == start)
+            return false;
+
+          const char* q = SkipSpace(p);
+          Compound::Combinator combinator;
+          if (*q == '>') {
+            combinator = Compound::kChild;
+            q = SkipSpace(q + 1);
+          } else if (q != p && *q && *q != ',') {
+            combinator = Compound::kDescendant;
+          } else {
+            p = q;
+            break;
+          }
+          compounds_.back().combinator = combinator;
+          p = q;
+        }
+
+        // Reverse the compound order, and shift the combinators so that each
+        // compound holds the relation to the compound that follows it.
+        size_t end = compounds_.size();
+        for (size_t i = first, j = end - 1; i < j; ++i, --j)
+          std::swap(compounds_[i], compounds_[j]);
+        for (size_t i = first; i + 1 < end; ++i)
+          compounds_[i].combinator = compounds_[i + 1].combinator;
+        compounds_[end - 1].combinator = Compound::kNone;
+        selectors_.push_back(std::make_pair(first, end));
+
+        if (*p != ',')
+          return *p == '\0';
+        ++p;
+      }
+    }
+
+    std::vector<Test> tests_;
+    std::vector<Compound> compounds_;
+    std::vector<std::pair<size_t, size_t> > selectors_;
+    bool valid_;
+};
+
+} // namespace htmlgen
+
+#endif // SELECTOR_H_
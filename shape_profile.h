@@ -0,0 +1,624 @@
+// -*- mode: c++; tab-width: 2; indent-tabs-mode: nil; -*-
+//----------------------------------------------------------------------------
+// Recording and synthesis of document shapes for benchmarks.
+//----------------------------------------------------------------------------
+// This is free and unencumbered software released into the public domain.
+//
+// Anyone is free to copy, modify, publish, use, compile, sell, or
+// distribute this software, either in source code form or as a compiled
+// binary, for any purpose, commercial or non-commercial, and by any
+// means.
+//
+// In jurisdictions that recognize copyright laws, the author or authors
+// of this software dedicate any and all copyright interest in the
+// software to the public domain. We make this dedication for the benefit
+// of the public at large and to the detriment of our heirs and
+// successors. We intend this dedication to be an overt act of
+// relinquishment in perpetuity of all present and future rights to this
+// software under copyright law.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+// OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+// ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+//
+// For more information, please refer to <http://unlicense.org/>
+//----------------------------------------------------------------------------
+
+#ifndef SHAPE_PROFILE_H_
+#define SHAPE_PROFILE_H_
+
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "document.h"
+
+namespace htmlgen {
+
+/// @brief A histogram of non-negative integers, with power of two buckets.
+///
+/// Bucket 0 counts zeros, and bucket i > 0 counts values in
+/// [2^(i-1), 2^i - 1].
+class ShapeHistogram {
+  public:
+    static const int kNumBuckets = 65;
+
+    ShapeHistogram() : counts_(kNumBuckets, 0) {}
+
+    /// @brief Count a value.
+    void Add(uint64_t value) {
+      ++counts_[BucketOf(value)];
+    }
+
+    /// @brief Add the counts of another histogram.
+    void Merge(const ShapeHistogram& other) {
+      for (int i = 0; i < kNumBuckets; ++i)
+        counts_[i] += other.counts_[i];
+    }
+
+    /// @brief Get the number of values in a bucket.
+    uint64_t count(int bucket) const {
+      return counts_[bucket];
+    }
+
+    /// @brief Get the total number of values.
+    uint64_t total() const {
+      uint64_t sum = 0;
+      for (int i = 0; i < kNumBuckets; ++i)
+        sum += counts_[i];
+      return sum;
+    }
+
+    /// @brief Get the smallest value of a bucket.
+    static uint64_t BucketMin(int bucket) {
+      return bucket == 0 ? 0 : uint64_t(1) << (bucket - 1);
+    }
+
+    /// @brief Get the largest value of a bucket.
+    static uint64_t BucketMax(int bucket) {
+      return bucket == 0 ? 0 : (BucketMin(bucket) - 1) * 2 + 1;
+    }
+
+    static int BucketOf(uint64_t value) {
+      int bucket = 0;
+      while (value) {
+        value >>= 1;
+        ++bucket;
+      }
+      return bucket;
+    }
+
+  private:
+    friend class ShapeProfile;
+
+    std::vector<uint64_t> counts_;
+};
+
+/// @brief Anonymized statistics about the shape of documents.
+///
+/// A profile records how documents are built, but not what they contain:
+/// the depth of elements, the number of children and attributes per tag,
+/// which tags are children of which tags, the lengths of text and attribute
+/// values, and how many characters per 1024 need escaping. Standard HTML
+/// names are kept, while other element names are recorded as "x-custom",
+/// "data-*" attributes as "data-x" and other attributes as "x-custom". No
+/// text or attribute values are recorded.
+///
+/// Profiles can be saved as text with Serialize(), and be used by a
+/// ShapeGenerator to build synthetic documents with the same shape.
+///
+/// @code{.cpp}
+///   // In production (e.g. for a sample of the requests):
+///   profile.Record(doc);
+///   ...
+///   SaveFile("pages.profile", profile.Serialize());
+///
+///   // In a benchmark:
+///   htmlgen::ShapeProfile profile;
+///   profile.Parse(LoadFile("pages.profile"));
+///   htmlgen::ShapeGenerator generator(profile, 1234);
+///   htmlgen::Document doc;
+///   generator.Generate(doc);
+/// @endcode
+class ShapeProfile {
+  public:
+    /// @brief Statistics for one element name.
+    struct TagStats {
+      TagStats() : count(0) {}
+
+      uint64_t count;               ///< The number of elements.
+      ShapeHistogram children;      ///< Children per element.
+      ShapeHistogram attributes;    ///< Attributes per element.
+      /// Child counts by name ("#text" and "#raw" for other nodes).
+      std::map<std::string, uint64_t> child_names;
+      /// Attribute counts by name.
+      std::map<std::string, uint64_t> attribute_names;
+    };
+
+    ShapeProfile() : documents_(0) {}
+
+    /// @brief Record the shape of a document.
+    void Record(const Document& doc) {
+      ++documents_;
+      Record(*doc.root());
+    }
+
+    /// @brief Record the shape of the subtree rooted at an Element.
+    void Record(const Document::Element& root) {
+      const Document::Node* node = &root;
+      uint64_t depth = 0;
+      while (node) {
+        RecordNode(*node, depth);
+        if (node->type() == Document::Node::kElement) {
+          const Document::Node* child =
+              static_cast<const Document::Element*>(node)->first_child();
+          if (child) {
+            node = child;
+            ++depth;
+            continue;
+          }
+        }
+        while (node != &root && !node->next_sibling()) {
+          node = node->parent();
+          --depth;
+        }
+        node = (node == &root) ? nullptr : node->next_sibling();
+      }
+    }
+
+    /// @brief Add the statistics of another profile.
+    void Merge(const ShapeProfile& other) {
+      documents_ += other.documents_;
+      depth_.Merge(other.depth_);
+      text_length_.Merge(other.text_length_);
+      text_escapes_.Merge(other.text_escapes_);
+      raw_length_.Merge(other.raw_length_);
+      value_length_.Merge(other.value_length_);
+      value_escapes_.Merge(other.value_escapes_);
+      for (auto i = other.tags_.begin(); i != other.tags_.end(); ++i) {
+        TagStats& stats = tags_[i->first];
+        stats.count += i->second.count;
+        stats.children.Merge(i->second.children);
+        stats.attributes.Merge(i->second.attributes);
+        MergeCounts(i->second.child_names, stats.child_names);
+        MergeCounts(i->second.attribute_names, stats.attribute_names);
+      }
+    }
+
+    /// @brief Get the number of recorded documents.
+    uint64_t documents() const {
+      return documents_;
+    }
+
+    /// @brief Get the depths of elements (the root has depth 0).
+    const ShapeHistogram& depth() const {
+      return depth_;
+    }
+
+    /// @brief Get the lengths of text nodes (unescaped).
+    const ShapeHistogram& text_length() const {
+      return text_length_;
+    }
+
+    /// @brief Get the escaped characters per 1024 characters of text nodes.
+    const ShapeHistogram& text_escapes() const {
+      return text_escapes_;
+    }
+
+    /// @brief Get the lengths of raw HTML nodes.
+    const ShapeHistogram& raw_length() const {
+      return raw_length_;
+    }
+
+    /// @brief Get the lengths of attribute values (unescaped).
+    const ShapeHistogram& value_length() const {
+      return value_length_;
+    }
+
+    /// @brief Get the escaped characters per 1024 characters of attribute
+    /// values.
+    const ShapeHistogram& value_escapes() const {
+      return value_escapes_;
+    }
+
+    /// @brief Get the statistics per element name.
+    const std::map<std::string, TagStats>& tags() const {
+      return tags_;
+    }
+
+    /// @brief Convert the profile to text.
+    std::string Serialize() const {
+      std::ostringstream out;
+      out << "htmlgen-shape-profile 1\n";
+      out << "documents " << documents_ << '\n';
+      WriteHistogram(out, "depth", depth_);
+      WriteHistogram(out, "text_length", text_length_);
+      WriteHistogram(out, "text_escapes", text_escapes_);
+      WriteHistogram(out, "raw_length", raw_length_);
+      WriteHistogram(out, "value_length", value_length_);
+      WriteHistogram(out, "value_escapes", value_escapes_);
+      for (auto i = tags_.begin(); i != tags_.end(); ++i) {
+        const TagStats& stats = i->second;
+        out << "tag " << i->first << ' ' << stats.count << '\n';
+        WriteHistogram(out, "children", stats.children);
+        WriteHistogram(out, "attributes", stats.attributes);
+        WriteCounts(out, "child", stats.child_names);
+        WriteCounts(out, "attribute", stats.attribute_names);
+      }
+      return out.str();
+    }
+
+    /// @brief Replace the profile with one that was converted to text by
+    /// Serialize().
+    ///
+    /// Names are anonymized as by Record(), so that a profile from an
+    /// untrusted file only builds documents with standard names and the
+    /// placeholder names (see internal::NameTable). Counts for names that
+    /// become the same are added up.
+    /// @returns false if the text is not a valid profile (the profile is
+    /// then left empty).
+    bool Parse(const std::string& text) {
+      *this = ShapeProfile();
+      std::istringstream in(text);
+      std::string word;
+      int version;
+      if (!(in >> word >> version) || word != "htmlgen-shape-profile" ||
+          version != 1)
+        return Fail();
+      TagStats* tag = nullptr;
+      while (in >> word) {
+        bool ok;
+        if (word == "documents") {
+          ok = static_cast<bool>(in >> documents_);
+        } else if (word == "tag") {
+          std::string name;
+          uint64_t count;
+          ok = static_cast<bool>(in >> name >> count);
+          tag = &tags_[AnonymizeTag(name)];
+          tag->count += count;
+        } else if (word == "child") {
+          std::string name;
+          uint64_t count;
+          ok = tag && (in >> name >> count);
+          if (ok && name != "#text" && name != "#raw")
+            name = AnonymizeTag(name);
+          if (ok)
+            tag->child_names[name] += count;
+        } else if (word == "attribute") {
+          std::string name;
+          uint64_t count;
+          ok = tag && (in >> name >> count);
+          if (ok)
+            tag->attribute_names[AnonymizeAttribute(name)] += count;
+        } else {
+          ShapeHistogram* histogram = FindHistogram(word, tag);
+          ok = histogram && ReadHistogram(in, *histogram);
+        }
+        if (!ok)
+          return Fail();
+      }
+      return true;
+    }
+
+  private:
+    void RecordNode(const Document::Node& node, uint64_t depth) {
+      const Document::Element* parent = node.parent();
+      switch (node.type()) {
+      case Document::Node::kElement: {
+        const Document::Element& element =
+            static_cast<const Document::Element&>(node);
+        std::string name = AnonymizeTag(element.name());
+        TagStats& stats = tags_[name];
+        ++stats.count;
+        uint64_t children = 0;
+        for (const Document::Node* child = element.first_child(); child;
+             child = child->next_sibling())
+          ++children;
+        stats.children.Add(children);
+        stats.attributes.Add(element.attributes().size());
+        for (auto i = element.attributes().begin();
+             i != element.attributes().end(); ++i) {
+          ++stats.attribute_names[AnonymizeAttribute(i->name())];
+          RecordEscaped(i->escaped_value(), value_length_, value_escapes_);
+        }
+        depth_.Add(depth);
+        if (parent && depth > 0)
+          ++tags_[AnonymizeTag(parent->name())].child_names[name];
+        return;
+      }
+      case Document::Node::kText: {
+        const std::string& value =
+            static_cast<const Document::TextNode&>(node).escaped_value();
+        if (parent && parent->IsRawTextElement()) {
+          // Raw text is not escaped.
+          text_length_.Add(value.size());
+          text_escapes_.Add(0);
+        } else {
+          RecordEscaped(value, text_length_, text_escapes_);
+        }
+        if (parent && depth > 0)
+          ++tags_[AnonymizeTag(parent->name())].child_names["#text"];
+        return;
+      }
+      default: {
+        std::string html;
+        node.GetHTML(html);
+        raw_length_.Add(html.size());
+        if (parent && depth > 0)
+          ++tags_[AnonymizeTag(parent->name())].child_names["#raw"];
+        return;
+      }
+      }
+    }
+
+    /// @brief Record the unescaped length and the escape density of an
+    /// escaped string (each "&...;" reference counts as one character).
+    static void RecordEscaped(const std::string& escaped,
+                              ShapeHistogram& lengths,
+                              ShapeHistogram& escapes) {
+      uint64_t length = 0, escaped_chars = 0;
+      for (size_t i = 0; i < escaped.size(); ++i) {
+        if (escaped[i] == '&') {
+          size_t end = escaped.find(';', i);
+          if (end != std::string::npos)
+            i = end;
+          ++escaped_chars;
+        }
+        ++length;
+      }
+      lengths.Add(length);
+      escapes.Add(length ? escaped_chars * 1024 / length : 0);
+    }
+
+    static std::string AnonymizeTag(const std::string& name) {
+      int id = internal::StandardNames::Find(name.data(), name.size());
+      if (id >= 0 &&
+          (internal::StandardNames::Flags(id) & internal::StandardNames::kTag))
+        return name;
+      return "x-custom";
+    }
+
+    static std::string AnonymizeAttribute(const std::string& name) {
+      int id = internal::StandardNames::Find(name.data(), name.size());
+      if (id >= 0 && (internal::StandardNames::Flags(id) &
+                      internal::StandardNames::kAttribute))
+        return name;
+      if (name.compare(0, 5, "data-") == 0)
+        return "data-x";
+      return "x-custom";
+    }
+
+    static void MergeCounts(const std::map<std::string, uint64_t>& from,
+                            std::map<std::string, uint64_t>& to) {
+      for (auto i = from.begin(); i != from.end(); ++i)
+        to[i->first] += i->second;
+    }
+
+    /// @brief Write a histogram as "name bucket:count ... ;", with only the
+    /// non-empty buckets.
+    static void WriteHistogram(std::ostream& out, const char* name,
+                               const ShapeHistogram& histogram) {
+      out << name;
+      for (int i = 0; i < ShapeHistogram::kNumBuckets; ++i) {
+        if (histogram.counts_[i])
+          out << ' ' << i << ':' << histogram.counts_[i];
+      }
+      out << " ;\n";
+    }
+
+    static bool ReadHistogram(std::istream& in, ShapeHistogram& histogram) {
+      std::string entry;
+      while (in >> entry && entry != ";") {
+        std::istringstream fields(entry);
+        int bucket;
+        char colon;
+        uint64_t count;
+        if (!(fields >> bucket >> colon >> count) || colon != ':' ||
+            bucket < 0 || bucket >= ShapeHistogram::kNumBuckets)
+          return false;
+        histogram.counts_[bucket] += count;
+      }
+      return entry == ";";
+    }
+
+    static void WriteCounts(std::ostream& out, const char* name,
+                            const std::map<std::string, uint64_t>& counts) {
+      for (auto i = counts.begin(); i != counts.end(); ++i)
+        out << name << ' ' << i->first << ' ' << i->second << '\n';
+    }
+
+    ShapeHistogram* FindHistogram(const std::string& name, TagStats* tag) {
+      if (tag && name == "children")
+        return &tag->children;
+      if (tag && name == "attributes")
+        return &tag->attributes;
+      if (name == "depth")
+        return &depth_;
+      if (name == "text_length")
+        return &text_length_;
+      if (name == "text_escapes")
+        return &text_escapes_;
+      if (name == "raw_length")
+        return &raw_length_;
+      if (name == "value_length")
+        return &value_length_;
+      if (name == "value_escapes")
+        return &value_escapes_;
+      return nullptr;
+    }
+
+    bool Fail() {
+      *this = ShapeProfile();
+      return false;
+    }
+
+    uint64_t documents_;
+    ShapeHistogram depth_;
+    ShapeHistogram text_length_;
+    ShapeHistogram text_escapes_;
+    ShapeHistogram raw_length_;
+    ShapeHistogram value_length_;
+    ShapeHistogram value_escapes_;
+    std::map<std::string, TagStats> tags_;
+};
+
+/// @brief A generator of synthetic documents with the shape of a profile.
+///
+/// Documents are built top down from the root ("html" element): the number
+/// of children and attributes of an element, and the names of its children
+/// and attributes, are drawn from the statistics of its name, and lengths
+/// and escape densities from the global histograms. Text is made of lower
+/// case words, with characters that need escaping mixed in at the drawn
+/// density.
+///
+/// The generator uses its own pseudo random number generator, so a given
+/// profile and seed give the same documents on all platforms.
+class ShapeGenerator {
+  public:
+    /// @param profile The profile. It must outlive the generator.
+    /// @param seed The random seed.
+    /// @param max_nodes The maximum number of nodes in a generated document.
+    ShapeGenerator(const ShapeProfile& profile, uint64_t seed,
+                   size_t max_nodes = 1 << 20) : profile_(profile),
+        state_(seed), max_nodes_(max_nodes), max_depth_(0) {
+      for (int i = 0; i < ShapeHistogram::kNumBuckets; ++i) {
+        if (profile.depth().count(i))
+          max_depth_ = ShapeHistogram::BucketMax(i);
+      }
+    }
+
+    /// @brief Generate the content of a document (the children and attributes
+    /// of its root element).
+    /// @param[out] doc An empty document.
+    void Generate(Document& doc) {
+      size_t nodes = 1;
+      std::vector<std::pair<Document::Element*, uint64_t> > stack;
+      stack.push_back(std::make_pair(doc.root(), uint64_t(0)));
+      while (!stack.empty()) {
+        Document::Element* element = stack.back().first;
+        uint64_t depth = stack.back().second;
+        stack.pop_back();
+        auto stats = profile_.tags().find(element->name());
+        if (stats == profile_.tags().end())
+          continue;
+        AddAttributes(element, stats->second);
+
+        if (element->IsVoidElement() || depth >= max_depth_)
+          continue;
+        uint64_t children = Sample(stats->second.children);
+        std::vector<Document::Element*> child_elements;
+        for (uint64_t i = 0; i < children && nodes < max_nodes_; ++i) {
+          const std::string* name = Choose(stats->second.child_names);
+          if (!name)
+            break;
+          ++nodes;
+          if (*name == "#text") {
+            element->AddTextChild(MakeText(profile_.text_length(),
+                                           profile_.text_escapes(), "<&>"));
+          } else if (*name == "#raw") {
+            element->AddRawChild(MakeText(profile_.raw_length(),
+                                          ShapeHistogram(), ""));
+          } else {
+            child_elements.push_back(element->AddChild(*name));
+          }
+        }
+
+        // Visit the children in document order.
+        for (auto i = child_elements.rbegin(); i != child_elements.rend(); ++i)
+          stack.push_back(std::make_pair(*i, depth + 1));
+      }
+    }
+
+  private:
+    void AddAttributes(Document::Element* element,
+                       const ShapeProfile::TagStats& stats) {
+      uint64_t attributes = Sample(stats.attributes);
+      for (uint64_t i = 0; i < attributes; ++i) {
+        const std::string* name = Choose(stats.attribute_names);
+        if (!name)
+          break;
+        element->AddAttribute(*name,
+                              MakeText(profile_.value_length(),
+                                       profile_.value_escapes(), "\"&<"));
+      }
+    }
+
+    /// @brief Make a string of words, with a length and an escape density
+    /// drawn from histograms.
+    std::string MakeText(const ShapeHistogram& lengths,
+                         const ShapeHistogram& escapes,
+                         const char* special) {
+      uint64_t length = Sample(lengths);
+      uint64_t density = Sample(escapes);
+      std::string text;
+      text.reserve(length);
+      while (text.size() < length) {
+        if (density && special[0] && Next() % 1024 < density) {
+          text += special[Next() % std::strlen(special)];
+        } else if (!text.empty() && text.back() != ' ' && Next() % 6 == 0) {
+          text += ' ';
+        } else {
+          text += static_cast<char>('a' + Next() % 26);
+        }
+      }
+      return text;
+    }
+
+    /// @brief Draw a value from a histogram (uniformly within the drawn
+    /// bucket), or 0 if it is empty.
+    uint64_t Sample(const ShapeHistogram& histogram) {
+      uint64_t total = histogram.total();
+      if (!total)
+        return 0;
+      uint64_t r = Next() % total;
+      int bucket = 0;
+      for (; bucket < ShapeHistogram::kNumBuckets - 1; ++bucket) {
+        if (r < histogram.count(bucket))
+          break;
+        r -= histogram.count(bucket);
+      }
+      uint64_t min = ShapeHistogram::BucketMin(bucket);
+      uint64_t range = ShapeHistogram::BucketMax(bucket) - min + 1;
+      return range ? min + Next() % range : min + Next();
+    }
+
+    /// @brief Draw a name, weighted by the counts.
+    const std::string* Choose(const std::map<std::string, uint64_t>& counts) {
+      uint64_t total = 0;
+      for (auto i = counts.begin(); i != counts.end(); ++i)
+        total += i->second;
+      if (!total)
+        return nullptr;
+      uint64_t r = Next() % total;
+      for (auto i = counts.begin(); i != counts.end(); ++i) {
+        if (r < i->second)
+          return &i->first;
+        r -= i->second;
+      }
+      return nullptr;
+    }
+
+    /// @brief The SplitMix64 generator.
+    uint64_t Next() {
+      uint64_t z = (state_ += 0x9e3779b97f4a7c15ULL);
+      z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+      z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+      return z ^ (z >> 31);
+    }
+
+    const ShapeProfile& profile_;
+    uint64_t state_;
+    size_t max_nodes_;
+    uint64_t max_depth_;
+};
+
+} // namespace htmlgen
+
+#endif // SHAPE_PROFILE_H_
@@ -0,0 +1,690 @@
+// -*- mode: c++; tab-width: 2; indent-tabs-mode: nil; -*-
+//----------------------------------------------------------------------------
+// Binary snapshots of htmlgen documents that can be memory mapped.
+//----------------------------------------------------------------------------
+// This is free and unencumbered software released into the public domain.
+//
+// Anyone is free to copy, modify, publish, use, compile, sell, or
+// distribute this software, either in source code form or as a compiled
+// binary, for any purpose, commercial or non-commercial, and by any
+// means.
+//
+// In jurisdictions that recognize copyright laws, the author or authors
+// of this software dedicate any and all copyright interest in the
+// software to the public domain. We make this dedication for the benefit
+// of the public at large and to the detriment of our heirs and
+// successors. We intend this dedication to be an overt act of
+// relinquishment in perpetuity of all present and future rights to this
+// software under copyright law.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+// OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+// ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+//
+// For more information, please refer to <http://unlicense.org/>
+//----------------------------------------------------------------------------
+
+/// @file
+/// A snapshot is a compact binary form of a node tree, consisting of a
+/// header, a table of node records, a table of attribute records and a string
+/// table. The records refer to each other by index and to the strings by
+/// offset, so a snapshot can be used in place (e.g. directly from a memory
+/// mapped file) as a read-only document, without any deserialization step.
+///
+/// @code{.cpp}
+///   // Save a document.
+///   std::string data;
+///   if (htmlgen::Snapshot::Save(doc, data))
+///     htmlgen::Snapshot::SaveToFile(data, "page.snap");
+///
+///   // ...later, possibly in another process:
+///   htmlgen::SnapshotFile file;
+///   if (file.Open("page.snap"))
+///     file.view().GetHTML(html_string);
+/// @endcode
+///
+/// @note Snapshots use the native byte order, and are meant to be shared
+/// between processes on the same host.
+
+#ifndef SNAPSHOT_H_
+#define SNAPSHOT_H_
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "document.h"
+
+namespace htmlgen {
+
+/// @brief The binary layout of snapshots.
+namespace snapshot_format {
+
+const char kMagic[8] = {'H', 'G', 'S', 'N', 'A', 'P', '\0', '\0'};
+const uint32_t kByteOrderMark = 0x01020304;
+const uint32_t kVersion = 1;
+const uint32_t kNone = 0xffffffff;
+
+/// @brief Set in Header::flags if the snapshot holds a whole Document.
+const uint32_t kIsDocument = 1;
+
+/// @brief Set in NodeRecord::flags if the node is a void element.
+const uint32_t kIsVoid = 1;
+
+struct Header {
+  char magic[8];
+  uint32_t byte_order;
+  uint32_t version;
+  uint32_t flags;
+  uint32_t num_nodes;
+  uint32_t num_attributes;
+  uint32_t strings_size;
+};
+
+/// @brief A node. The nodes are stored in pre-order, with the root first.
+struct NodeRecord {
+  uint32_t type;          // A Document::Node::Type.
+  uint32_t flags;
+  uint32_t str;           // Element name, escaped text or raw HTML.
+  uint32_t str_len;
+  uint32_t first_attribute;
+  uint32_t num_attributes;
+  uint32_t parent;
+  uint32_t first_child;
+  uint32_t next_sibling;
+};
+
+struct AttributeRecord {
+  uint32_t name;
+  uint32_t name_len;
+  uint32_t value;  // Escaped.
+  uint32_t value_len;
+};
+
+} // namespace snapshot_format
+
+/// @brief A string in a snapshot (not zero terminated).
+struct SnapshotString {
+  const char* data;
+  size_t size;
+
+  std::string str() const {
+    return std::string(data, size);
+  }
+};
+
+class SnapshotView;
+
+/// @brief A handle to a node in a SnapshotView.
+///
+/// Nodes that are neither Elements nor TextNodes (e.g. RawNodes) hold their
+/// pre-rendered HTML.
+class SnapshotNode {
+  public:
+    SnapshotNode() : view_(nullptr), index_(snapshot_format::kNone) {}
+
+    SnapshotNode(const SnapshotView* view, uint32_t index) :
+        view_(view), index_(index) {}
+
+    /// @brief Check if this handle refers to a node.
+    bool valid() const {
+      return index_ != snapshot_format::kNone;
+    }
+
+    Document::Node::Type type() const {
+      return static_cast<Document::Node::Type>(record().type);
+    }
+
+    /// @brief Get the element name.
+    SnapshotString name() const;
+
+    /// @brief Get the escaped text of a text node, or the HTML of other nodes.
+    SnapshotString escaped_value() const;
+
+    size_t num_attributes() const {
+      return record().num_attributes;
+    }
+
+    /// @brief Get the name of an attribute.
+    SnapshotString attribute_name(size_t i) const;
+
+    /// @brief Get the escaped value of an attribute.
+    SnapshotString attribute_escaped_value(size_t i) const;
+
+    SnapshotNode parent() const {
+      return SnapshotNode(view_, record().parent);
+    }
+
+    SnapshotNode first_child() const {
+      return SnapshotNode(view_, record().first_child);
+    }
+
+    SnapshotNode next_sibling() const {
+      return SnapshotNode(view_, record().next_sibling);
+    }
+
+    /// @brief Write the HTML representation of this node and its subtree.
+    /// @param writer The Writer that receives the HTML.
+    void Write(Document::Writer& writer) const;
+
+    /// @brief Get an HTML formatted string representing this node.
+    /// @param[out] out The output string that will receive the HTML.
+    void GetHTML(std::string& out) const {
+      Document::Writer writer(out);
+      Write(writer);
+    }
+
+  private:
+    const snapshot_format::NodeRecord& record() const;
+
+    const SnapshotView* view_;
+    uint32_t index_;
+};
+
+/// @brief A read-only view of a snapshot that is stored in memory.
+///
+/// The view does not copy or own the snapshot data, which must stay valid for
+/// the lifetime of the view.
+class SnapshotView {
+  public:
+    SnapshotView() : nodes_(nullptr), attributes_(nullptr), strings_(nullptr),
+        num_nodes_(0), num_attributes_(0), strings_size_(0), flags_(0) {}
+
+    /// @brief Create a view of snapshot data.
+    ///
+    /// The data is validated, so that a truncated or corrupt snapshot results
+    /// in an invalid view rather than in out of bounds accesses.
+    /// @param data The snapshot data (must be 4-byte aligned).
+    /// @param size The size of the snapshot data, in bytes.
+    SnapshotView(const void* data, size_t size) : SnapshotView() {
+      if (!Validate(data, size)) {
+        num_nodes_ = 0;
+        return;
+      }
+      const char* base = static_cast<const char*>(data);
+      const snapshot_format::Header* header =
+          reinterpret_cast<const snapshot_format::Header*>(base);
+      nodes_ = reinterpret_cast<const snapshot_format::NodeRecord*>(
+          base + sizeof(snapshot_format::Header));
+      attributes_ = reinterpret_cast<const snapshot_format::AttributeRecord*>(
+          nodes_ + header->num_nodes);
+      strings_ = reinterpret_cast<const char*>(
+          attributes_ + header->num_attributes);
+      num_nodes_ = header->num_nodes;
+      num_attributes_ = header->num_attributes;
+      strings_size_ = header->strings_size;
+      flags_ = header->flags;
+    }
+
+    /// @brief Check if the view holds a valid snapshot.
+    bool valid() const {
+      return num_nodes_ > 0;
+    }
+
+    /// @brief Check if the snapshot holds a whole Document (rather than a
+    /// single subtree).
+    bool is_document() const {
+      return (flags_ & snapshot_format::kIsDocument) != 0;
+    }
+
+    /// @brief Get the root node of the snapshot.
+    SnapshotNode root() const {
+      return valid() ? SnapshotNode(this, 0) : SnapshotNode();
+    }
+
+    /// @brief Write the HTML representation of the snapshot.
+    ///
+    /// Document snapshots are written like Document::Write(), i.e. with a
+    /// DOCTYPE declaration.
+    /// @param writer The Writer that receives the HTML.
+    void Write(Document::Writer& writer) const {
+      if (!valid())
+        return;
+      if (is_document())
+        writer.out().append("<!DOCTYPE html>\n");
+      root().Write(writer);
+      if (is_document())
+        writer.out() += '\n';
+    }
+
+    /// @brief Get an HTML formatted string representing the snapshot.
+    /// @param[out] out The output string that will receive the HTML.
+    void GetHTML(std::string& out) const {
+      Document::Writer writer(out);
+      Write(writer);
+    }
+
+  private:
+    friend class SnapshotNode;
+
+    static bool InRange(uint32_t offset, uint32_t len, uint32_t size) {
+      return offset <= size && len <= size - offset;
+    }
+
+    static bool Validate(const void* data, size_t size) {
+      using namespace snapshot_format;
+      if (!data || (reinterpret_cast<uintptr_t>(data) & 3) != 0 ||
+          size < sizeof(Header))
+        return false;
+      const Header* header = static_cast<const Header*>(data);
+      if (std::memcmp(header->magic, kMagic, sizeof(kMagic)) != 0 ||
+          header->byte_order != kByteOrderMark ||
+          header->version != kVersion || header->num_nodes == 0)
+        return false;
+      uint64_t expected_size =
+          sizeof(Header) +
+          static_cast<uint64_t>(header->num_nodes) * sizeof(NodeRecord) +
+          static_cast<uint64_t>(header->num_attributes) *
+              sizeof(AttributeRecord) +
+          header->strings_size;
+      if (expected_size != size)
+        return false;
+
+      // Check all references. Requiring the nodes to be stored in pre-order
+      // also guarantees that the links can not form cycles.
+      const NodeRecord* nodes = reinterpret_cast<const NodeRecord*>(header + 1);
+      const AttributeRecord* attributes =
+          reinterpret_cast<const AttributeRecord*>(nodes + header->num_nodes);
+      for (uint32_t i = 0; i < header->num_nodes; ++i) {
+        const NodeRecord& node = nodes[i];
+        if (node.type > Document::Node::kOther ||
+            !InRange(node.str, node.str_len, header->strings_size) ||
+            !InRange(node.first_attribute, node.num_attributes,
+                     header->num_attributes))
+          return false;
+        if (i == 0 ? (node.parent != kNone || node.next_sibling != kNone)
+                   : (node.parent >= i))
+          return false;
+        if (node.first_child != kNone &&
+            (node.first_child != i + 1 ||
+             node.first_child >= header->num_nodes ||
+             node.type != Document::Node::kElement ||
+             nodes[node.first_child].parent != i))
+          return false;
+        if (node.next_sibling != kNone &&
+            (node.next_sibling <= i || node.next_sibling >= header->num_nodes ||
+             nodes[node.next_sibling].parent != node.parent))
+          return false;
+      }
+      for (uint32_t i = 0; i < header->num_attributes; ++i) {
+        const AttributeRecord& attribute = attributes[i];
+        if (!InRange(attribute.name, attribute.name_len,
+                     header->strings_size) ||
+            !InRange(attribute.value, attribute.value_len,
+                     header->strings_size))
+          return false;
+      }
+      return true;
+    }
+
+    const snapshot_format::NodeRecord* nodes_;
+    const snapshot_format::AttributeRecord* attributes_;
+    const char* strings_;
+    uint32_t num_nodes_;
+    uint32_t num_attributes_;
+    uint32_t strings_size_;
+    uint32_t flags_;
+};
+
+inline const snapshot_format::NodeRecord& SnapshotNode::record() const {
+  return view_->nodes_[index_];
+}
+
+inline SnapshotString SnapshotNode::name() const {
+  const snapshot_format::NodeRecord& r = record();
+  SnapshotString result = {view_->strings_ + r.str,
+                           r.type == Document::Node::kElement ? r.str_len : 0};
+  return result;
+}
+
+inline SnapshotString SnapshotNode::escaped_value() const {
+  const snapshot_format::NodeRecord& r = record();
+  SnapshotString result = {view_->strings_ + r.str,
+                           r.type != Document::Node::kElement ? r.str_len : 0};
+  return result;
+}
+
+inline SnapshotString SnapshotNode::attribute_name(size_t i) const {
+  const snapshot_format::AttributeRecord& a =
+      view_->attributes_[record().first_attribute + i];
+  SnapshotString result = {view_->strings_ + a.name, a.name_len};
+  return result;
+}
+
+inline SnapshotString SnapshotNode::attribute_escaped_value(size_t i) const {
+  const snapshot_format::AttributeRecord& a =
+      view_->attributes_[record().first_attribute + i];
+  SnapshotString result = {view_->strings_ + a.value, a.value_len};
+  return result;
+}
+
+inline void SnapshotNode::Write(Document::Writer& writer) const {
+  using snapshot_format::kNone;
+  using snapshot_format::NodeRecord;
+  using snapshot_format::AttributeRecord;
+
+  std::string& out = writer.out();
+  const NodeRecord* nodes = view_->nodes_;
+  const char* strings = view_->strings_;
+  uint32_t index = index_;
+  while (true) {
+    const NodeRecord& node = nodes[index];
+    if (node.type == Document::Node::kElement) {
+      out += '<';
+      out.append(strings + node.str, node.str_len);
+      const AttributeRecord* a = view_->attributes_ + node.first_attribute;
+      const AttributeRecord* a_end = a + node.num_attributes;
+      for (; a != a_end; ++a) {
+        const char* value = strings + a->value;
+        out += ' ';
+        out.append(strings + a->name, a->name_len);
+        out.append("=\"", 2);
+        const Document::AttributeRewrite* rewrite = writer.FindAttributeRewrite(
+            strings + a->name, a->name_len, value, a->value_len);
+        if (rewrite) {
+          out.append(rewrite->escaped_prefix());
+          out.append(value, a->value_len);
+          out.append(rewrite->escaped_suffix());
+        }
+        else
+          out.append(value, a->value_len);
+        out += '"';
+      }
+      out += '>';
+      if (node.first_child != kNone) {
+        index = node.first_child;
+        continue;
+      }
+      if (!(node.flags & snapshot_format::kIsVoid)) {
+        out.append("</", 2);
+        out.append(strings + node.str, node.str_len);
+        out += '>';
+      }
+    }
+    else
+      out.append(strings + node.str, node.str_len);
+
+    // Advance to the next sibling, closing the completed elements.
+    while (index != index_ && nodes[index].next_sibling == kNone) {
+      index = nodes[index].parent;
+      out.append("</", 2);
+      out.append(strings + nodes[index].str, nodes[index].str_len);
+      out += '>';
+    }
+    if (index == index_)
+      return;
+    index = nodes[index].next_sibling;
+  }
+}
+
+/// @brief Functions for creating snapshots.
+class Snapshot {
+  public:
+    /// @brief Create a snapshot of a Document.
+    /// @param doc The document.
+    /// @param[out] out The string that will receive the snapshot data.
+    /// @returns false if the document is too large for the snapshot format
+    /// (the offsets and counts are 32 bits), in which case out is cleared.
+    static bool Save(const Document& doc, std::string& out) {
+      Builder builder;
+      builder.AddNode(*doc.root(), snapshot_format::kNone);
+      return builder.Finish(snapshot_format::kIsDocument, out);
+    }
+
+    /// @brief Create a snapshot of a subtree.
+    /// @param root The root of the subtree.
+    /// @param[out] out The string that will receive the snapshot data.
+    /// @returns false if the subtree is too large for the snapshot format, in
+    /// which case out is cleared.
+    static bool Save(const Document::Node& root, std::string& out) {
+      Builder builder;
+      builder.AddNode(root, snapshot_format::kNone);
+      return builder.Finish(0, out);
+    }
+
+    /// @brief Write snapshot data to a file.
+    ///
+    /// The data is first written to a uniquely named temporary file in the
+    /// same directory, which is synced to disk and then renamed. Processes
+    /// that have the old file mapped are not affected, and concurrent
+    /// writers do not interfere (the last rename wins).
+    /// @param data The snapshot data.
+    /// @param path The file name.
+    /// @returns true on success.
+    static bool SaveToFile(const std::string& data, const char* path) {
+      std::string tmp_path(path);
+      tmp_path.append(".XXXXXX");
+      int fd = ::mkstemp(&tmp_path[0]);
+      if (fd < 0)
+        return false;
+      bool ok = ::fchmod(fd, 0644) == 0;
+      const char* p = data.data();
+      size_t len = data.size();
+      while (ok && len > 0) {
+        ssize_t n = ::write(fd, p, len);
+        if (n < 0 && errno == EINTR)
+          continue;
+        ok = n > 0;
+        if (ok) {
+          p += n;
+          len -= static_cast<size_t>(n);
+        }
+      }
+      ok = ok && ::fsync(fd) == 0;
+      ok = (::close(fd) == 0) && ok;
+      if (ok)
+        ok = std::rename(tmp_path.c_str(), path) == 0;
+      if (!ok)
+        ::unlink(tmp_path.c_str());
+      return ok;
+    }
+
+  private:
+    class Builder {
+      public:
+        uint32_t AddNode(const Document::Node& node, uint32_t parent) {
+          if (nodes_.size() >= snapshot_format::kNone) {
+            overflow_ = true;
+            return snapshot_format::kNone;
+          }
+          uint32_t index = static_cast<uint32_t>(nodes_.size());
+          snapshot_format::NodeRecord record;
+          std::memset(&record, 0, sizeof(record));
+          record.type = node.type();
+          record.parent = parent;
+          record.first_child = snapshot_format::kNone;
+          record.next_sibling = snapshot_format::kNone;
+          record.first_attribute = static_cast<uint32_t>(attributes_.size());
+
+          if (node.type() == Document::Node::kElement) {
+            const Document::Element& element =
+                static_cast<const Document::Element&>(node);
+            AddName(element.name(), &record.str, &record.str_len);
+            if (element.IsVoidElement())
+              record.flags |= snapshot_format::kIsVoid;
+            const std::vector<Document::Attribute>& attributes =
+                element.attributes();
+            if (attributes_.size() + attributes.size() >=
+                snapshot_format::kNone) {
+              overflow_ = true;
+              return snapshot_format::kNone;
+            }
+            for (auto i = attributes.begin(); i != attributes.end(); ++i) {
+              snapshot_format::AttributeRecord a;
+              AddName(i->name(), &a.name, &a.name_len);
+              AddString(i->escaped_value(), &a.value, &a.value_len);
+              attributes_.push_back(a);
+            }
+            record.num_attributes =
+                static_cast<uint32_t>(attributes.size());
+            nodes_.push_back(record);
+
+            uint32_t prev = snapshot_format::kNone;
+            for (const Document::Node* child = element.first_child(); child;
+                 child = child->next_sibling()) {
+              uint32_t child_index = AddNode(*child, index);
+              if (overflow_)
+                return snapshot_format::kNone;
+              if (prev == snapshot_format::kNone)
+                nodes_[index].first_child = child_index;
+              else
+                nodes_[prev].next_sibling = child_index;
+              prev = child_index;
+            }
+          } else if (node.type() == Document::Node::kText) {
+            AddString(static_cast<const Document::TextNode&>(node)
+                          .escaped_value(),
+                      &record.str, &record.str_len);
+            nodes_.push_back(record);
+          } else {
+            std::string html;
+            node.GetHTML(html);
+            AddString(html, &record.str, &record.str_len);
+            nodes_.push_back(record);
+          }
+          return index;
+        }
+
+        Builder() : overflow_(false) {}
+
+        /// @returns false if the node tree did not fit in the format.
+        bool Finish(uint32_t flags, std::string& out) {
+          out.clear();
+          if (overflow_)
+            return false;
+          snapshot_format::Header header;
+          std::memcpy(header.magic, snapshot_format::kMagic,
+                      sizeof(header.magic));
+          header.byte_order = snapshot_format::kByteOrderMark;
+          header.version = snapshot_format::kVersion;
+          header.flags = flags;
+          header.num_nodes = static_cast<uint32_t>(nodes_.size());
+          header.num_attributes = static_cast<uint32_t>(attributes_.size());
+          header.strings_size = static_cast<uint32_t>(strings_.size());
+
+          out.reserve(sizeof(header) +
+                      nodes_.size() * sizeof(snapshot_format::NodeRecord) +
+                      attributes_.size() *
+                          sizeof(snapshot_format::AttributeRecord) +
+                      strings_.size());
+          out.append(reinterpret_cast<const char*>(&header), sizeof(header));
+          if (!nodes_.empty())
+            out.append(reinterpret_cast<const char*>(nodes_.data()),
+                       nodes_.size() * sizeof(snapshot_format::NodeRecord));
+          if (!attributes_.empty())
+            out.append(reinterpret_cast<const char*>(attributes_.data()),
+                       attributes_.size() *
+                           sizeof(snapshot_format::AttributeRecord));
+          out.append(strings_);
+          return true;
+        }
+
+      private:
+        void AddString(const std::string& str, uint32_t* offset,
+                       uint32_t* len) {
+          // The size of the string table is stored in 32 bits.
+          if (str.size() > snapshot_format::kNone - strings_.size()) {
+            overflow_ = true;
+            *offset = 0;
+            *len = 0;
+            return;
+          }
+          *offset = static_cast<uint32_t>(strings_.size());
+          *len = static_cast<uint32_t>(str.size());
+          strings_.append(str);
+        }
+
+        /// @brief Add a tag or attribute name. Each distinct name is only
+        /// stored once.
+        void AddName(const std::string& name, uint32_t* offset,
+                     uint32_t* len) {
+          auto i = names_.find(name);
+          if (i != names_.end()) {
+            *offset = i->second;
+            *len = static_cast<uint32_t>(name.size());
+            return;
+          }
+          AddString(name, offset, len);
+          names_[name] = *offset;
+        }
+
+        std::vector<snapshot_format::NodeRecord> nodes_;
+        std::vector<snapshot_format::AttributeRecord> attributes_;
+        std::string strings_;
+        std::unordered_map<std::string, uint32_t> names_;
+        bool overflow_;
+    };
+};
+
+/// @brief A snapshot file that is memory mapped for reading.
+class SnapshotFile {
+  public:
+    SnapshotFile() : data_(nullptr), size_(0) {}
+
+    ~SnapshotFile() {
+      Close();
+    }
+
+    /// @brief Map a snapshot file.
+    /// @param path The file name.
+    /// @returns true if the file could be mapped and holds a valid snapshot.
+    bool Open(const char* path) {
+      Close();
+      int fd = ::open(path, O_RDONLY);
+      if (fd < 0)
+        return false;
+      struct stat st;
+      if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+        void* data = ::mmap(nullptr, static_cast<size_t>(st.st_size),
+                            PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+          data_ = data;
+          size_ = static_cast<size_t>(st.st_size);
+        }
+      }
+      ::close(fd);
+      view_ = SnapshotView(data_, size_);
+      if (!view_.valid())
+        Close();
+      return view_.valid();
+    }
+
+    /// @brief Unmap the file.
+    void Close() {
+      if (data_)
+        ::munmap(data_, size_);
+      data_ = nullptr;
+      size_ = 0;
+      view_ = SnapshotView();
+    }
+
+    /// @brief Get a view of the mapped snapshot.
+    const SnapshotView& view() const {
+      return view_;
+    }
+
+  private:
+    SnapshotFile(const SnapshotFile&) = delete;
+    SnapshotFile& operator=(const SnapshotFile&) = delete;
+
+    void* data_;
+    size_t size_;
+    SnapshotView view_;
+};
+
+} // namespace htmlgen
+
+#endif // SNAPSHOT_H_